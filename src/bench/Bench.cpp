@@ -0,0 +1,445 @@
+/*
+ * Micro-benchmarks of the plugin's hot paths, run outside the server:
+ *     mrcpmod_bench [--filter name] [--threads max] [--min-time ms] [--label text]
+ * Every case runs at 1, 2, 4 ... max threads and the results are printed as one json document,
+ * ns_per_op is the time a thread spends per op, allocs_per_op counts operator new calls.
+ */
+#include "Recognize.h"
+#include "Synthesizer.h"
+#include "ini/IniParser.h"
+#include "timer/TimerWheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+static thread_local uint64_t sAllocs = 0;
+
+void* operator new(size_t size)
+{
+    sAllocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+namespace {
+
+#define BENCH_CONFIG_FILE "/tmp/mrcpmod_bench.ini"
+#define BENCH_FRAME_BYTES 320
+
+struct Case {
+    string name;
+    /** per run, before the threads start, threads is the number about to run */
+    std::function<void(int threads)> setup;
+    /** one op of thread index */
+    std::function<void(int thread, uint64_t i)> op;
+    std::function<void()> teardown;
+};
+
+struct Result {
+    string name;
+    int threads = 0;
+    uint64_t ops = 0;
+    double nsPerOp = 0;
+    double opsPerSec = 0;
+    double allocsPerOp = 0;
+};
+
+struct Options {
+    string filter;
+    string label;
+    int maxThreads = 0;
+    int minTime = 200;
+};
+
+class BenchRecognize : public Recognize {
+public:
+    explicit BenchRecognize(const string& voiceId)
+    {
+        mVoiceId = voiceId;
+        mChannelId = voiceId;
+    }
+    int init() override
+    {
+        mIsReady = true;
+        return 0;
+    }
+    void stop() override
+    {
+        mIsReady = false;
+    }
+    int write(char* buff, int len) override
+    {
+        return 0;
+    }
+    void flush() override
+    {
+    }
+};
+
+/** plays text synthesized by hand, pushData() stands in for the vendor callback */
+class BenchSynthesizer : public Synthesizer {
+public:
+    explicit BenchSynthesizer(const string& channelId)
+    {
+        mChannelId = channelId;
+        mVoiceId = channelId;
+        mIniParser = std::make_shared<IniParser>();
+        mIniParser->setFileName(BENCH_CONFIG_FILE);
+    }
+    int init() override
+    {
+        return 0;
+    }
+    void stop() override
+    {
+    }
+};
+
+// runs ops of every thread between two barriers, returns the wall time of the slowest thread
+double RunOnce(const Case& c, int threads, uint64_t ops, uint64_t& allocs)
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    int ready = 0;
+    bool go = false;
+    std::atomic<uint64_t> totalAllocs { 0 };
+    std::vector<double> elapsed(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            {
+                std::unique_lock<std::mutex> l(mutex);
+                ready++;
+                cond.notify_all();
+                cond.wait(l, [&]() { return go; });
+            }
+            uint64_t before = sAllocs;
+            auto begin = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < ops; i++) {
+                c.op(t, i);
+            }
+            elapsed[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            totalAllocs += sAllocs - before;
+        });
+    }
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        cond.wait(l, [&]() { return ready == threads; });
+        go = true;
+        cond.notify_all();
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    allocs = totalAllocs;
+    double slowest = 0;
+    for (double e : elapsed) {
+        slowest = std::max(slowest, e);
+    }
+    return slowest;
+}
+
+Result Run(const Case& c, int threads, const Options& options)
+{
+    // grow the op count until a run lasts long enough to trust the clock
+    uint64_t ops = 64;
+    uint64_t allocs = 0;
+    double elapsed = 0;
+    while (true) {
+        if (c.setup) {
+            c.setup(threads);
+        }
+        elapsed = RunOnce(c, threads, ops, allocs);
+        if (c.teardown) {
+            c.teardown();
+        }
+        if (elapsed >= options.minTime * 1e6 || ops >= (1ULL << 40)) {
+            break;
+        }
+        double scale = elapsed > 0 ? options.minTime * 1e6 * 1.2 / elapsed : 100;
+        ops = (uint64_t)(ops * std::min(100.0, std::max(2.0, scale)));
+    }
+    Result result;
+    result.name = c.name;
+    result.threads = threads;
+    result.ops = ops * threads;
+    result.nsPerOp = elapsed / ops;
+    result.opsPerSec = result.ops / (elapsed / 1e9);
+    result.allocsPerOp = (double)allocs / result.ops;
+    return result;
+}
+
+void WriteConfig()
+{
+    std::ofstream ofs(BENCH_CONFIG_FILE);
+    ofs << "[generic]\n"
+        << "type=bench\n"
+        << "synth_buffer_time=10000\n"
+        << "synth_coalesce=0\n"
+        << "synth_watchdog_timeout=3600000\n"
+        << "[bench]\n"
+        << "appid=1234567890\n"
+        << "sample_rates=8000\n";
+}
+
+string MakeId(size_t i)
+{
+    char id[40];
+    snprintf(id, sizeof(id), "%08zx-0000-4000-8000-%012zx", i, i * 2654435761u);
+    return id;
+}
+
+std::vector<Case> MakeCases()
+{
+    std::vector<Case> cases;
+
+    // registry lookups the vendor callbacks make for every result
+    static std::vector<string> voiceIds;
+    Case c;
+    c.name = "recognize_get";
+    c.setup = [](int threads) {
+        voiceIds.clear();
+        for (size_t i = 0; i < 1000; i++) {
+            voiceIds.push_back(MakeId(i));
+            Recognize::Set(voiceIds.back(), std::make_shared<BenchRecognize>(voiceIds.back()));
+        }
+    };
+    c.op = [](int thread, uint64_t i) {
+        auto recognize = Recognize::GetRecognize(voiceIds[(i * 7 + thread * 131) % voiceIds.size()]);
+        if (!recognize) {
+            abort();
+        }
+    };
+    c.teardown = []() {
+        for (auto& voiceId : voiceIds) {
+            Recognize::Del(voiceId, voiceId);
+        }
+    };
+    cases.push_back(c);
+
+    // channel open and close churning the same registry
+    c = Case();
+    c.name = "recognize_set_del";
+    c.op = [](int thread, uint64_t i) {
+        string id = MakeId((uint64_t)thread << 32 | (i & 1023));
+        Recognize::Set(id, std::make_shared<BenchRecognize>(id));
+        Recognize::Del(id, id);
+    };
+    cases.push_back(c);
+
+    // vendor thread push and media thread read of one 20ms frame, a synthesizer per thread
+    static std::vector<std::shared_ptr<BenchSynthesizer>> synthesizers;
+    c = Case();
+    c.name = "synth_push_read";
+    c.setup = [](int threads) {
+        synthesizers.clear();
+        for (int t = 0; t < threads; t++) {
+            auto synthesizer = std::make_shared<BenchSynthesizer>("bench-" + std::to_string(t));
+            synthesizer->setText("bench");
+            synthesizer->setFormat("LPCM", 8000);
+            synthesizer->start();
+            synthesizers.push_back(synthesizer);
+        }
+    };
+    c.op = [](int thread, uint64_t i) {
+        char frame[BENCH_FRAME_BYTES];
+        memset(frame, (int)(i & 0x7F), sizeof(frame));
+        synthesizers[thread]->pushData(0, frame, sizeof(frame));
+        synthesizers[thread]->read(frame, sizeof(frame));
+    };
+    c.teardown = []() {
+        synthesizers.clear();
+    };
+    cases.push_back(c);
+
+    // same as above, encoded to PCMU on the way out
+    c.name = "synth_push_read_pcmu";
+    c.setup = [](int threads) {
+        synthesizers.clear();
+        for (int t = 0; t < threads; t++) {
+            auto synthesizer = std::make_shared<BenchSynthesizer>("bench-" + std::to_string(t));
+            synthesizer->setText("bench");
+            synthesizer->setFormat("PCMU", 8000);
+            synthesizer->start();
+            synthesizers.push_back(synthesizer);
+        }
+    };
+    c.op = [](int thread, uint64_t i) {
+        char frame[BENCH_FRAME_BYTES];
+        memset(frame, (int)(i & 0x7F), sizeof(frame));
+        synthesizers[thread]->pushData(0, frame, sizeof(frame));
+        synthesizers[thread]->read(frame, sizeof(frame) / 2);
+    };
+    cases.push_back(c);
+
+    // RECOGNITION-COMPLETE body, from the vendor text to the NLSML result
+    c = Case();
+    c.name = "recognize_complete_format";
+    c.op = [](int thread, uint64_t i) {
+        static const string voiceId = MakeId(1);
+        static const string text = "我要查询上个月的话费账单";
+        char* body = Recognize::MakeCompleteBody(voiceId, text);
+        string result = Recognize::FormatResult(body);
+        Recognize::FreeCompleteBody(body);
+        if (result.empty()) {
+            abort();
+        }
+    };
+    cases.push_back(c);
+
+    // session bookkeeping drawn from a per-session arena, slabs recycled between sessions
+    c = Case();
+    c.name = "arena_session";
+    c.op = [](int thread, uint64_t i) {
+        Arena arena;
+        std::vector<size_t, ArenaAllocator<size_t>> parts { ArenaAllocator<size_t>(&arena) };
+        for (size_t n = 0; n < 32; n++) {
+            parts.push_back(n);
+            arena.copy("segment text of a session", 25);
+        }
+    };
+    cases.push_back(c);
+
+    // request timeouts of a busy engine, most are cancelled by input before they fire
+    c = Case();
+    c.name = "timer_wheel";
+    c.op = [](int thread, uint64_t i) {
+        static thread_local TimerWheel wheel(10);
+        static thread_local std::vector<TimerWheel::Id> ids(4096);
+        static thread_local int64_t now = 0;
+        TimerWheel::Id& id = ids[i % ids.size()];
+        wheel.cancel(id);
+        id = wheel.schedule(now, 5000 + (int64_t)(i % 64) * 100, [] {});
+        now += 1;
+        wheel.advance(now);
+    };
+    cases.push_back(c);
+
+    // config reads, each session does a dozen of them on start
+    static IniParser ini;
+    c = Case();
+    c.name = "ini_get";
+    c.setup = [](int threads) {
+        ini.setFileName(BENCH_CONFIG_FILE);
+    };
+    c.op = [](int thread, uint64_t i) {
+        int value = 0;
+        ini.get("generic", "synth_buffer_time", value);
+        if (value == 0) {
+            abort();
+        }
+    };
+    cases.push_back(c);
+
+    return cases;
+}
+
+string Escape(const string& s)
+{
+    string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+        }
+        out.push_back(c);
+    }
+    return out;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        if (arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (arg == "--threads") {
+            options.maxThreads = atoi(argv[++i]);
+        } else if (arg == "--min-time") {
+            options.minTime = atoi(argv[++i]);
+        } else if (arg == "--label") {
+            options.label = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    if (options.maxThreads <= 0) {
+        options.maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (options.minTime <= 0) {
+        options.minTime = 200;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--filter name] [--threads max] [--min-time ms] [--label text]\n", argv[0]);
+        return 1;
+    }
+    WriteConfig();
+    std::vector<Result> results;
+    for (auto& c : MakeCases()) {
+        if (!options.filter.empty() && c.name.find(options.filter) == string::npos) {
+            continue;
+        }
+        for (int threads = 1;; threads *= 2) {
+            threads = std::min(threads, options.maxThreads);
+            results.push_back(Run(c, threads, options));
+            const Result& r = results.back();
+            fprintf(stderr, "%-28s threads:%-3d %10.1f ns/op %8.2f allocs/op\n", r.name.c_str(), r.threads, r.nsPerOp, r.allocsPerOp);
+            if (threads == options.maxThreads) {
+                break;
+            }
+        }
+    }
+    unlink(BENCH_CONFIG_FILE);
+
+    std::ostringstream oss;
+    oss << "{\n  \"label\": \"" << Escape(options.label) << "\",\n"
+        << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        oss << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"threads\": " << r.threads
+            << ", \"ops\": " << r.ops << ", \"ns_per_op\": " << r.nsPerOp << ", \"ops_per_sec\": " << r.opsPerSec
+            << ", \"allocs_per_op\": " << r.allocsPerOp << "}";
+    }
+    oss << "\n  ]\n}\n";
+    fputs(oss.str().c_str(), stdout);
+    return 0;
+}
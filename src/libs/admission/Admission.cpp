@@ -0,0 +1,371 @@
+#include "Admission.h"
+#include "metrics/Metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#define ADMISSION_SECTION "admission"
+#define DEFAULT_QUEUE_SIZE 16
+#define DEFAULT_MAX_WAIT 1000
+#define DEFAULT_SUSPEND_TIME 60000
+
+Admission::State& Admission::Instance()
+{
+    static State state;
+    return state;
+}
+
+int64_t Admission::NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Admission::Lease::Lease(Backend* backend, Slot* slot)
+    : mBackend(backend)
+    , mSlot(slot)
+{
+}
+
+Admission::Lease::~Lease()
+{
+    Admission::Release(mBackend, mSlot);
+}
+
+const Admission::Credential& Admission::Lease::credential() const
+{
+    return mSlot->account.credential;
+}
+
+Admission::Backend* Admission::GetBackend(State& s, const string& name)
+{
+    auto it = s.backends.find(name);
+    if (it != s.backends.end()) {
+        return it->second.get();
+    }
+    std::unique_ptr<Backend> backend(new Backend());
+    backend->name = name;
+    string prefix = "admission_" + name;
+    backend->inUseMetric = &Metrics::Get(prefix + "_in_use");
+    backend->queuedMetric = &Metrics::Get(prefix + "_queued");
+    backend->admittedMetric = &Metrics::Get(prefix + "_admitted_total");
+    backend->rejectedMetric = &Metrics::Get(prefix + "_rejected_total");
+    backend->timeoutMetric = &Metrics::Get(prefix + "_timeout_total");
+    backend->waitMetric = &Metrics::Get(prefix + "_queue_wait_ms_total");
+    backend->waitMaxMetric = &Metrics::Get(prefix + "_queue_wait_ms_max");
+    // not configured, a single unlimited account without credential
+    std::unique_ptr<Slot> slot(new Slot());
+    slot->account.credential.name = "default";
+    slot->inUseMetric = &Metrics::Get(prefix + "_default_in_use");
+    slot->suspendedMetric = &Metrics::Get(prefix + "_default_suspended_total");
+    backend->slots.push_back(std::move(slot));
+    return s.backends.emplace(name, std::move(backend)).first->second.get();
+}
+
+void Admission::Configure(const string& backend, const std::vector<Account>& accounts, int queueSize, int maxWait, const std::set<int>& quotaCodes, int suspendTime)
+{
+    State& s = Instance();
+    std::vector<Done> done;
+    {
+        std::lock_guard<std::mutex> l(s.mutex);
+        Backend* b = GetBackend(s, backend);
+        b->queueSize = queueSize > 0 ? queueSize : 0;
+        b->maxWait = maxWait > 0 ? maxWait : 0;
+        b->quotaCodes = quotaCodes;
+        b->suspendTime = suspendTime;
+        // accounts are matched by name, sessions on a removed one run to their end
+        for (auto& slot : b->slots) {
+            slot->isRemoved = !accounts.empty();
+        }
+        for (auto& account : accounts) {
+            Slot* slot = nullptr;
+            for (auto& existing : b->slots) {
+                if (existing->account.credential.name == account.credential.name) {
+                    slot = existing.get();
+                }
+            }
+            if (!slot) {
+                b->slots.emplace_back(new Slot());
+                slot = b->slots.back().get();
+                string prefix = "admission_" + backend + "_" + account.credential.name;
+                slot->inUseMetric = &Metrics::Get(prefix + "_in_use");
+                slot->suspendedMetric = &Metrics::Get(prefix + "_suspended_total");
+            }
+            slot->account = account;
+            slot->account.limit = std::max(account.limit, 0);
+            slot->account.weight = std::max(account.weight, 1);
+            slot->isRemoved = false;
+        }
+        // more room admits the waiters at once
+        Admit(b, done);
+    }
+    Run(done);
+}
+
+std::vector<Admission::Account> Admission::Load(IniParser& ini, const string& type, const string& kind)
+{
+    string backend = type + "_" + kind;
+    int limit = 0;
+    int queueSize = DEFAULT_QUEUE_SIZE;
+    int maxWait = DEFAULT_MAX_WAIT;
+    ini.get(ADMISSION_SECTION, backend + "_limit", limit);
+    ini.get(ADMISSION_SECTION, backend + "_queue", queueSize);
+    ini.get(ADMISSION_SECTION, backend + "_max_wait", maxWait);
+    // the vendor section is the first account, accounts= lists the sections of the others
+    std::vector<string> sections { type };
+    string names;
+    ini.get(type, "accounts", names);
+    std::istringstream iss(names);
+    string name;
+    while (std::getline(iss, name, ',')) {
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (!name.empty()) {
+            sections.push_back(name);
+        }
+    }
+    std::vector<Account> accounts;
+    for (auto& section : sections) {
+        Account account;
+        account.credential.name = section;
+        ini.get(section, "appid", account.credential.appId);
+        ini.get(section, "secretid", account.credential.secretId);
+        ini.get(section, "secretkey", account.credential.secretKey);
+        account.limit = limit;
+        ini.get(section, kind + "_limit", account.limit);
+        ini.get(section, "weight", account.weight);
+        account.limit = std::max(account.limit, 0);
+        account.weight = std::max(account.weight, 1);
+        accounts.push_back(account);
+    }
+    string codes;
+    int suspendTime = DEFAULT_SUSPEND_TIME;
+    ini.get(type, "quota_codes", codes);
+    ini.get(type, "suspend_time", suspendTime);
+    std::set<int> quotaCodes;
+    std::istringstream codeStream(codes);
+    string code;
+    while (std::getline(codeStream, code, ',')) {
+        if (!code.empty()) {
+            quotaCodes.insert(atoi(code.c_str()));
+        }
+    }
+    Configure(backend, accounts, queueSize, maxWait, quotaCodes, suspendTime);
+    return accounts;
+}
+
+Admission::Result Admission::Acquire(const string& backend, Priority priority, Ticket& ticket, Callback callback, uint64_t* waitId)
+{
+    State& s = Instance();
+    std::vector<Done> done;
+    Result result = REJECTED;
+    {
+        std::lock_guard<std::mutex> l(s.mutex);
+        Backend* b = GetBackend(s, backend);
+        Slot* slot = b->queued == 0 ? Pick(b, NowMs()) : nullptr;
+        if (slot) {
+            ticket = MakeTicket(b, slot);
+            (*b->admittedMetric)++;
+            return ADMITTED;
+        }
+        if (b->queued >= b->queueSize) {
+            // the newest waiter of a lower priority makes room, otherwise this one is rejected
+            for (int p = PRIORITY_COUNT - 1; p > priority; p--) {
+                if (!b->queues[p].empty()) {
+                    auto it = b->queues[p].end() - 1;
+                    (*b->rejectedMetric)++;
+                    done.push_back(Done { std::move(it->callback), nullptr });
+                    Remove(b, b->queues[p], it);
+                    break;
+                }
+            }
+        }
+        if (b->queued < b->queueSize && b->maxWait > 0) {
+            Waiter waiter;
+            waiter.id = ++s.nextId;
+            waiter.queued = NowMs();
+            waiter.callback = std::move(callback);
+            b->queues[priority].push_back(std::move(waiter));
+            b->queued++;
+            (*b->queuedMetric)++;
+            *waitId = s.nextId;
+            result = QUEUED;
+        } else {
+            (*b->rejectedMetric)++;
+        }
+    }
+    Run(done);
+    return result;
+}
+
+bool Admission::Cancel(const string& backend, uint64_t waitId)
+{
+    State& s = Instance();
+    std::lock_guard<std::mutex> l(s.mutex);
+    Backend* b = GetBackend(s, backend);
+    for (auto& queue : b->queues) {
+        for (auto it = queue.begin(); it != queue.end(); it++) {
+            if (it->id == waitId) {
+                Remove(b, queue, it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+Admission::ErrorAction Admission::OnError(const Ticket& ticket, int code)
+{
+    if (!ticket) {
+        return IGNORED;
+    }
+    State& s = Instance();
+    std::lock_guard<std::mutex> l(s.mutex);
+    Backend* b = ticket->mBackend;
+    Slot* slot = ticket->mSlot;
+    if (b->suspendTime <= 0 || b->quotaCodes.find(code) == b->quotaCodes.end()) {
+        return IGNORED;
+    }
+    int64_t now = NowMs();
+    // the last account in rotation is kept, suspending it would fail every session rather than some
+    bool hasOther = false;
+    for (auto& other : b->slots) {
+        if (other.get() != slot && !other->isRemoved && other->suspendUntil <= now) {
+            hasOther = true;
+        }
+    }
+    if (!hasOther) {
+        return KEPT;
+    }
+    if (slot->suspendUntil <= now) {
+        (*slot->suspendedMetric)++;
+    }
+    slot->suspendUntil = now + b->suspendTime;
+    return SUSPENDED;
+}
+
+bool Admission::IsUsable(const Ticket& ticket)
+{
+    if (!ticket) {
+        return false;
+    }
+    State& s = Instance();
+    std::lock_guard<std::mutex> l(s.mutex);
+    Slot* slot = ticket->mSlot;
+    return !slot->isRemoved && slot->suspendUntil <= NowMs();
+}
+
+bool Admission::HasWaiters(const string& backend)
+{
+    State& s = Instance();
+    std::lock_guard<std::mutex> l(s.mutex);
+    return GetBackend(s, backend)->queued > 0;
+}
+
+void Admission::Expire()
+{
+    State& s = Instance();
+    std::vector<Done> done;
+    {
+        std::lock_guard<std::mutex> l(s.mutex);
+        int64_t now = NowMs();
+        for (auto& entry : s.backends) {
+            Backend* b = entry.second.get();
+            for (auto& queue : b->queues) {
+                // waiters of a priority are in arrival order, the oldest expire first
+                while (!queue.empty() && now - queue.front().queued >= b->maxWait) {
+                    (*b->timeoutMetric)++;
+                    (*b->rejectedMetric)++;
+                    done.push_back(Done { std::move(queue.front().callback), nullptr });
+                    Remove(b, queue, queue.begin());
+                }
+            }
+            // accounts back from suspension take the waiters left
+            Admit(b, done);
+        }
+    }
+    Run(done);
+}
+
+Admission::Ticket Admission::MakeTicket(Backend* backend, Slot* slot)
+{
+    backend->inUse++;
+    (*backend->inUseMetric)++;
+    slot->inUse++;
+    (*slot->inUseMetric)++;
+    return Ticket(new Lease(backend, slot));
+}
+
+void Admission::Release(Backend* backend, Slot* slot)
+{
+    State& s = Instance();
+    std::vector<Done> done;
+    {
+        std::lock_guard<std::mutex> l(s.mutex);
+        backend->inUse--;
+        (*backend->inUseMetric)--;
+        slot->inUse--;
+        (*slot->inUseMetric)--;
+        Admit(backend, done);
+    }
+    Run(done);
+}
+
+void Admission::Admit(Backend* backend, std::vector<Done>& done)
+{
+    int64_t now = NowMs();
+    for (auto& queue : backend->queues) {
+        while (!queue.empty()) {
+            Slot* slot = Pick(backend, now);
+            if (!slot) {
+                return;
+            }
+            int64_t wait = now - queue.front().queued;
+            *backend->waitMetric += wait;
+            Metrics::SetMax(*backend->waitMaxMetric, wait);
+            (*backend->admittedMetric)++;
+            done.push_back(Done { std::move(queue.front().callback), MakeTicket(backend, slot) });
+            Remove(backend, queue, queue.begin());
+        }
+    }
+}
+
+Admission::Slot* Admission::Pick(Backend* backend, int64_t now)
+{
+    Slot* best = nullptr;
+    size_t bestIndex = 0;
+    size_t count = backend->slots.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t index = (backend->next + i) % count;
+        Slot* slot = backend->slots[index].get();
+        if (slot->isRemoved || slot->suspendUntil > now || (slot->account.limit > 0 && slot->inUse >= slot->account.limit)) {
+            continue;
+        }
+        // load once this session is added, weights compared by cross multiplying
+        if (!best || (int64_t)(slot->inUse + 1) * best->account.weight < (int64_t)(best->inUse + 1) * slot->account.weight) {
+            best = slot;
+            bestIndex = index;
+        }
+    }
+    if (best) {
+        backend->next = bestIndex + 1;
+    }
+    return best;
+}
+
+void Admission::Remove(Backend* backend, std::deque<Waiter>& queue, std::deque<Waiter>::iterator it)
+{
+    queue.erase(it);
+    backend->queued--;
+    (*backend->queuedMetric)--;
+}
+
+void Admission::Run(std::vector<Done>& done)
+{
+    for (auto& d : done) {
+        if (d.callback) {
+            d.callback(d.ticket);
+        }
+        // a ticket nobody took is given back here, outside the lock
+        d.ticket = nullptr;
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include "ini/IniParser.h"
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using std::map;
+using std::string;
+
+/**
+ * Process wide admission control of vendor sessions. A backend has one or more vendor accounts,
+ * each runs at most `limit` sessions at once. A session goes to the least loaded account by weight,
+ * sessions over every account's limit wait in a short queue, highest priority first, and are
+ * rejected when the queue is full or their wait exceeds the deadline.
+ * The admitted slot is a ticket carrying the account's credential, given back when the last copy goes:
+ *     uint64_t waitId = 0;
+ *     Admission::Ticket ticket;
+ *     if (Admission::Acquire("tencent_tts", Admission::LIVE, ticket, onAdmitted, &waitId) == Admission::QUEUED) { ... }
+ */
+class Admission {
+private:
+    struct Backend;
+    struct Slot;
+
+public:
+    /** lower values are admitted first, a full queue drops its lowest waiter for a higher one */
+    enum Priority {
+        LIVE,
+        WARMUP,
+        PRIORITY_COUNT
+    };
+    enum Result {
+        ADMITTED,
+        QUEUED,
+        REJECTED
+    };
+    /** what a vendor error did to the account of the session */
+    enum ErrorAction {
+        /** not a quota error of the backend */
+        IGNORED,
+        SUSPENDED,
+        /** a quota error on the last account in rotation, which is kept */
+        KEPT
+    };
+    struct Credential {
+        /** config section of the account, used in logs and metric names */
+        string name;
+        string appId;
+        string secretId;
+        string secretKey;
+    };
+    struct Account {
+        Credential credential;
+        /** concurrent sessions, 0 is unlimited */
+        int limit = 0;
+        /** share of the sessions relative to the other accounts */
+        int weight = 1;
+    };
+    /** one admitted session on one account, the slot is given back by the destructor */
+    class Lease {
+    public:
+        ~Lease();
+        const Credential& credential() const;
+
+    private:
+        friend class Admission;
+        Lease(Backend* backend, Slot* slot);
+        Backend* mBackend;
+        Slot* mSlot;
+    };
+    typedef std::shared_ptr<const Lease> Ticket;
+    /** called once for a queued session, with its ticket, or an empty one when it was rejected.
+        Runs on the thread which freed the slot or called Expire(), without any lock of Admission held */
+    typedef std::function<void(Ticket)> Callback;
+
+    /** queueSize waiters are kept for at most maxWait (ms), quotaCodes are vendor errors suspending an account */
+    static void Configure(const string& backend, const std::vector<Account>& accounts, int queueSize, int maxWait, const std::set<int>& quotaCodes, int suspendTime);
+    /** accounts of the [type] section, queue of the [admission] section, backend is <type>_<kind>.
+        Returns the accounts configured, for the engine to log */
+    static std::vector<Account> Load(IniParser& ini, const string& type, const string& kind);
+    /** ADMITTED sets ticket, QUEUED sets waitId and calls callback later */
+    static Result Acquire(const string& backend, Priority priority, Ticket& ticket, Callback callback, uint64_t* waitId);
+    /** drop a waiter without calling its callback, false when it was admitted or rejected already */
+    static bool Cancel(const string& backend, uint64_t waitId);
+    /** a vendor error of the session, a quota error takes its account out of rotation for a while */
+    static ErrorAction OnError(const Ticket& ticket, int code);
+    /** the ticket's account is still in rotation, so a kept ticket may start another session */
+    static bool IsUsable(const Ticket& ticket);
+    /** sessions are waiting for a slot of the backend, a slot kept idle should be given back */
+    static bool HasWaiters(const string& backend);
+    /** reject the waiters past their deadline and admit to accounts back from suspension,
+        called periodically from the engine timers */
+    static void Expire();
+
+private:
+    struct Waiter {
+        uint64_t id = 0;
+        int64_t queued = 0;
+        Callback callback;
+    };
+    struct Slot {
+        Account account;
+        int inUse = 0;
+        int64_t suspendUntil = 0;
+        /** left out of a later Configure(), kept for the tickets still pointing at it */
+        bool isRemoved = false;
+        std::atomic<int64_t>* inUseMetric;
+        std::atomic<int64_t>* suspendedMetric;
+    };
+    struct Backend {
+        string name;
+        size_t queueSize = 0;
+        int maxWait = 0;
+        std::set<int> quotaCodes;
+        int suspendTime = 0;
+        int inUse = 0;
+        size_t queued = 0;
+        /** round robin start of the search, so equally loaded accounts take turns */
+        size_t next = 0;
+        std::vector<std::unique_ptr<Slot>> slots;
+        std::deque<Waiter> queues[PRIORITY_COUNT];
+        std::atomic<int64_t>* inUseMetric;
+        std::atomic<int64_t>* queuedMetric;
+        std::atomic<int64_t>* admittedMetric;
+        std::atomic<int64_t>* rejectedMetric;
+        std::atomic<int64_t>* timeoutMetric;
+        std::atomic<int64_t>* waitMetric;
+        std::atomic<int64_t>* waitMaxMetric;
+    };
+    /** a queued session leaving the queue, its callback is called once the lock is released */
+    struct Done {
+        Callback callback;
+        Ticket ticket;
+    };
+    struct State {
+        std::mutex mutex;
+        map<string, std::unique_ptr<Backend>> backends;
+        uint64_t nextId = 0;
+    };
+
+    static State& Instance();
+    /** under the state lock, backends and slots are never removed so pointers stay valid */
+    static Backend* GetBackend(State& s, const string& name);
+    /** least loaded account by weight with a free slot, nullptr when all are full or suspended */
+    static Slot* Pick(Backend* backend, int64_t now);
+    static Ticket MakeTicket(Backend* backend, Slot* slot);
+    static void Release(Backend* backend, Slot* slot);
+    static void Admit(Backend* backend, std::vector<Done>& done);
+    static void Remove(Backend* backend, std::deque<Waiter>& queue, std::deque<Waiter>::iterator it);
+    static void Run(std::vector<Done>& done);
+    static int64_t NowMs();
+};
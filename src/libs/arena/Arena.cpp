@@ -0,0 +1,155 @@
+#include "Arena.h"
+#include "metrics/Metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#define DEFAULT_CACHED_SLABS 256
+
+static std::mutex sFreeMutex;
+static std::vector<char*> sFreeSlabs;
+static size_t sCachedSlabs = DEFAULT_CACHED_SLABS;
+
+// global counters move on slab and large block events only, never per allocation
+static std::atomic<int64_t>& sArenas = Metrics::Get("arena_count");
+static std::atomic<int64_t>& sAllocs = Metrics::Get("arena_allocs_total");
+static std::atomic<int64_t>& sAllocBytes = Metrics::Get("arena_alloc_bytes_total");
+static std::atomic<int64_t>& sLargeBytes = Metrics::Get("arena_large_bytes");
+static std::atomic<int64_t>& sSlabsUsed = Metrics::Get("arena_slabs_used");
+static std::atomic<int64_t>& sSlabsFree = Metrics::Get("arena_slabs_free");
+static std::atomic<int64_t>& sSlabsNew = Metrics::Get("arena_slab_allocs_total");
+static std::atomic<int64_t>& sSlabsReused = Metrics::Get("arena_slab_reuses_total");
+static std::atomic<int64_t>& sLargeAllocs = Metrics::Get("arena_large_allocs_total");
+
+Arena::~Arena()
+{
+    for (char* slab : mSlabs) {
+        GiveSlab(slab);
+    }
+    for (auto& block : mLarge) {
+        free(block.first);
+        sLargeBytes -= block.second;
+    }
+    if (mAllocs > 0) {
+        sArenas--;
+        sAllocs += mAllocs;
+        sAllocBytes += mAllocBytes;
+    }
+}
+
+void* Arena::allocate(size_t bytes, size_t align)
+{
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    std::lock_guard<std::mutex> l(mMutex);
+    if (mAllocs++ == 0) {
+        sArenas++;
+    }
+    mAllocBytes += bytes;
+    mUsed += bytes;
+    if (bytes > LARGE_SIZE) {
+        void* block = malloc(bytes);
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        mLarge.emplace_back(block, bytes);
+        sLargeAllocs++;
+        sLargeBytes += bytes;
+        return block;
+    }
+    char* p = (char*)(((uintptr_t)mPos + align - 1) & ~(uintptr_t)(align - 1));
+    if (!mPos || p + bytes > mEnd) {
+        char* slab = TakeSlab();
+        mSlabs.push_back(slab);
+        mEnd = slab + SLAB_SIZE;
+        p = (char*)(((uintptr_t)slab + align - 1) & ~(uintptr_t)(align - 1));
+    }
+    mPos = p + bytes;
+    return p;
+}
+
+void Arena::deallocate(void* p, size_t bytes)
+{
+    if (!p) {
+        return;
+    }
+    std::lock_guard<std::mutex> l(mMutex);
+    if (bytes > LARGE_SIZE) {
+        for (auto it = mLarge.begin(); it != mLarge.end(); it++) {
+            if (it->first == p) {
+                free(p);
+                sLargeBytes -= it->second;
+                mUsed -= it->second;
+                mLarge.erase(it);
+                break;
+            }
+        }
+        return;
+    }
+    if ((char*)p + bytes == mPos) {
+        mPos = (char*)p;
+        mUsed -= bytes;
+    }
+}
+
+char* Arena::copy(const char* data, size_t len)
+{
+    char* p = (char*)allocate(len + 1, 1);
+    memcpy(p, data, len);
+    p[len] = '\0';
+    return p;
+}
+
+size_t Arena::used()
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    return mUsed;
+}
+
+void Arena::Configure(size_t cachedSlabs)
+{
+    std::lock_guard<std::mutex> l(sFreeMutex);
+    sCachedSlabs = cachedSlabs;
+    while (sFreeSlabs.size() > sCachedSlabs) {
+        free(sFreeSlabs.back());
+        sFreeSlabs.pop_back();
+    }
+    sSlabsFree = sFreeSlabs.size();
+}
+
+char* Arena::TakeSlab()
+{
+    sSlabsUsed++;
+    {
+        std::lock_guard<std::mutex> l(sFreeMutex);
+        if (!sFreeSlabs.empty()) {
+            char* slab = sFreeSlabs.back();
+            sFreeSlabs.pop_back();
+            sSlabsFree = sFreeSlabs.size();
+            sSlabsReused++;
+            return slab;
+        }
+    }
+    char* slab = (char*)malloc(SLAB_SIZE);
+    if (!slab) {
+        sSlabsUsed--;
+        throw std::bad_alloc();
+    }
+    sSlabsNew++;
+    return slab;
+}
+
+void Arena::GiveSlab(char* slab)
+{
+    sSlabsUsed--;
+    {
+        std::lock_guard<std::mutex> l(sFreeMutex);
+        if (sFreeSlabs.size() < sCachedSlabs) {
+            sFreeSlabs.push_back(slab);
+            sSlabsFree = sFreeSlabs.size();
+            return;
+        }
+    }
+    free(slab);
+}
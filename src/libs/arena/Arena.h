@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * Per-session bump allocator. Memory comes from fixed size slabs, nothing is freed one by one,
+ * everything goes back at once when the arena is destroyed and the slabs are kept in a process
+ * wide free list for the next session. Safe to allocate from several threads.
+ */
+class Arena {
+public:
+    enum {
+        SLAB_SIZE = 16 * 1024,
+        /** larger requests get a block of their own, released with the arena */
+        LARGE_SIZE = SLAB_SIZE / 4
+    };
+
+    Arena() = default;
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+    /** large blocks and the most recent allocation are given back, the latter is what vectors grow from */
+    void deallocate(void* p, size_t bytes);
+    char* copy(const char* data, size_t len);
+    /** bytes handed out and not given back */
+    size_t used();
+
+    /** free slabs kept for reuse, the rest go back to the heap */
+    static void Configure(size_t cachedSlabs);
+
+private:
+    static char* TakeSlab();
+    static void GiveSlab(char* slab);
+
+    std::mutex mMutex;
+    std::vector<char*> mSlabs;
+    std::vector<std::pair<void*, size_t>> mLarge;
+    char* mPos = nullptr;
+    char* mEnd = nullptr;
+    size_t mUsed = 0;
+    /** lifetime totals, added to the global metrics when the arena goes */
+    size_t mAllocs = 0;
+    size_t mAllocBytes = 0;
+};
+
+/** std allocator drawing from an Arena, which must outlive the container */
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(Arena* arena)
+        : mArena(arena)
+    {
+    }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : mArena(other.arena())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(mArena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        mArena->deallocate(p, n * sizeof(T));
+    }
+    Arena* arena() const
+    {
+        return mArena;
+    }
+
+private:
+    Arena* mArena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() != b.arena();
+}
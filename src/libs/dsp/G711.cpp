@@ -0,0 +1,81 @@
+#include "G711.h"
+
+static const int16_t sUlawSegmentEnd[8] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF };
+static const int16_t sAlawSegmentEnd[8] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+
+static int Segment(int val, const int16_t* table)
+{
+    for (int i = 0; i < 8; i++) {
+        if (val <= table[i]) {
+            return i;
+        }
+    }
+    return 8;
+}
+
+G711::Tables::Tables()
+{
+    for (int i = 0; i < 16384; i++) {
+        int16_t sample = (int16_t)(i << 2);
+        ulaw[i] = LinearToUlaw(sample);
+        alaw[i] = LinearToAlaw(sample);
+    }
+}
+
+const G711::Tables& G711::Instance()
+{
+    static Tables tables;
+    return tables;
+}
+
+uint8_t G711::LinearToUlaw(int16_t sample)
+{
+    int val = sample >> 2;
+    int mask = 0xFF;
+    if (val < 0) {
+        val = -val;
+        mask = 0x7F;
+    }
+    if (val > 8159) {
+        val = 8159;
+    }
+    val += 0x21;
+    int seg = Segment(val, sUlawSegmentEnd);
+    if (seg >= 8) {
+        return (uint8_t)(0x7F ^ mask);
+    }
+    return (uint8_t)(((seg << 4) | ((val >> (seg + 1)) & 0xF)) ^ mask);
+}
+
+uint8_t G711::LinearToAlaw(int16_t sample)
+{
+    int val = sample >> 3;
+    int mask = 0xD5;
+    if (val < 0) {
+        val = -val - 1;
+        mask = 0x55;
+    }
+    int seg = Segment(val, sAlawSegmentEnd);
+    if (seg >= 8) {
+        return (uint8_t)(0x7F ^ mask);
+    }
+    int aval = seg << 4;
+    aval |= seg < 2 ? (val >> 1) & 0xF : (val >> seg) & 0xF;
+    return (uint8_t)(aval ^ mask);
+}
+
+void G711::EncodeUlaw(const int16_t* in, uint8_t* out, size_t count)
+{
+    const uint8_t* table = Instance().ulaw;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = table[(uint16_t)in[i] >> 2];
+    }
+}
+
+void G711::EncodeAlaw(const int16_t* in, uint8_t* out, size_t count)
+{
+    const uint8_t* table = Instance().alaw;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = table[(uint16_t)in[i] >> 2];
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * G.711 encoders, 16 bit linear pcm in and one byte per sample out.
+ * Both laws are single lookups in 16K tables built once, indexed by the top 14 bits of the sample.
+ */
+class G711 {
+public:
+    static void EncodeUlaw(const int16_t* in, uint8_t* out, size_t count);
+    static void EncodeAlaw(const int16_t* in, uint8_t* out, size_t count);
+
+    /** reference encoders the tables are built from */
+    static uint8_t LinearToUlaw(int16_t sample);
+    static uint8_t LinearToAlaw(int16_t sample);
+
+private:
+    struct Tables {
+        Tables();
+        uint8_t ulaw[16384];
+        uint8_t alaw[16384];
+    };
+    static const Tables& Instance();
+};
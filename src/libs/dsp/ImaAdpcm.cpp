@@ -0,0 +1,107 @@
+#include "ImaAdpcm.h"
+#include <algorithm>
+#include <string.h>
+
+static const int16_t sStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t sIndexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+namespace {
+struct State {
+    int predictor = 0;
+    int index = 0;
+
+    int decode(int code)
+    {
+        int step = sStepTable[index];
+        int diff = step >> 3;
+        if (code & 4) {
+            diff += step;
+        }
+        if (code & 2) {
+            diff += step >> 1;
+        }
+        if (code & 1) {
+            diff += step >> 2;
+        }
+        predictor += (code & 8) ? -diff : diff;
+        predictor = std::min(32767, std::max(-32768, predictor));
+        index = std::min(88, std::max(0, index + sIndexTable[code]));
+        return predictor;
+    }
+
+    // quantize the difference, then track exactly what the decoder will reconstruct
+    int encode(int sample)
+    {
+        int step = sStepTable[index];
+        int diff = sample - predictor;
+        int code = 0;
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+        if (diff >= step) {
+            code |= 4;
+            diff -= step;
+        }
+        if (diff >= step >> 1) {
+            code |= 2;
+            diff -= step >> 1;
+        }
+        if (diff >= step >> 2) {
+            code |= 1;
+        }
+        decode(code);
+        return code;
+    }
+};
+}
+
+size_t ImaAdpcm::BlockCount(size_t samples)
+{
+    return (samples + BLOCK_SAMPLES - 1) / BLOCK_SAMPLES;
+}
+
+void ImaAdpcm::Encode(const int16_t* in, size_t count, uint8_t* out)
+{
+    State state;
+    int16_t padded[BLOCK_SAMPLES];
+    for (size_t pos = 0; pos < count; pos += BLOCK_SAMPLES, out += BLOCK_BYTES) {
+        const int16_t* block = in + pos;
+        size_t n = std::min((size_t)BLOCK_SAMPLES, count - pos);
+        if (n < BLOCK_SAMPLES) {
+            memcpy(padded, block, n * sizeof(int16_t));
+            memset(padded + n, 0, (BLOCK_SAMPLES - n) * sizeof(int16_t));
+            block = padded;
+        }
+        // the step index carries over from the previous block, the predictor restarts exactly
+        state.predictor = block[0];
+        out[0] = (uint8_t)(block[0] & 0xFF);
+        out[1] = (uint8_t)((uint16_t)block[0] >> 8);
+        out[2] = (uint8_t)state.index;
+        out[3] = 0;
+        for (size_t i = 1, j = 4; i < BLOCK_SAMPLES; i += 2, j++) {
+            int low = state.encode(block[i]);
+            int high = state.encode(block[i + 1]);
+            out[j] = (uint8_t)(low | (high << 4));
+        }
+    }
+}
+
+void ImaAdpcm::DecodeBlock(const uint8_t* block, int16_t* out)
+{
+    State state;
+    state.predictor = (int16_t)(block[0] | (block[1] << 8));
+    state.index = std::min((int)block[2], 88);
+    out[0] = (int16_t)state.predictor;
+    for (size_t i = 1, j = 4; i < BLOCK_SAMPLES; i += 2, j++) {
+        out[i] = (int16_t)state.decode(block[j] & 0xF);
+        out[i + 1] = (int16_t)state.decode(block[j] >> 4);
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * IMA/DVI ADPCM, 4 bits per 16 bit pcm sample, in self-contained blocks laid out like wav's
+ * ima_adpcm format: a 4 byte header (first sample, step index) followed by two samples per byte.
+ * Any block decodes on its own, so a reader can start or seek at a block boundary.
+ */
+class ImaAdpcm {
+public:
+    enum {
+        BLOCK_BYTES = 256,
+        BLOCK_SAMPLES = (BLOCK_BYTES - 4) * 2 + 1
+    };
+
+    static size_t BlockCount(size_t samples);
+    /** encode whole blocks, out holds BlockCount(count) * BLOCK_BYTES, the last block is zero padded */
+    static void Encode(const int16_t* in, size_t count, uint8_t* out);
+    /** decode one block into BLOCK_SAMPLES samples */
+    static void DecodeBlock(const uint8_t* block, int16_t* out);
+};
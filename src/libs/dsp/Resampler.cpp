@@ -0,0 +1,106 @@
+#include "Resampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define KAISER_BETA 8.0
+/** passband edge relative to the lower nyquist frequency */
+#define CUTOFF_RATIO 0.92
+
+static size_t Gcd(size_t a, size_t b)
+{
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/** zeroth order modified bessel function of the first kind, for the kaiser window */
+static double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+Resampler::Resampler(int inRate, int outRate, int tapsPerPhase)
+    : mInRate(inRate)
+    , mOutRate(outRate)
+{
+    size_t g = Gcd(inRate, outRate);
+    mUp = outRate / g;
+    mDown = inRate / g;
+    mTaps = tapsPerPhase > 1 ? tapsPerPhase : 2;
+    design();
+    mWork.assign(mTaps - 1, 0.0f);
+}
+
+int Resampler::inRate() const
+{
+    return mInRate;
+}
+
+int Resampler::outRate() const
+{
+    return mOutRate;
+}
+
+void Resampler::design()
+{
+    size_t n = mUp * mTaps;
+    // cutoff in cycles per sample of the upsampled stream
+    double fc = 0.5 * CUTOFF_RATIO / std::max(mUp, mDown);
+    double center = (n - 1) / 2.0;
+    double norm = BesselI0(KAISER_BETA);
+    std::vector<double> h(n);
+    for (size_t i = 0; i < n; i++) {
+        double t = i - center;
+        double sinc = t == 0 ? 1.0 : sin(2.0 * M_PI * fc * t) / (2.0 * M_PI * fc * t);
+        double r = 2.0 * t / (n - 1);
+        double window = BesselI0(KAISER_BETA * sqrt(std::max(0.0, 1.0 - r * r))) / norm;
+        // gain of mUp makes up for the zeros stuffed between input samples
+        h[i] = mUp * 2.0 * fc * sinc * window;
+    }
+    mFilter.resize(n);
+    for (size_t phase = 0; phase < mUp; phase++) {
+        for (size_t k = 0; k < mTaps; k++) {
+            mFilter[phase * mTaps + (mTaps - 1 - k)] = (float)h[phase + k * mUp];
+        }
+    }
+}
+
+void Resampler::process(const int16_t* in, size_t count, std::vector<int16_t>& out)
+{
+    out.clear();
+    size_t history = mTaps - 1;
+    mWork.resize(history + count);
+    for (size_t i = 0; i < count; i++) {
+        mWork[history + i] = in[i];
+    }
+    out.reserve(count * mUp / mDown + 1);
+    while (mPos / mUp < count) {
+        size_t i = mPos / mUp;
+        const float* h = &mFilter[(mPos % mUp) * mTaps];
+        // the window ends at input sample i, which sits at mWork[history + i]
+        const float* x = &mWork[i];
+        float acc = 0.0f;
+        for (size_t k = 0; k < mTaps; k++) {
+            acc += h[k] * x[k];
+        }
+        long v = lrintf(acc);
+        out.push_back((int16_t)std::min(32767L, std::max(-32768L, v)));
+        mPos += mDown;
+    }
+    mPos -= count * mUp;
+    memmove(mWork.data(), mWork.data() + count, history * sizeof(float));
+    mWork.resize(history);
+}
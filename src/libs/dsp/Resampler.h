@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Streaming polyphase resampler for 16 bit mono pcm between two integer rates.
+ * The anti-aliasing filter is a Kaiser windowed sinc designed once per instance. Input history
+ * is kept between process() calls so chunks of any size join seamlessly, use one instance per stream.
+ */
+class Resampler {
+public:
+    enum {
+        DEFAULT_TAPS = 32
+    };
+
+    Resampler(int inRate, int outRate, int tapsPerPhase = DEFAULT_TAPS);
+
+    /** resample a chunk, out is replaced with the samples that became available */
+    void process(const int16_t* in, size_t count, std::vector<int16_t>& out);
+
+    int inRate() const;
+    int outRate() const;
+
+private:
+    void design();
+
+    int mInRate = 0;
+    int mOutRate = 0;
+    size_t mUp = 1;
+    size_t mDown = 1;
+    size_t mTaps = 0;
+    /** phase major, taps of each phase stored reversed so a phase is a plain dot product */
+    std::vector<float> mFilter;
+    /** last mTaps - 1 input samples followed by the current chunk */
+    std::vector<float> mWork;
+    /** next output position in 1/mUp input samples, relative to the current chunk */
+    size_t mPos = 0;
+};
@@ -0,0 +1,136 @@
+#include "TimeStretch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/** segment length (ms), long enough to hold a couple of pitch periods */
+#define STRETCH_WINDOW_TIME 30
+/** how far a segment may move off its nominal position to line up (ms) */
+#define STRETCH_TOLERANCE_TIME 10
+/** the similarity search looks at every n-th lag and sample, plenty at speech bandwidth */
+#define STRETCH_LAG_STEP 2
+#define STRETCH_SAMPLE_STEP 4
+
+static int16_t Saturate(float v)
+{
+    long s = lrintf(v);
+    return (int16_t)std::min(32767L, std::max(-32768L, s));
+}
+
+TimeStretch::TimeStretch(int sampleRate, float rate)
+{
+    mWindow = (size_t)sampleRate * STRETCH_WINDOW_TIME / 1000 / 2 * 2;
+    mHop = mWindow / 2;
+    mTolerance = (size_t)sampleRate * STRETCH_TOLERANCE_TIME / 1000;
+    mAnalysisHop = mHop * (double)rate;
+    // periodic hann, two of them at half overlap sum to exactly one
+    mHann.resize(mWindow);
+    for (size_t i = 0; i < mWindow; i++) {
+        mHann[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / mWindow));
+    }
+    mOverlap.assign(mHop, 0.0f);
+    // lead in with silence, so the first searches have room before the start
+    mIn.assign(mTolerance, 0.0f);
+}
+
+void TimeStretch::push(const int16_t* in, size_t count)
+{
+    mIn.insert(mIn.end(), in, in + count);
+    process();
+}
+
+void TimeStretch::flush()
+{
+    // the input short of a whole search is still to be stretched, pad it with silence until every
+    // sample pushed has been passed by a segment
+    double end = (double)(mInBase + mIn.size() - mTolerance);
+    while (mNominal < end) {
+        // just enough for one more segment, so the output does not run on into the padding
+        mIn.resize(needed() - mInBase, 0.0f);
+        process();
+    }
+    for (size_t i = 0; i < mHop; i++) {
+        mOut.push_back(Saturate(mOverlap[i]));
+    }
+    std::fill(mOverlap.begin(), mOverlap.end(), 0.0f);
+}
+
+size_t TimeStretch::available() const
+{
+    return mOut.size() - mOutPos;
+}
+
+size_t TimeStretch::pop(int16_t* out, size_t count)
+{
+    size_t n = std::min(count, available());
+    memcpy(out, mOut.data() + mOutPos, n * sizeof(int16_t));
+    mOutPos += n;
+    if (mOutPos == mOut.size()) {
+        mOut.clear();
+        mOutPos = 0;
+    }
+    return n;
+}
+
+size_t TimeStretch::needed() const
+{
+    size_t nominal = (size_t)llround(mNominal) + mTolerance;
+    size_t need = nominal + mTolerance + mWindow;
+    if (mHasPrev) {
+        need = std::max(need, mPrev + mHop + mWindow);
+    }
+    return need;
+}
+
+void TimeStretch::process()
+{
+    while (true) {
+        size_t nominal = (size_t)llround(mNominal) + mTolerance;
+        size_t lo = nominal - mTolerance;
+        if (needed() > mInBase + mIn.size()) {
+            break;
+        }
+        size_t best = nominal;
+        if (mHasPrev) {
+            // the natural continuation of the previous segment is what the new one should look like
+            const float* target = &mIn[mPrev + mHop - mInBase];
+            float bestScore = -INFINITY;
+            for (size_t pos = lo; pos <= nominal + mTolerance; pos += STRETCH_LAG_STEP) {
+                const float* cand = &mIn[pos - mInBase];
+                float score = 0.0f;
+                for (size_t k = 0; k < mWindow; k += STRETCH_SAMPLE_STEP) {
+                    score += target[k] * cand[k];
+                }
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = pos;
+                }
+            }
+        }
+        const float* seg = &mIn[best - mInBase];
+        for (size_t k = 0; k < mHop; k++) {
+            mOut.push_back(Saturate(mOverlap[k] + seg[k] * mHann[k]));
+            mOverlap[k] = seg[mHop + k] * mHann[mHop + k];
+        }
+        mPrev = best;
+        mHasPrev = true;
+        mNominal += mAnalysisHop;
+        // drop input neither the next search nor the next continuation can reach
+        size_t keep = std::min((size_t)llround(mNominal), mPrev + mHop);
+        if (keep > mInBase + 4 * mWindow) {
+            size_t drop = keep - mInBase - mWindow;
+            mIn.erase(mIn.begin(), mIn.begin() + drop);
+            mInBase += drop;
+        }
+    }
+}
+
+void TimeStretch::ApplyGain(int16_t* samples, size_t count, float gain)
+{
+    // 4.12 fixed point, the loop vectorizes
+    int32_t g = (int32_t)lrintf(gain * 4096.0f);
+    for (size_t i = 0; i < count; i++) {
+        int32_t v = (samples[i] * g) >> 12;
+        samples[i] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+    }
+}
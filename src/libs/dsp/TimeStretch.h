@@ -0,0 +1,47 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Streaming WSOLA time-stretch for 16 bit mono pcm, changes the speaking rate and keeps the pitch.
+ * Hann windowed segments are overlap-added at a fixed synthesis hop, each one taken from around
+ * its nominal input position where it best continues the previous one.
+ * rate > 1 plays faster. One instance per stream, input is pushed and output popped as it comes.
+ */
+class TimeStretch {
+public:
+    TimeStretch(int sampleRate, float rate);
+
+    void push(const int16_t* in, size_t count);
+    /** no more input, stretch what is left and make the tail held in the overlap available */
+    void flush();
+    size_t available() const;
+    size_t pop(int16_t* out, size_t count);
+
+    /** scale samples in place, gain 1.0 is a no-op, results saturate */
+    static void ApplyGain(int16_t* samples, size_t count, float gain);
+
+private:
+    void process();
+    /** absolute input position the next segment needs input up to */
+    size_t needed() const;
+
+    size_t mWindow = 0;
+    size_t mHop = 0;
+    size_t mTolerance = 0;
+    double mAnalysisHop = 0;
+    std::vector<float> mHann;
+    /** input from absolute sample mInBase on */
+    std::vector<float> mIn;
+    size_t mInBase = 0;
+    /** absolute input position the next segment is nominally taken from */
+    double mNominal = 0;
+    /** absolute input position of the previous segment */
+    size_t mPrev = 0;
+    bool mHasPrev = false;
+    /** windowed second half of the previous segment */
+    std::vector<float> mOverlap;
+    std::vector<int16_t> mOut;
+    size_t mOutPos = 0;
+};
@@ -0,0 +1,62 @@
+#include "Metrics.h"
+#include <cstdio>
+#include <sstream>
+
+Metrics::Registry& Metrics::Instance()
+{
+    static Registry registry;
+    return registry;
+}
+
+std::atomic<int64_t>& Metrics::Get(const string& name, int64_t scale)
+{
+    Registry& r = Instance();
+    std::lock_guard<std::mutex> l(r.mutex);
+    auto it = r.metrics.find(name);
+    if (it == r.metrics.end()) {
+        Metric metric;
+        metric.value.reset(new std::atomic<int64_t>(0));
+        metric.scale = scale > 0 ? scale : 1;
+        it = r.metrics.emplace(name, std::move(metric)).first;
+    }
+    return *it->second.value;
+}
+
+void Metrics::SetMax(std::atomic<int64_t>& metric, int64_t val)
+{
+    int64_t cur = metric.load(std::memory_order_relaxed);
+    while (cur < val && !metric.compare_exchange_weak(cur, val, std::memory_order_relaxed)) {
+    }
+}
+
+string Metrics::Dump()
+{
+    Registry& r = Instance();
+    std::ostringstream oss;
+    std::lock_guard<std::mutex> l(r.mutex);
+    for (auto it = r.metrics.begin(); it != r.metrics.end(); it++) {
+        oss << "mrcpmod_" << it->first << " " << it->second.value->load(std::memory_order_relaxed) / it->second.scale << "\n";
+    }
+    return oss.str();
+}
+
+bool Metrics::Flush(const string& fileName)
+{
+    if (fileName.empty()) {
+        return false;
+    }
+    // write aside and rename, so scrapers never see a half written file
+    string tmpName = fileName + ".tmp";
+    FILE* fp = fopen(tmpName.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+    string text = Dump();
+    size_t written = fwrite(text.data(), 1, text.size(), fp);
+    fclose(fp);
+    if (written != text.size()) {
+        remove(tmpName.c_str());
+        return false;
+    }
+    return rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
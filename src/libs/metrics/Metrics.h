@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+using std::map;
+using std::string;
+
+/**
+ * Process wide named counters and gauges.
+ * Look a metric up once and keep the reference, updating it is a single relaxed atomic op:
+ *     static auto& hits = Metrics::Get("synth_prompt_cache_hits_total");
+ *     hits++;
+ * A metric counted in finer units than it is exported in gives the ratio, e.g. ns exported as us:
+ *     static auto& time = Metrics::Get("synth_prompt_decode_us_total", 1000);
+ */
+class Metrics {
+public:
+    /** the value is divided by scale on export, so small increments do not truncate */
+    static std::atomic<int64_t>& Get(const string& name, int64_t scale = 1);
+    static void SetMax(std::atomic<int64_t>& metric, int64_t val);
+
+    /** prometheus text exposition format */
+    static string Dump();
+    /** write Dump() to fileName, every engine keeps its own file, false when it is empty or can not be written */
+    static bool Flush(const string& fileName);
+
+private:
+    struct Metric {
+        std::unique_ptr<std::atomic<int64_t>> value;
+        int64_t scale = 1;
+    };
+    struct Registry {
+        std::mutex mutex;
+        map<string, Metric> metrics;
+    };
+    /** function local, so metrics can be registered from static initializers of any unit */
+    static Registry& Instance();
+};
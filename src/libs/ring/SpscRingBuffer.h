@@ -0,0 +1,124 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Fixed-capacity single-producer/single-consumer ring buffer.
+ * push() and available() belong to the producer thread, pop(), peek(), consume() and clear()
+ * belong to the consumer thread. Neither side ever takes a lock.
+ */
+template <typename T>
+class SpscRingBuffer {
+public:
+    explicit SpscRingBuffer(size_t capacity)
+    {
+        size_t real = 1;
+        while (real < capacity) {
+            real <<= 1;
+        }
+        mData.reset(new T[real]);
+        mCapacity = real;
+        mMask = real - 1;
+    }
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    /** Copy up to len items in, returns the number actually written */
+    size_t push(const T* data, size_t len)
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (mCapacity - (head - mCachedTail) < len) {
+            mCachedTail = mTail.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(len, mCapacity - (head - mCachedTail));
+        if (n == 0) {
+            return 0;
+        }
+        size_t pos = head & mMask;
+        size_t first = std::min(n, mCapacity - pos);
+        memcpy(&mData[pos], data, first * sizeof(T));
+        memcpy(&mData[0], data + first, (n - first) * sizeof(T));
+        mHead.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    /** Copy up to len items out, returns the number actually read */
+    size_t pop(T* data, size_t len)
+    {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (mCachedHead - tail < len) {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(len, mCachedHead - tail);
+        if (n == 0) {
+            return 0;
+        }
+        size_t pos = tail & mMask;
+        size_t first = std::min(n, mCapacity - pos);
+        memcpy(data, &mData[pos], first * sizeof(T));
+        memcpy(data + first, &mData[0], (n - first) * sizeof(T));
+        mTail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    /** Zero-copy access to the readable items up to the wrap point, release them with consume() */
+    size_t peek(const T** data)
+    {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        mCachedHead = mHead.load(std::memory_order_acquire);
+        size_t pos = tail & mMask;
+        *data = &mData[pos];
+        return std::min(mCachedHead - tail, mCapacity - pos);
+    }
+
+    void consume(size_t len)
+    {
+        mTail.store(mTail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    /** Drop everything readable, consumer side */
+    void clear()
+    {
+        mTail.store(mHead.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /** Readable items, exact on the consumer side */
+    size_t size() const
+    {
+        return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire);
+    }
+
+    /** Writable items, exact on the producer side */
+    size_t available() const
+    {
+        return mCapacity - (mHead.load(std::memory_order_relaxed) - mTail.load(std::memory_order_acquire));
+    }
+
+    size_t capacity() const
+    {
+        return mCapacity;
+    }
+
+private:
+    std::unique_ptr<T[]> mData;
+    size_t mCapacity = 0;
+    size_t mMask = 0;
+
+    /** producer and consumer indexes live on separate cache lines, padded rather than
+     * aligned because c++11 operator new ignores over-alignment */
+    char mPad0[CACHE_LINE_SIZE];
+    /** written by producer */
+    std::atomic<size_t> mHead { 0 };
+    size_t mCachedTail = 0;
+    char mPad1[CACHE_LINE_SIZE];
+    /** written by consumer */
+    std::atomic<size_t> mTail { 0 };
+    size_t mCachedHead = 0;
+    char mPad2[CACHE_LINE_SIZE];
+};
@@ -0,0 +1,207 @@
+#include "SessionTable.h"
+#include "metrics/Metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
+
+#define SESSION_TABLE_MAGIC 0x6d727374
+#define SESSION_TABLE_VERSION 1
+
+static_assert(std::is_standard_layout<SessionTable::Slot>::value, "the slot layout is shared with other processes");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "the slot counters must be lock free to be shared");
+
+static std::atomic<int64_t>& sFull = Metrics::Get("session_table_full_total");
+
+namespace {
+size_t MapSize(size_t capacity)
+{
+    return sizeof(SessionTable::Slot) * (capacity + 1);
+}
+
+SessionTable::Slot* SlotsOf(void* header)
+{
+    // the header takes the first slot, so the slots stay aligned
+    return (SessionTable::Slot*)header + 1;
+}
+
+void CopyId(char* dst, size_t size, const string& src)
+{
+    size_t len = std::min(src.size(), size - 1);
+    memcpy(dst, src.data(), len);
+    dst[len] = '\0';
+}
+}
+
+bool SessionTable::open(const string& name, size_t capacity)
+{
+    static_assert(sizeof(Header) <= sizeof(Slot), "the header must fit in a slot");
+    if (mHeader.load() || name.empty() || capacity == 0) {
+        return false;
+    }
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = MapSize(capacity);
+    if (ftruncate(fd, size) != 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return false;
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    // left behind by an earlier run of the server, its sessions are gone
+    memset(addr, 0, size);
+    Header* header = (Header*)addr;
+    header->capacity = (uint32_t)capacity;
+    header->slotSize = sizeof(Slot);
+    header->pid = getpid();
+    header->version = SESSION_TABLE_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SESSION_TABLE_MAGIC;
+    mName = name;
+    mHeader.store(header);
+    return true;
+}
+
+void SessionTable::close()
+{
+    Header* header = mHeader.exchange(nullptr);
+    if (!header) {
+        return;
+    }
+    shm_unlink(mName.c_str());
+}
+
+SessionTable::Slot* SessionTable::acquire(const string& channelId, const string& voiceId, const string& backend)
+{
+    Header* header = mHeader.load();
+    if (!header) {
+        return Scratch();
+    }
+    Slot* slots = SlotsOf(header);
+    uint32_t capacity = header->capacity;
+    uint32_t start = mNext.fetch_add(1, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < capacity; i++) {
+        Slot* slot = &slots[(start + i) % capacity];
+        uint32_t expected = 0;
+        if (slot->used.load(std::memory_order_relaxed) != 0 || !slot->used.compare_exchange_strong(expected, 1)) {
+            continue;
+        }
+        slot->seq.fetch_add(1, std::memory_order_acq_rel);
+        CopyId(slot->channelId, sizeof(slot->channelId), channelId);
+        CopyId(slot->voiceId, sizeof(slot->voiceId), voiceId);
+        CopyId(slot->backend, sizeof(slot->backend), backend);
+        slot->created.store(NowMs(), std::memory_order_relaxed);
+        slot->lastVendorEvent.store(0, std::memory_order_relaxed);
+        slot->bytesIn.store(0, std::memory_order_relaxed);
+        slot->bytesOut.store(0, std::memory_order_relaxed);
+        slot->depth.store(0, std::memory_order_relaxed);
+        slot->state.store(NEW, std::memory_order_relaxed);
+        slot->seq.fetch_add(1, std::memory_order_release);
+        return slot;
+    }
+    sFull++;
+    return Scratch();
+}
+
+void SessionTable::Release(Slot* slot)
+{
+    if (slot == Scratch()) {
+        return;
+    }
+    slot->state.store(FREE, std::memory_order_relaxed);
+    slot->used.store(0, std::memory_order_release);
+}
+
+SessionTable::Slot* SessionTable::Scratch()
+{
+    static Slot sScratch;
+    return &sScratch;
+}
+
+bool SessionTable::Read(const string& name, std::vector<Row>& rows)
+{
+    rows.clear();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < MapSize(0)) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    const Header* header = (const Header*)addr;
+    bool ok = header->magic == SESSION_TABLE_MAGIC && header->version == SESSION_TABLE_VERSION && header->slotSize == sizeof(Slot) && MapSize(header->capacity) <= size;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    Slot* slots = SlotsOf(addr);
+    for (uint32_t i = 0; ok && i < header->capacity; i++) {
+        Slot* slot = &slots[i];
+        // the identity is copied between two reads of seq, a slot changing hands meanwhile shows next time
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        State state = (State)slot->state.load(std::memory_order_relaxed);
+        if ((seq & 1) != 0 || state == FREE || slot->used.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        Row row;
+        row.channelId.assign(slot->channelId, strnlen(slot->channelId, sizeof(slot->channelId)));
+        row.voiceId.assign(slot->voiceId, strnlen(slot->voiceId, sizeof(slot->voiceId)));
+        row.backend.assign(slot->backend, strnlen(slot->backend, sizeof(slot->backend)));
+        row.state = state;
+        row.created = slot->created.load(std::memory_order_relaxed);
+        row.lastVendorEvent = slot->lastVendorEvent.load(std::memory_order_relaxed);
+        row.bytesIn = slot->bytesIn.load(std::memory_order_relaxed);
+        row.bytesOut = slot->bytesOut.load(std::memory_order_relaxed);
+        row.depth = slot->depth.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+        rows.push_back(row);
+    }
+    munmap(addr, size);
+    return ok;
+}
+
+const char* SessionTable::StateName(State state)
+{
+    switch (state) {
+    case FREE:
+        return "free";
+    case NEW:
+        return "new";
+    case QUEUED:
+        return "queued";
+    case STARTING:
+        return "starting";
+    case RUNNING:
+        return "running";
+    case IDLE:
+        return "idle";
+    case STOPPED:
+        return "stopped";
+    }
+    return "unknown";
+}
+
+int64_t SessionTable::NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+
+/**
+ * Sessions of an engine published in a POSIX shared memory object, so mrcpmod-top can watch a live
+ * server. Each engine owns its table, a session owns a slot of it for its lifetime and updates it
+ * with relaxed atomics from whichever thread is at hand, nothing is locked and the reader never holds
+ * up a writer:
+ *     SessionTable::Slot* slot = table->acquire(channelId, voiceId, backend);
+ *     slot->addIn(len);
+ *     SessionTable::Release(slot);
+ */
+class SessionTable {
+public:
+    enum State {
+        FREE,
+        /** created, not admitted to its backend yet */
+        NEW,
+        QUEUED,
+        /** admitted, the vendor session is starting */
+        STARTING,
+        RUNNING,
+        /** continuous stream between turns */
+        IDLE,
+        STOPPED
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> used;
+        /** odd while the identity is written, a reader retries when it changed under it */
+        std::atomic<uint32_t> seq;
+        std::atomic<uint32_t> state;
+        char channelId[64];
+        char voiceId[64];
+        char backend[32];
+        /** wall clock ms, so another process can tell the age */
+        std::atomic<int64_t> created;
+        std::atomic<int64_t> lastVendorEvent;
+        std::atomic<int64_t> bytesIn;
+        std::atomic<int64_t> bytesOut;
+        /** bytes buffered between the caller and the vendor */
+        std::atomic<int64_t> depth;
+
+        void setState(State val)
+        {
+            state.store(val, std::memory_order_relaxed);
+        }
+        void addIn(int64_t n)
+        {
+            bytesIn.fetch_add(n, std::memory_order_relaxed);
+        }
+        void addOut(int64_t n)
+        {
+            bytesOut.fetch_add(n, std::memory_order_relaxed);
+        }
+        void setDepth(int64_t n)
+        {
+            depth.store(n, std::memory_order_relaxed);
+        }
+        void markVendorEvent()
+        {
+            lastVendorEvent.store(NowMs(), std::memory_order_relaxed);
+        }
+    };
+
+    /** a row copied out of a table by the reader */
+    struct Row {
+        string channelId;
+        string voiceId;
+        string backend;
+        State state = FREE;
+        int64_t created = 0;
+        int64_t lastVendorEvent = 0;
+        int64_t bytesIn = 0;
+        int64_t bytesOut = 0;
+        int64_t depth = 0;
+    };
+
+    /** create the table, name is the shared memory object, e.g. /mrcpmod-recog,
+        false with errno set when it can not be created */
+    bool open(const string& name, size_t capacity);
+    /** unlink the table, the mapping stays for the sessions still holding a slot */
+    void close();
+    /** never null, a scratch slot nobody reads is handed out while the table is closed or full,
+        session_table_full_total counts the latter */
+    Slot* acquire(const string& channelId, const string& voiceId, const string& backend);
+    /** a slot of any table, or the scratch slot */
+    static void Release(Slot* slot);
+    static Slot* Scratch();
+
+    /** the sessions of a table published by another process, false when it does not exist */
+    static bool Read(const string& name, std::vector<Row>& rows);
+    static const char* StateName(State state);
+    static int64_t NowMs();
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t slotSize;
+        int64_t pid;
+    };
+
+    /** the mapping of the open table, never unmapped */
+    std::atomic<Header*> mHeader { nullptr };
+    string mName;
+    std::atomic<uint32_t> mNext { 0 };
+};
@@ -0,0 +1,146 @@
+#include "TimerWheel.h"
+#include <chrono>
+
+TimerWheel::TimerWheel(int tick)
+    : mTick(tick > 0 ? tick : 1)
+{
+    for (auto& head : mHeads) {
+        head = -1;
+    }
+}
+
+int64_t TimerWheel::NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerWheel::Id TimerWheel::schedule(int64_t now, int64_t delay, Callback callback)
+{
+    if (mOrigin < 0) {
+        mOrigin = now;
+    }
+    int32_t index;
+    if (mFree.empty()) {
+        index = (int32_t)mNodes.size();
+        mNodes.emplace_back();
+    } else {
+        index = mFree.back();
+        mFree.pop_back();
+    }
+    Node& node = mNodes[index];
+    // rounded up, so a timer never fires early, and at least one tick after the current one
+    int64_t ticks = (now - mOrigin + (delay > 0 ? delay : 0) + mTick - 1) / mTick;
+    node.expire = ticks > (int64_t)mCurrent ? (uint64_t)ticks : mCurrent + 1;
+    node.callback = std::move(callback);
+    link(index);
+    mSize++;
+    return ((Id)node.generation << 32) | (Id)(index + 1);
+}
+
+bool TimerWheel::cancel(Id id)
+{
+    if (id == 0) {
+        return false;
+    }
+    int32_t index = (int32_t)(id & 0xffffffff) - 1;
+    if (index < 0 || index >= (int32_t)mNodes.size()) {
+        return false;
+    }
+    Node& node = mNodes[index];
+    if (node.bucket < 0 || node.generation != (uint32_t)(id >> 32)) {
+        return false;
+    }
+    unlink(index);
+    node.callback = nullptr;
+    node.generation++;
+    mFree.push_back(index);
+    mSize--;
+    return true;
+}
+
+void TimerWheel::advance(int64_t now)
+{
+    if (mOrigin < 0) {
+        return;
+    }
+    uint64_t target = (uint64_t)((now - mOrigin) / mTick);
+    while (mCurrent < target) {
+        mCurrent++;
+        // the higher levels hand their slot of the next 256 ticks down when the lower one wraps
+        for (int level = 1; level < LEVELS; level++) {
+            if (((mCurrent >> ((level - 1) * SLOT_BITS)) & (SLOTS - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+        int32_t& head = mHeads[mCurrent & (SLOTS - 1)];
+        while (head >= 0) {
+            int32_t index = head;
+            Node& node = mNodes[index];
+            unlink(index);
+            Callback callback = std::move(node.callback);
+            node.callback = nullptr;
+            node.generation++;
+            mFree.push_back(index);
+            mSize--;
+            // the node is free before the call, the callback may schedule into it
+            callback();
+        }
+    }
+}
+
+size_t TimerWheel::size() const
+{
+    return mSize;
+}
+
+void TimerWheel::link(int32_t index)
+{
+    Node& node = mNodes[index];
+    uint64_t delta = node.expire - mCurrent;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * SLOT_BITS))) {
+        level++;
+    }
+    // beyond the span of the wheel, some 500 days at 10ms, the timer is cut to it
+    if (delta >= ((uint64_t)1 << (LEVELS * SLOT_BITS))) {
+        node.expire = mCurrent + ((uint64_t)1 << (LEVELS * SLOT_BITS)) - 1;
+    }
+    int slot = (int)((node.expire >> (level * SLOT_BITS)) & (SLOTS - 1));
+    node.bucket = level * SLOTS + slot;
+    node.prev = -1;
+    node.next = mHeads[node.bucket];
+    if (node.next >= 0) {
+        mNodes[node.next].prev = index;
+    }
+    mHeads[node.bucket] = index;
+}
+
+void TimerWheel::unlink(int32_t index)
+{
+    Node& node = mNodes[index];
+    if (node.prev >= 0) {
+        mNodes[node.prev].next = node.next;
+    } else {
+        mHeads[node.bucket] = node.next;
+    }
+    if (node.next >= 0) {
+        mNodes[node.next].prev = node.prev;
+    }
+    node.prev = -1;
+    node.next = -1;
+    node.bucket = -1;
+}
+
+void TimerWheel::cascade(int level)
+{
+    int slot = (int)((mCurrent >> (level * SLOT_BITS)) & (SLOTS - 1));
+    int32_t index = mHeads[level * SLOTS + slot];
+    mHeads[level * SLOTS + slot] = -1;
+    while (index >= 0) {
+        int32_t next = mNodes[index].next;
+        mNodes[index].bucket = -1;
+        link(index);
+        index = next;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+/**
+ * Hierarchical timing wheel for the per-request timeouts of many channels, schedule and cancel
+ * are O(1) and advance() costs one slot a tick plus a cascade every 256 ticks. Not thread safe,
+ * it belongs to the engine task, which calls advance() from a periodic timer:
+ *     TimerWheel::Id id = wheel.schedule(TimerWheel::NowMs(), 5000, [channel] { ... });
+ *     wheel.cancel(id);
+ */
+class TimerWheel {
+public:
+    /** 0 is never a timer, so it can mark one that is not running */
+    typedef uint64_t Id;
+    typedef std::function<void()> Callback;
+
+    /** tick is the resolution (ms), timers fire up to one tick late */
+    explicit TimerWheel(int tick);
+    /** fire callback once advance() passes now + delay (ms) */
+    Id schedule(int64_t now, int64_t delay, Callback callback);
+    /** false when the timer fired or was cancelled already */
+    bool cancel(Id id);
+    /** fire the timers due by now, a callback may schedule or cancel timers */
+    void advance(int64_t now);
+    size_t size() const;
+
+    static int64_t NowMs();
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 8;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    struct Node {
+        uint64_t expire = 0;
+        uint32_t generation = 0;
+        int32_t prev = -1;
+        int32_t next = -1;
+        /** level * SLOTS + slot while linked, -1 while free */
+        int32_t bucket = -1;
+        Callback callback;
+    };
+
+    void link(int32_t index);
+    void unlink(int32_t index);
+    void cascade(int level);
+
+    int mTick;
+    /** ms of tick 0, set by the first schedule() */
+    int64_t mOrigin = -1;
+    uint64_t mCurrent = 0;
+    size_t mSize = 0;
+    int32_t mHeads[LEVELS * SLOTS];
+    /** nodes are addressed by index, an id is the index with the generation it was scheduled in */
+    std::vector<Node> mNodes;
+    std::vector<int32_t> mFree;
+};
@@ -0,0 +1,73 @@
+#include "BackgroundWorker.h"
+
+BackgroundWorker::BackgroundWorker(size_t maxThreads)
+    : mMaxThreads(maxThreads > 0 ? maxThreads : 1)
+{
+}
+
+BackgroundWorker::~BackgroundWorker()
+{
+    stop();
+}
+
+void BackgroundWorker::setMaxThreads(size_t maxThreads)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    mMaxThreads = maxThreads > 0 ? maxThreads : 1;
+}
+
+void BackgroundWorker::post(Job job)
+{
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        if (!mIsStop) {
+            mJobs.push_back(std::move(job));
+            // one blocked job must not hold up the others, start a thread while none is free
+            if (mIdle < mJobs.size() && mThreads.size() < mMaxThreads) {
+                mThreads.emplace_back(&BackgroundWorker::run, this);
+            }
+            mCv.notify_one();
+            return;
+        }
+    }
+    // the worker is being stopped, run in the caller rather than lose the job
+    job();
+}
+
+void BackgroundWorker::stop()
+{
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        mIsStop = true;
+        mCv.notify_all();
+        threads.swap(mThreads);
+    }
+    for (auto& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    std::lock_guard<std::mutex> l(mMutex);
+    mIsStop = false;
+}
+
+void BackgroundWorker::run()
+{
+    std::unique_lock<std::mutex> l(mMutex);
+    while (true) {
+        mIdle++;
+        mCv.wait(l, [this] { return mIsStop || !mJobs.empty(); });
+        mIdle--;
+        if (mJobs.empty()) {
+            break;
+        }
+        Job job = std::move(mJobs.front());
+        mJobs.pop_front();
+        l.unlock();
+        job();
+        // release captured objects before taking the lock again
+        job = nullptr;
+        l.lock();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Small pool of worker threads for slow vendor work, such as session teardown or opening a
+ * session admitted late, which must run neither on the engine task nor on the media thread.
+ * Each engine owns its workers, threads are started as jobs queue up, at most maxThreads.
+ *     worker->post([synthesizer] { synthesizer->stop(); });
+ */
+class BackgroundWorker {
+public:
+    typedef std::function<void()> Job;
+
+    explicit BackgroundWorker(size_t maxThreads = 1);
+    /** stops the workers */
+    ~BackgroundWorker();
+
+    /** takes effect for threads started afterwards, at least one */
+    void setMaxThreads(size_t maxThreads);
+    /** run the job later on a worker thread */
+    void post(Job job);
+    /** run the jobs already posted and join the threads, jobs posted meanwhile run in the caller */
+    void stop();
+
+private:
+    void run();
+
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    std::deque<Job> mJobs;
+    std::vector<std::thread> mThreads;
+    size_t mMaxThreads;
+    /** threads waiting for a job */
+    size_t mIdle = 0;
+    bool mIsStop = false;
+};
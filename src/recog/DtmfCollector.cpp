@@ -0,0 +1,141 @@
+#include "DtmfCollector.h"
+#include <stdlib.h>
+#include <sstream>
+
+#define DIGITS_GRAMMAR "builtin:dtmf/digits"
+
+namespace {
+bool ParseLength(const string& value, size_t& out)
+{
+    char* end = nullptr;
+    long n = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || n < 0 || n > 64) {
+        return false;
+    }
+    out = (size_t)n;
+    return true;
+}
+}
+
+bool DtmfCollector::parse(const string& uri)
+{
+    if (uri.compare(0, sizeof(DIGITS_GRAMMAR) - 1, DIGITS_GRAMMAR) != 0) {
+        return false;
+    }
+    string query = uri.substr(sizeof(DIGITS_GRAMMAR) - 1);
+    if (query.empty()) {
+        return true;
+    }
+    if (query[0] != '?') {
+        return false;
+    }
+    // name=value pairs separated by ';', as in the builtin grammars of other servers, '&' is taken too
+    size_t pos = 1;
+    while (pos < query.size()) {
+        size_t end = query.find_first_of(";&", pos);
+        if (end == string::npos) {
+            end = query.size();
+        }
+        string pair = query.substr(pos, end - pos);
+        pos = end + 1;
+        if (pair.empty()) {
+            continue;
+        }
+        size_t eq = pair.find('=');
+        if (eq == string::npos) {
+            return false;
+        }
+        string name = pair.substr(0, eq);
+        string value = pair.substr(eq + 1);
+        size_t length = 0;
+        if (!ParseLength(value, length)) {
+            return false;
+        }
+        if (name == "length") {
+            mMinLength = length;
+            mMaxLength = length;
+        } else if (name == "minlength") {
+            mMinLength = length;
+        } else if (name == "maxlength") {
+            mMaxLength = length;
+        } else {
+            return false;
+        }
+    }
+    return mMaxLength == 0 || mMinLength <= mMaxLength;
+}
+
+void DtmfCollector::setTermChar(char val)
+{
+    mTermChar = val;
+}
+
+void DtmfCollector::setInterdigitTimeout(int val)
+{
+    mInterdigitTimeout = val;
+}
+
+DtmfCollector::State DtmfCollector::add(int eventId, int64_t now)
+{
+    char key = ToChar(eventId);
+    if (!key) {
+        return COLLECTING;
+    }
+    mLastDigit = now;
+    if (mTermChar && key == mTermChar) {
+        return finish();
+    }
+    if (key < '0' || key > '9') {
+        return NO_MATCH;
+    }
+    mDigits.push_back(key);
+    if (mMaxLength > 0 && mDigits.size() >= mMaxLength) {
+        return finish();
+    }
+    return COLLECTING;
+}
+
+DtmfCollector::State DtmfCollector::check(int64_t now)
+{
+    if (mDigits.empty() || mInterdigitTimeout <= 0 || now - mLastDigit < mInterdigitTimeout) {
+        return COLLECTING;
+    }
+    return finish();
+}
+
+DtmfCollector::State DtmfCollector::finish()
+{
+    return mDigits.size() >= mMinLength ? MATCH : NO_MATCH;
+}
+
+bool DtmfCollector::hasInput() const
+{
+    return mLastDigit != 0;
+}
+
+const string& DtmfCollector::getDigits() const
+{
+    return mDigits;
+}
+
+void DtmfCollector::reset()
+{
+    mDigits.clear();
+    mLastDigit = 0;
+}
+
+string DtmfCollector::toString() const
+{
+    std::ostringstream oss;
+    oss << "min_length:" << mMinLength << " max_length:" << mMaxLength << " term_char:" << (mTermChar ? mTermChar : '-') << " interdigit_timeout:" << mInterdigitTimeout;
+    return oss.str();
+}
+
+char DtmfCollector::ToChar(int eventId)
+{
+    static const char sKeys[] = "0123456789*#ABCD";
+    if (eventId < 0 || eventId >= (int)sizeof(sKeys) - 1) {
+        return 0;
+    }
+    return sKeys[eventId];
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+using std::string;
+
+/**
+ * Keypad input of a RECOGNIZE matched locally against a builtin digits grammar, so it completes
+ * without a vendor round trip. The grammar is given as a line of the RECOGNIZE body:
+ *     builtin:dtmf/digits?minlength=1;maxlength=4
+ *     builtin:dtmf/digits?length=6
+ * Input ends on the term char, at maxlength, or when no digit came for the interdigit timeout.
+ */
+class DtmfCollector {
+public:
+    enum State {
+        COLLECTING,
+        MATCH,
+        NO_MATCH
+    };
+
+    /** false when the uri is not a digits grammar or its parameters are invalid */
+    bool parse(const string& uri);
+    /** DTMF-Term-Char, 0 for none */
+    void setTermChar(char val);
+    /** DTMF-Interdigit-Timeout (ms) */
+    void setInterdigitTimeout(int val);
+    /** an RFC 4733 event, 0-9 * # A-D */
+    State add(int eventId, int64_t now);
+    /** ends input once the interdigit timeout passed since the last digit */
+    State check(int64_t now);
+    bool hasInput() const;
+    const string& getDigits() const;
+    /** drop the digits collected, for the next turn */
+    void reset();
+    string toString() const;
+
+    /** the key of an RFC 4733 event id, 0 for other events */
+    static char ToChar(int eventId);
+
+private:
+    State finish();
+
+    size_t mMinLength = 1;
+    /** 0 is unlimited */
+    size_t mMaxLength = 0;
+    char mTermChar = 0;
+    int mInterdigitTimeout = 5000;
+    string mDigits;
+    int64_t mLastDigit = 0;
+};
@@ -0,0 +1,82 @@
+#include "PreRoll.h"
+#include <string.h>
+#include <algorithm>
+
+PreRoll::PreRoll(size_t capacity)
+    : mData(capacity > 0 ? capacity : 1)
+{
+}
+
+void PreRoll::push(const char* data, size_t len)
+{
+    size_t capacity = mData.size();
+    // only the tail of a frame larger than the ring is kept
+    if (len > capacity) {
+        data += len - capacity;
+        mWritten += len - capacity;
+        len = capacity;
+    }
+    size_t pos = (size_t)(mWritten % capacity);
+    size_t first = std::min(len, capacity - pos);
+    memcpy(mData.data() + pos, data, first);
+    memcpy(mData.data(), data + first, len - first);
+    mWritten += len;
+    if (mWritten - mRead > capacity) {
+        mLost += (size_t)(mWritten - mRead - capacity);
+        mRead = mWritten - capacity;
+    }
+}
+
+bool PreRoll::begin(const string& voiceId, uint32_t turn)
+{
+    if (voiceId == mVoiceId && turn == mTurn) {
+        return false;
+    }
+    mVoiceId = voiceId;
+    mTurn = turn;
+    return true;
+}
+
+void PreRoll::rewind(size_t back)
+{
+    uint64_t held = std::min<uint64_t>(mWritten, mData.size());
+    mRead = mWritten - std::min<uint64_t>(back, held);
+    mLost = 0;
+}
+
+void PreRoll::skip()
+{
+    mRead = mWritten;
+}
+
+const char* PreRoll::read(size_t max, size_t& len)
+{
+    len = std::min(backlog(), max);
+    if (len == 0) {
+        return nullptr;
+    }
+    size_t capacity = mData.size();
+    size_t pos = (size_t)(mRead % capacity);
+    size_t first = std::min(len, capacity - pos);
+    mRead += len;
+    if (first == len) {
+        return mData.data() + pos;
+    }
+    // the span wraps, it is handed out in one piece
+    mOut.resize(len);
+    memcpy(mOut.data(), mData.data() + pos, first);
+    memcpy(mOut.data() + first, mData.data(), len - first);
+    return mOut.data();
+}
+
+size_t PreRoll::backlog() const
+{
+    return (size_t)(mWritten - mRead);
+}
+
+size_t PreRoll::takeLost()
+{
+    size_t lost = mLost;
+    mLost = 0;
+    return lost;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+
+/**
+ * The latest audio of a channel, captured on every frame whether or not a session is running, so
+ * speech before a vendor session is ready is not lost. A new session or continuous turn starts
+ * reading preroll bytes back from the newest audio, the backlog is then sent a few frames per
+ * frame until it is caught up with the live audio. Media thread only.
+ */
+class PreRoll {
+public:
+    /** capacity bytes are held, the backlog older than that is dropped */
+    explicit PreRoll(size_t capacity);
+    void push(const char* data, size_t len);
+    /** true once for each session and turn, the caller then rewinds to take the pre-roll */
+    bool begin(const string& voiceId, uint32_t turn);
+    /** read from back bytes before the newest audio, or from the oldest held if that is less */
+    void rewind(size_t back);
+    /** nothing is owed to the session, the next read starts at the newest audio */
+    void skip();
+    /** up to max bytes of the backlog, valid until the next call, nullptr when caught up */
+    const char* read(size_t max, size_t& len);
+    size_t backlog() const;
+    /** backlog bytes which fell out of the ring, since the last call */
+    size_t takeLost();
+
+private:
+    std::vector<char> mData;
+    std::vector<char> mOut;
+    /** absolute byte positions, the ring index is the position modulo the capacity */
+    uint64_t mWritten = 0;
+    uint64_t mRead = 0;
+    size_t mLost = 0;
+    string mVoiceId;
+    uint32_t mTurn = 0;
+};
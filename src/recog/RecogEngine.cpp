@@ -28,22 +28,56 @@
  */
 #include "RecogEngine.h"
 #include "Recognize.h"
+#include "PreRoll.h"
 #include "apr_general.h"
 #include "apt.h"
 #include "mrcp_recog_header.h"
 #include "mrcp_types.h"
+#include "metrics/Metrics.h"
+#include "session/SessionTable.h"
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
 #include <memory>
+#include <sstream>
 
 #define RECOG_ENGINE_TASK_NAME "Recog Engine"
+#define RECOG_ENGINE_TIMER_INTERVAL 10000
+#define RECOG_ADMISSION_TIMER_INTERVAL 100
+#define RECOG_SESSION_MAX_AGE 3600000
+#define RECOG_SESSION_MAX_IDLE 60000
+#define RECOG_CONTINUOUS_KEEPALIVE 5000
+#define RECOG_WHEEL_TICK 10
+#define RECOG_NO_INPUT_TIMEOUT 10000
+#define RECOG_RECOGNITION_TIMEOUT 30000
+/** silence the activity detector waits for before it reports the end of speech (msec) */
+#define RECOG_SPEECH_HANGOVER 300
+#define RECOG_PREROLL 300
+#define RECOG_PREROLL_MAX 3000
+/** frames of backlog sent to the vendor for each frame received, until it is caught up */
+#define RECOG_PREROLL_BURST 4
+#define RECOG_SESSION_TABLE_SIZE 1024
+#define RECOG_WORKER_THREADS 4
 
 typedef struct demo_recog_msg_t demo_recog_msg_t;
 
+static std::atomic<int64_t>& sSessions = Metrics::Get("recog_sessions");
+static std::atomic<int64_t>& sReapedAge = Metrics::Get("recog_reaped_age_total");
+static std::atomic<int64_t>& sReapedIdle = Metrics::Get("recog_reaped_idle_total");
+static std::atomic<int64_t>& sReapedOrphan = Metrics::Get("recog_reaped_orphan_total");
+static std::atomic<int64_t>& sTimers = Metrics::Get("recog_timers");
+static std::atomic<int64_t>& sNoInputTimeout = Metrics::Get("recog_timeout_no_input_total");
+static std::atomic<int64_t>& sRecognitionTimeout = Metrics::Get("recog_timeout_recognition_total");
+static std::atomic<int64_t>& sSpeechCompleteTimeout = Metrics::Get("recog_timeout_speech_complete_total");
+static std::atomic<int64_t>& sPreRollLost = Metrics::Get("recog_preroll_lost_bytes_total");
+
 /** Declaration of recognizer engine methods */
 static apt_bool_t demo_recog_engine_destroy(mrcp_engine_t* engine);
 static apt_bool_t demo_recog_engine_open(mrcp_engine_t* engine);
 static apt_bool_t demo_recog_engine_close(mrcp_engine_t* engine);
 static mrcp_engine_channel_t* demo_recog_engine_channel_create(mrcp_engine_t* engine, apr_pool_t* pool);
 static apt_bool_t demo_recog_recognition_complete(demo_recog_channel_t* recog_channel, mrcp_recog_completion_cause_e cause, string body);
+static apt_bool_t demo_recog_vendor_params_get(mrcp_message_t* request, std::map<string, string>& params, mrcp_status_code_e* status);
 
 static const struct mrcp_engine_method_vtable_t engine_vtable = {
     demo_recog_engine_destroy,
@@ -92,6 +126,11 @@ struct demo_recog_msg_t {
 };
 
 static apt_bool_t demo_recog_msg_process(apt_task_t* task, apt_task_msg_t* msg);
+static void demo_recog_engine_timer_proc(apt_timer_t* timer, void* obj);
+static void demo_recog_reap(demo_recog_engine_t* demo_engine);
+static void demo_recog_admission_timer_proc(apt_timer_t* timer, void* obj);
+static void demo_recog_wheel_timer_proc(apt_timer_t* timer, void* obj);
+static void demo_recog_timers_stop(demo_recog_channel_t* recog_channel);
 
 /** Declare this macro to set plugin version */
 MM_MRCP_PLUGIN_VERSION_DECLARE
@@ -126,6 +165,24 @@ mrcp_plugin_create(apr_pool_t* pool)
     if (vtable) {
         vtable->process_msg = demo_recog_msg_process;
     }
+    demo_engine->timer = apt_consumer_task_timer_create(demo_engine->task, demo_recog_engine_timer_proc, demo_engine, pool);
+    demo_engine->timer_interval = RECOG_ENGINE_TIMER_INTERVAL;
+    demo_engine->metrics_file = new string();
+    demo_engine->admission_timer = apt_consumer_task_timer_create(demo_engine->task, demo_recog_admission_timer_proc, demo_engine, pool);
+    demo_engine->session_table = new SessionTable();
+    demo_engine->stop_worker = new BackgroundWorker(RECOG_WORKER_THREADS);
+    demo_engine->session_max_age = RECOG_SESSION_MAX_AGE;
+    demo_engine->session_max_idle = RECOG_SESSION_MAX_IDLE;
+    demo_engine->continuous = FALSE;
+    demo_engine->keepalive_interval = RECOG_CONTINUOUS_KEEPALIVE;
+    demo_engine->wheel = new TimerWheel(RECOG_WHEEL_TICK);
+    demo_engine->channels = new std::map<string, demo_recog_channel_t*>();
+    demo_engine->wheel_timer = apt_consumer_task_timer_create(demo_engine->task, demo_recog_wheel_timer_proc, demo_engine, pool);
+    demo_engine->no_input_timeout = RECOG_NO_INPUT_TIMEOUT;
+    demo_engine->recognition_timeout = RECOG_RECOGNITION_TIMEOUT;
+    demo_engine->speech_complete_timeout = 0;
+    demo_engine->preroll = RECOG_PREROLL;
+    demo_engine->preroll_max = RECOG_PREROLL_MAX;
 
     INFOLN("end create recog engine");
     /* create engine base */
@@ -146,6 +203,16 @@ static apt_bool_t demo_recog_engine_destroy(mrcp_engine_t* engine)
         apt_task_destroy(task);
         demo_engine->task = NULL;
     }
+    delete demo_engine->wheel;
+    demo_engine->wheel = NULL;
+    delete demo_engine->channels;
+    demo_engine->channels = NULL;
+    delete demo_engine->metrics_file;
+    demo_engine->metrics_file = NULL;
+    delete demo_engine->session_table;
+    demo_engine->session_table = NULL;
+    delete demo_engine->stop_worker;
+    demo_engine->stop_worker = NULL;
     INFOLN("end destroy recog engine");
     return TRUE;
 }
@@ -155,10 +222,80 @@ static apt_bool_t demo_recog_engine_open(mrcp_engine_t* engine)
 {
     INFOLN("begin open recog engine");
     demo_recog_engine_t* demo_engine = (demo_recog_engine_t*)engine->obj;
+    IniParser ini;
+    int metricsInterval = 0;
+    int maxAge = RECOG_SESSION_MAX_AGE;
+    int maxIdle = RECOG_SESSION_MAX_IDLE;
+    int continuous = 0;
+    int keepAlive = RECOG_CONTINUOUS_KEEPALIVE;
+    int noInputTimeout = RECOG_NO_INPUT_TIMEOUT;
+    int recognitionTimeout = RECOG_RECOGNITION_TIMEOUT;
+    int speechCompleteTimeout = 0;
+    int preRoll = RECOG_PREROLL;
+    int preRollMax = RECOG_PREROLL_MAX;
+    int sessionTableSize = RECOG_SESSION_TABLE_SIZE;
+    int workerThreads = RECOG_WORKER_THREADS;
+    string sessionTable = "mrcpmod";
+    string metricsDir;
+    string type;
+    ini.setFileName(Recognize::GetConfigFile());
+    ini.get("generic", "session_max_age", maxAge);
+    ini.get("generic", "session_max_idle", maxIdle);
+    demo_engine->session_max_age = std::max(maxAge, 0);
+    demo_engine->session_max_idle = std::max(maxIdle, 0);
+    ini.get("generic", "recog_continuous", continuous);
+    ini.get("generic", "recog_continuous_keepalive", keepAlive);
+    demo_engine->continuous = continuous ? TRUE : FALSE;
+    demo_engine->keepalive_interval = std::max(keepAlive, 0);
+    ini.get("generic", "recog_no_input_timeout", noInputTimeout);
+    ini.get("generic", "recog_recognition_timeout", recognitionTimeout);
+    ini.get("generic", "recog_speech_complete_timeout", speechCompleteTimeout);
+    demo_engine->no_input_timeout = std::max(noInputTimeout, 0);
+    demo_engine->recognition_timeout = std::max(recognitionTimeout, 0);
+    demo_engine->speech_complete_timeout = std::max(speechCompleteTimeout, 0);
+    ini.get("generic", "recog_preroll", preRoll);
+    ini.get("generic", "recog_preroll_max", preRollMax);
+    demo_engine->preroll = std::max(preRoll, 0);
+    demo_engine->preroll_max = std::max(preRollMax, 0);
+    ini.get("generic", "type", type);
+    ini.get("generic", "metrics_dir", metricsDir);
+    ini.get("generic", "metrics_interval", metricsInterval);
+    ini.get("generic", "worker_threads", workerThreads);
+    if (workerThreads > 0) {
+        demo_engine->stop_worker->setMaxThreads(workerThreads);
+    }
+    for (auto& account : Admission::Load(ini, type, "asr")) {
+        INFOLN("admission account, backend:%s account:%s limit:%d weight:%d", (type + "_asr").c_str(), account.credential.name.c_str(), account.limit, account.weight);
+    }
+    ini.get("generic", "session_table", sessionTable);
+    ini.get("generic", "session_table_size", sessionTableSize);
+    if (!sessionTable.empty() && sessionTableSize > 0) {
+        string name = "/" + sessionTable + "-recog";
+        if (demo_engine->session_table->open(name, sessionTableSize)) {
+            INFOLN("session table open, name:%s size:%d", name.c_str(), sessionTableSize);
+        } else {
+            ERRLN("session table open failed, name:%s size:%d err:%s", name.c_str(), sessionTableSize, strerror(errno));
+        }
+    }
+    if (!metricsDir.empty()) {
+        *demo_engine->metrics_file = metricsDir + "/recog.prom";
+    }
+    if (metricsInterval > 0) {
+        demo_engine->timer_interval = metricsInterval;
+    }
     if (demo_engine->task) {
         apt_task_t* task = apt_consumer_task_base_get(demo_engine->task);
         apt_task_start(task);
     }
+    if (demo_engine->timer) {
+        apt_timer_set(demo_engine->timer, demo_engine->timer_interval);
+    }
+    if (demo_engine->admission_timer) {
+        apt_timer_set(demo_engine->admission_timer, RECOG_ADMISSION_TIMER_INTERVAL);
+    }
+    if (demo_engine->wheel_timer) {
+        apt_timer_set(demo_engine->wheel_timer, RECOG_WHEEL_TICK);
+    }
     INFOLN("end open recog engine");
     return mrcp_engine_open_respond(engine, TRUE);
 }
@@ -168,6 +305,18 @@ static apt_bool_t demo_recog_engine_close(mrcp_engine_t* engine)
 {
     INFOLN("begin close recog engine");
     demo_recog_engine_t* demo_engine = (demo_recog_engine_t*)engine->obj;
+    /* finish vendor teardown of stopped sessions */
+    demo_engine->stop_worker->stop();
+    if (demo_engine->timer) {
+        apt_timer_kill(demo_engine->timer);
+    }
+    if (demo_engine->admission_timer) {
+        apt_timer_kill(demo_engine->admission_timer);
+    }
+    if (demo_engine->wheel_timer) {
+        apt_timer_kill(demo_engine->wheel_timer);
+    }
+    demo_engine->session_table->close();
     if (demo_engine->task) {
         apt_task_t* task = apt_consumer_task_base_get(demo_engine->task);
         apt_task_terminate(task, TRUE);
@@ -188,6 +337,14 @@ static mrcp_engine_channel_t* demo_recog_engine_channel_create(mrcp_engine_t* en
     recog_channel->recog_request = NULL;
     recog_channel->stop_response = NULL;
     recog_channel->detector = mpf_activity_detector_create(pool);
+    mpf_activity_detector_silence_timeout_set(recog_channel->detector, RECOG_SPEECH_HANGOVER);
+    recog_channel->no_input_timer = 0;
+    recog_channel->recognition_timer = 0;
+    recog_channel->speech_complete_timer = 0;
+    recog_channel->input_started = FALSE;
+    recog_channel->preroll = NULL;
+    recog_channel->preroll_size = 0;
+    recog_channel->params = new std::map<string, string>();
 
     capabilities = mpf_sink_stream_capabilities_create(pool);
     mpf_codec_capabilities_add(&capabilities->codecs, MPF_SAMPLE_RATE_8000 | MPF_SAMPLE_RATE_16000, "LPCM");
@@ -216,7 +373,11 @@ static apt_bool_t demo_recog_channel_destroy(mrcp_engine_channel_t* channel)
 {
     string channelId(channel->id.buf, channel->id.length);
     INFOLN("demo_recog_channel_destroy, channelId:%s", channelId.c_str());
-    /* nothing to destrtoy */
+    demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)channel->method_obj;
+    delete recog_channel->params;
+    recog_channel->params = NULL;
+    delete recog_channel->preroll;
+    recog_channel->preroll = NULL;
     return TRUE;
 }
 
@@ -243,7 +404,7 @@ static apt_bool_t demo_recog_channel_close(mrcp_engine_channel_t* channel)
 {
     string channelId(channel->id.buf, channel->id.length);
     INFOLN("close recog channel, channelId:%s", channelId.c_str());
-    Recognize::Del(channelId);
+    /* the session is removed by the engine task, after the requests queued ahead of the close */
     return demo_recog_msg_signal(DEMO_RECOG_MSG_CLOSE_CHANNEL, channel, NULL, RECOGNIZER_COMPLETION_CAUSE_SUCCESS, NULL);
 }
 
@@ -281,6 +442,209 @@ static apt_bool_t demo_recog_channel_request_process(mrcp_engine_channel_t* chan
     return demo_recog_msg_signal(DEMO_RECOG_MSG_REQUEST_PROCESS, channel, request, RECOGNIZER_COMPLETION_CAUSE_SUCCESS, NULL);
 }
 
+typedef enum {
+    DEMO_RECOG_TIMEOUT_NO_INPUT,
+    DEMO_RECOG_TIMEOUT_RECOGNITION,
+    DEMO_RECOG_TIMEOUT_SPEECH_COMPLETE
+} demo_recog_timeout_e;
+
+/** Timer of the active request on the engine's wheel */
+static TimerWheel::Id* demo_recog_timer_get(demo_recog_channel_t* recog_channel, demo_recog_timeout_e which, apr_size_t* timeout)
+{
+    switch (which) {
+    case DEMO_RECOG_TIMEOUT_NO_INPUT:
+        *timeout = recog_channel->no_input_timeout;
+        return &recog_channel->no_input_timer;
+    case DEMO_RECOG_TIMEOUT_RECOGNITION:
+        *timeout = recog_channel->recognition_timeout;
+        return &recog_channel->recognition_timer;
+    default:
+        *timeout = recog_channel->speech_complete_timeout;
+        return &recog_channel->speech_complete_timer;
+    }
+}
+
+/** Stop the request's session, a continuous stream is kept for the next turn unless it cannot be reused */
+static void demo_recog_session_end(const string& channelId)
+{
+    auto recognize = Recognize::GetRecognize(Recognize::GetVoiceId(channelId));
+    if (recognize && recognize->isContinuous()) {
+        /* the stream is kept for the next turn, results until then are dropped */
+        recognize->disarm();
+        if (!recognize->isReusable()) {
+            Recognize::Del(channelId);
+        }
+    } else {
+        Recognize::Del(channelId);
+    }
+}
+
+/** A timer of the request fired, in the context of the engine task */
+static void demo_recog_timeout(demo_recog_channel_t* recog_channel, mrcp_message_t* request, demo_recog_timeout_e which)
+{
+    apr_size_t timeout = 0;
+    *demo_recog_timer_get(recog_channel, which, &timeout) = 0;
+    if (recog_channel->recog_request != request) {
+        return;
+    }
+    string channelId(recog_channel->channel->id.buf, recog_channel->channel->id.length);
+    if (which == DEMO_RECOG_TIMEOUT_SPEECH_COMPLETE) {
+        /* the vendor has not ended the sentence, it is asked for the result of the audio it got */
+        auto recognize = Recognize::GetRecognize(Recognize::GetVoiceId(channelId));
+        if (recognize && recog_channel->input_started) {
+            sSpeechCompleteTimeout++;
+            INFOLN("speech complete timeout, flush recognize, timeout:%d channelId:%s", (int)timeout, channelId.c_str());
+            recognize->flush();
+        }
+        return;
+    }
+    mrcp_recog_completion_cause_e cause = RECOGNIZER_COMPLETION_CAUSE_NO_INPUT_TIMEOUT;
+    if (which == DEMO_RECOG_TIMEOUT_NO_INPUT) {
+        sNoInputTimeout++;
+    } else {
+        sRecognitionTimeout++;
+        cause = RECOGNIZER_COMPLETION_CAUSE_RECOGNITION_TIMEOUT;
+    }
+    WARNLN("recognize timeout, cause:%d timeout:%d channelId:%s", cause, (int)timeout, channelId.c_str());
+    /* the vendor session is freed at once rather than when the vendor gives up */
+    demo_recog_session_end(channelId);
+    demo_recog_recognition_complete(recog_channel, cause, "");
+}
+
+/** Start a timer of the active request unless it runs already or its timeout is 0 */
+static void demo_recog_timer_start(demo_recog_channel_t* recog_channel, demo_recog_timeout_e which)
+{
+    apr_size_t timeout = 0;
+    TimerWheel::Id* timer = demo_recog_timer_get(recog_channel, which, &timeout);
+    if (*timer || timeout == 0 || !recog_channel->recog_request) {
+        return;
+    }
+    mrcp_message_t* request = recog_channel->recog_request;
+    int64_t delay = timeout;
+    if (which == DEMO_RECOG_TIMEOUT_SPEECH_COMPLETE) {
+        /* started at the end of speech, the detector waited out its hangover already */
+        delay = std::max<int64_t>(delay - RECOG_SPEECH_HANGOVER, 0);
+    }
+    *timer = recog_channel->demo_engine->wheel->schedule(TimerWheel::NowMs(), delay, [recog_channel, request, which] {
+        demo_recog_timeout(recog_channel, request, which);
+    });
+}
+
+static void demo_recog_timer_stop(demo_recog_channel_t* recog_channel, demo_recog_timeout_e which)
+{
+    apr_size_t timeout = 0;
+    TimerWheel::Id* timer = demo_recog_timer_get(recog_channel, which, &timeout);
+    recog_channel->demo_engine->wheel->cancel(*timer);
+    *timer = 0;
+}
+
+/** Stop the timers of the request, it completed or the channel goes */
+static void demo_recog_timers_stop(demo_recog_channel_t* recog_channel)
+{
+    demo_recog_timer_stop(recog_channel, DEMO_RECOG_TIMEOUT_NO_INPUT);
+    demo_recog_timer_stop(recog_channel, DEMO_RECOG_TIMEOUT_RECOGNITION);
+    demo_recog_timer_stop(recog_channel, DEMO_RECOG_TIMEOUT_SPEECH_COMPLETE);
+}
+
+/** Declaration of the grammars of a RECOGNIZE */
+struct demo_recog_grammars_t {
+    /** builtin:partial, sentences are reported as partial matches */
+    bool partial = false;
+    /** a grammar other than the builtin ones, the vendor recognizes speech */
+    bool speech = false;
+    /** builtin:dtmf/digits, keypad input is matched locally */
+    bool dtmf = false;
+    DtmfCollector digits;
+};
+
+/** Grammars of the RECOGNIZE body, one uri a line, and the DTMF headers applying to a digits grammar */
+static void demo_recog_grammars_get(mrcp_message_t* request, demo_recog_grammars_t* grammars)
+{
+    string body(request->body.buf, request->body.length);
+    std::istringstream iss(body);
+    string line;
+    while (std::getline(iss, line)) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        size_t end = line.find_last_not_of(" \t\r");
+        line = begin == string::npos ? "" : line.substr(begin, end - begin + 1);
+        if (line.empty()) {
+            continue;
+        }
+        if (line == "builtin:partial") {
+            grammars->partial = true;
+        } else if (grammars->digits.parse(line)) {
+            grammars->dtmf = true;
+        } else {
+            grammars->speech = true;
+        }
+    }
+    /* a body without grammars leaves the recognition to the vendor, as before */
+    if (!grammars->dtmf) {
+        grammars->speech = true;
+        return;
+    }
+    mrcp_recog_header_t* recog_header = (mrcp_recog_header_t*)mrcp_resource_header_get(request);
+    if (recog_header) {
+        if (mrcp_resource_header_property_check(request, RECOGNIZER_HEADER_DTMF_TERM_CHAR) == TRUE) {
+            grammars->digits.setTermChar(recog_header->dtmf_term_char);
+        }
+        if (mrcp_resource_header_property_check(request, RECOGNIZER_HEADER_DTMF_INTERDIGIT_TIMEOUT) == TRUE) {
+            grammars->digits.setInterdigitTimeout((int)recog_header->dtmf_interdigit_timeout);
+        }
+    }
+}
+
+/** Create a session for RECOGNIZE and start it, or queue it for admission; on failure the request is completed */
+static apt_bool_t demo_recog_recognize_start(demo_recog_channel_t* recog_channel, const demo_recog_grammars_t& grammars, const std::map<string, string>& params)
+{
+    string channelId(recog_channel->channel->id.buf, recog_channel->channel->id.length);
+    demo_recog_engine_t* demo_engine = recog_channel->demo_engine;
+    auto recognize = Recognize::Create(channelId, demo_engine->session_table, demo_engine->stop_worker);
+    if (NULL == recognize) {
+        ERRLN("create recognize error");
+        demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
+        return FALSE;
+    }
+    string voiceId = recognize->getVoiceId();
+    recognize->setRecogChannel(recog_channel);
+    if (grammars.partial) {
+        recognize->setPartial(true);
+        INFOLN("set partial match, channelId:%s", channelId.c_str());
+    }
+    if (grammars.dtmf) {
+        recognize->setDtmf(&grammars.digits);
+        INFOLN("set dtmf digits, %s speech:%d channelId:%s", grammars.digits.toString().c_str(), grammars.speech, channelId.c_str());
+    }
+    recognize->setParams(params);
+    if (demo_engine->continuous && grammars.speech) {
+        recognize->setContinuous(true, demo_engine->keepalive_interval);
+    }
+    /* registered before it starts, so STOP and channel close reach a session waiting for admission */
+    Recognize::Set(channelId, recognize);
+    if (!grammars.speech) {
+        /* keypad input only, no vendor session is needed */
+        return TRUE;
+    }
+    Admission::Result admission = recognize->admit();
+    if (admission == Admission::REJECTED) {
+        ERRLN("recognize admission rejected, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+        Recognize::Del(channelId);
+        demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
+        return FALSE;
+    }
+    if (admission == Admission::ADMITTED) {
+        int ret = recognize->init();
+        if (ret < 0) {
+            ERRLN("recognize init error, ret:%d channelId:%s voiceId:%s", ret, channelId.c_str(), voiceId.c_str());
+            Recognize::Del(channelId);
+            demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 /** Process RECOGNIZE request */
 static apt_bool_t demo_recog_channel_recognize(mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_message_t* response)
 {
@@ -292,6 +656,7 @@ static apt_bool_t demo_recog_channel_recognize(mrcp_engine_channel_t* channel, m
     string body(request->body.buf, request->body.length);
 
     INFOLN("begin recognize, body:%s channelId:%s", body.c_str(), channelId.c_str());
+    demo_recog_timers_stop(recog_channel);
     recog_channel->recog_request = request;
     if (!descriptor) {
         WARNLN("Failed to Get Codec Descriptor " APT_SIDRES_FMT, MRCP_MESSAGE_SIDRES(request));
@@ -299,33 +664,45 @@ static apt_bool_t demo_recog_channel_recognize(mrcp_engine_channel_t* channel, m
         return TRUE;
     }
 
+    /* channel values from SET-PARAMS, then this request's own, which do not outlive it */
+    std::map<string, string> params = *recog_channel->params;
+    mrcp_status_code_e status = MRCP_STATUS_CODE_SUCCESS;
+    if (!demo_recog_vendor_params_get(request, params, &status)) {
+        WARNLN("ignore invalid vendor specific params, status:%d channelId:%s", status, channelId.c_str());
+        params = *recog_channel->params;
+    }
+    demo_recog_grammars_t grammars;
+    demo_recog_grammars_get(request, &grammars);
+
     string voiceId = Recognize::GetVoiceId(channelId);
-    if (!voiceId.empty()) {
+    auto recognize = voiceId.empty() ? nullptr : Recognize::GetRecognize(voiceId);
+    if (recognize && recognize->isContinuous() && !recognize->isArmed()) {
+        /* continuous mode, the open vendor stream takes this turn unless it failed or was set up differently */
+        if (recognize->isReusable() && recognize->getParams() == params) {
+            recognize->setPartial(grammars.partial);
+            recognize->setDtmf(grammars.dtmf ? &grammars.digits : NULL);
+            recognize->arm();
+            INFOLN("continuous recognize turn, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+        } else {
+            INFOLN("continuous recognize restart the stream, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+            Recognize::Del(channelId);
+            recognize = nullptr;
+            voiceId.clear();
+        }
+    } else if (!voiceId.empty()) {
         WARNLN("channel is already recognize, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
         demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
         return TRUE;
     }
-    auto recognize = Recognize::Create(channelId);
-    if (NULL == recognize) {
-        ERRLN("create recognize error");
-        demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
-        return TRUE;
-    }
-    voiceId = recognize->getVoiceId();
-    recognize->setRecogChannel(recog_channel);
-    if (body == "builtin:partial") {
-        recognize->setPartial(true);
-        INFOLN("set partial match, channelId:%s", channelId.c_str());
-    }
-    int ret = recognize->init();
-    if (ret < 0) {
-        ERRLN("recognize init error, ret:%d channelId:%s voiceId:%s", ret, channelId.c_str(), voiceId.c_str());
-        demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
+    if (!recognize && !demo_recog_recognize_start(recog_channel, grammars, params)) {
         return TRUE;
     }
-    Recognize::Set(channelId, recognize);
-
+    voiceId = Recognize::GetVoiceId(channelId);
     recog_channel->timers_started = TRUE;
+    recog_channel->input_started = FALSE;
+    recog_channel->no_input_timeout = recog_channel->demo_engine->no_input_timeout;
+    recog_channel->recognition_timeout = recog_channel->demo_engine->recognition_timeout;
+    recog_channel->speech_complete_timeout = recog_channel->demo_engine->speech_complete_timeout;
 
     /* get recognizer header */
     recog_header = (mrcp_recog_header_t*)mrcp_resource_header_get(request);
@@ -334,26 +711,145 @@ static apt_bool_t demo_recog_channel_recognize(mrcp_engine_channel_t* channel, m
             recog_channel->timers_started = recog_header->start_input_timers;
         }
         if (mrcp_resource_header_property_check(request, RECOGNIZER_HEADER_NO_INPUT_TIMEOUT) == TRUE) {
-            mpf_activity_detector_noinput_timeout_set(recog_channel->detector, recog_header->no_input_timeout);
+            recog_channel->no_input_timeout = recog_header->no_input_timeout;
+        }
+        if (mrcp_resource_header_property_check(request, RECOGNIZER_HEADER_RECOGNITION_TIMEOUT) == TRUE) {
+            recog_channel->recognition_timeout = recog_header->recognition_timeout;
         }
         if (mrcp_resource_header_property_check(request, RECOGNIZER_HEADER_SPEECH_COMPLETE_TIMEOUT) == TRUE) {
-            mpf_activity_detector_silence_timeout_set(recog_channel->detector, recog_header->speech_complete_timeout);
+            recog_channel->speech_complete_timeout = recog_header->speech_complete_timeout;
         }
-        INFOLN("recognize param, start_input_timers:%d no_input_timeout:%d speech_complete_timeout:%d channelId:%s voiceId:%s", recog_header->start_input_timers, recog_header->no_input_timeout, recog_header->speech_complete_timeout, channelId.c_str(), voiceId.c_str());
+    }
+    INFOLN("recognize param, start_input_timers:%d no_input_timeout:%d recognition_timeout:%d speech_complete_timeout:%d channelId:%s voiceId:%s", recog_channel->timers_started, (int)recog_channel->no_input_timeout, (int)recog_channel->recognition_timeout, (int)recog_channel->speech_complete_timeout, channelId.c_str(), voiceId.c_str());
+    if (recog_channel->timers_started) {
+        demo_recog_timer_start(recog_channel, DEMO_RECOG_TIMEOUT_NO_INPUT);
     }
 
     INFOLN("end recognize, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
     return TRUE;
 }
 
+/** A RECOGNIZE which waited for admission got its slot, or was rejected, in the context of the engine task */
+static void demo_recog_channel_admitted(demo_recog_channel_t* recog_channel, mrcp_recog_completion_cause_e cause, const string& voiceId)
+{
+    string channelId(recog_channel->channel->id.buf, recog_channel->channel->id.length);
+    auto recognize = Recognize::GetRecognize(voiceId);
+    /* a continuous session stopped while queued still opens its stream for the next turn */
+    if (!recognize || (!recog_channel->recog_request && !recognize->isContinuous())) {
+        INFOLN("admitted recognize is gone, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+        return;
+    }
+    if (cause != RECOGNIZER_COMPLETION_CAUSE_SUCCESS) {
+        ERRLN("recognize admission timeout, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+    } else {
+        int ret = recognize->init();
+        if (ret >= 0) {
+            INFOLN("recognize admitted, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+            return;
+        }
+        ERRLN("recognize init error, ret:%d channelId:%s voiceId:%s", ret, channelId.c_str(), voiceId.c_str());
+    }
+    Recognize::Del(channelId);
+    if (recog_channel->recog_request) {
+        demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
+    }
+}
+
+/** Vendor-Specific-Parameters of a request added to params, on an unknown or invalid one nothing is added */
+static apt_bool_t demo_recog_vendor_params_get(mrcp_message_t* request, std::map<string, string>& params, mrcp_status_code_e* status)
+{
+    mrcp_generic_header_t* generic_header = mrcp_generic_header_get(request);
+    if (!generic_header || mrcp_generic_header_property_check(request, GENERIC_HEADER_VENDOR_SPECIFIC_PARAMS) != TRUE || !generic_header->vendor_specific_params) {
+        return TRUE;
+    }
+    std::map<string, string> values;
+    RecognizeParams check;
+    int count = apt_pair_array_size_get(generic_header->vendor_specific_params);
+    for (int i = 0; i < count; i++) {
+        const apt_pair_t* pair = apt_pair_array_get(generic_header->vendor_specific_params, i);
+        string name(pair->name.buf, pair->name.length);
+        string value(pair->value.buf ? pair->value.buf : "", pair->value.length);
+        RecognizeParams::SetResult result = check.set(name, value);
+        if (result != RecognizeParams::OK) {
+            *status = result == RecognizeParams::UNKNOWN_NAME ? MRCP_STATUS_CODE_UNSUPPORTED_PARAM : MRCP_STATUS_CODE_ILLEGAL_PARAM_VALUE;
+            WARNLN("invalid vendor specific param, name:%s value:%s", name.c_str(), value.c_str());
+            return FALSE;
+        }
+        values[name] = value;
+    }
+    for (auto& value : values) {
+        params[value.first] = value.second;
+    }
+    return TRUE;
+}
+
+/** Process SET-PARAMS request, the values apply to every later RECOGNIZE of the channel */
+static apt_bool_t demo_recog_channel_set_params(mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_message_t* response)
+{
+    string channelId(channel->id.buf, channel->id.length);
+    demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)channel->method_obj;
+    mrcp_status_code_e status = MRCP_STATUS_CODE_SUCCESS;
+    if (!demo_recog_vendor_params_get(request, *recog_channel->params, &status)) {
+        response->start_line.status_code = status;
+    }
+    INFOLN("set params, status:%d params:%zu channelId:%s", status, recog_channel->params->size(), channelId.c_str());
+    return mrcp_engine_channel_message_send(channel, response);
+}
+
+/** Process GET-PARAMS request, the requested vendor parameters or all of them as the next RECOGNIZE would use them */
+static apt_bool_t demo_recog_channel_get_params(mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_message_t* response)
+{
+    string channelId(channel->id.buf, channel->id.length);
+    demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)channel->method_obj;
+    IniParser ini;
+    string type;
+    RecognizeParams params;
+    ini.setFileName(Recognize::GetConfigFile());
+    ini.get("generic", "type", type);
+    params.load(ini, type + "_asr");
+    for (auto& param : *recog_channel->params) {
+        params.set(param.first, param.second);
+    }
+
+    std::vector<string> names;
+    mrcp_generic_header_t* req_generic_header = mrcp_generic_header_get(request);
+    if (req_generic_header && mrcp_generic_header_property_check(request, GENERIC_HEADER_VENDOR_SPECIFIC_PARAMS) == TRUE && req_generic_header->vendor_specific_params) {
+        int count = apt_pair_array_size_get(req_generic_header->vendor_specific_params);
+        for (int i = 0; i < count; i++) {
+            const apt_pair_t* pair = apt_pair_array_get(req_generic_header->vendor_specific_params, i);
+            names.push_back(string(pair->name.buf, pair->name.length));
+        }
+    } else {
+        names = RecognizeParams::Names();
+    }
+    mrcp_generic_header_t* res_generic_header = mrcp_generic_header_prepare(response);
+    res_generic_header->vendor_specific_params = apt_pair_array_create(names.size(), response->pool);
+    for (auto& name : names) {
+        string value;
+        if (!params.get(name, value)) {
+            response->start_line.status_code = MRCP_STATUS_CODE_UNSUPPORTED_PARAM;
+            continue;
+        }
+        apt_str_t pair_name;
+        apt_str_t pair_value;
+        apt_string_assign_n(&pair_name, name.c_str(), name.size(), response->pool);
+        apt_string_assign_n(&pair_value, value.c_str(), value.size(), response->pool);
+        apt_pair_array_append(res_generic_header->vendor_specific_params, &pair_name, &pair_value, response->pool);
+    }
+    mrcp_generic_header_property_add(response, GENERIC_HEADER_VENDOR_SPECIFIC_PARAMS);
+    INFOLN("get params, names:%zu channelId:%s", names.size(), channelId.c_str());
+    return mrcp_engine_channel_message_send(channel, response);
+}
+
 /** Process STOP request */
 static apt_bool_t demo_recog_channel_stop(mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_message_t* response)
 {
     string channelId(channel->id.buf, channel->id.length);
     INFOLN("begin recognize stop, channelId:%s", channelId.c_str());
-    Recognize::Del(channelId);
+    demo_recog_session_end(channelId);
     /* process STOP request */
     demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)channel->method_obj;
+    demo_recog_timers_stop(recog_channel);
     /* store STOP request, make sure there is no more activity and only then send the response */
     recog_channel->stop_response = response;
     recog_channel->recog_request = NULL;
@@ -367,6 +863,9 @@ static apt_bool_t demo_recog_channel_timers_start(mrcp_engine_channel_t* channel
     string channelId(channel->id.buf, channel->id.length);
     demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)channel->method_obj;
     recog_channel->timers_started = TRUE;
+    if (!recog_channel->input_started) {
+        demo_recog_timer_start(recog_channel, DEMO_RECOG_TIMEOUT_NO_INPUT);
+    }
     INFOLN("demo_recog_channel_timers_start, channelId:%s", channelId.c_str());
     return mrcp_engine_channel_message_send(channel, response);
 }
@@ -378,8 +877,10 @@ static apt_bool_t demo_recog_channel_request_dispatch(mrcp_engine_channel_t* cha
     mrcp_message_t* response = mrcp_response_create(request, request->pool);
     switch (request->start_line.method_id) {
     case RECOGNIZER_SET_PARAMS:
+        processed = demo_recog_channel_set_params(channel, request, response);
         break;
     case RECOGNIZER_GET_PARAMS:
+        processed = demo_recog_channel_get_params(channel, request, response);
         break;
     case RECOGNIZER_DEFINE_GRAMMAR:
         break;
@@ -415,6 +916,18 @@ static apt_bool_t demo_recog_stream_destroy(mpf_audio_stream_t* stream)
 static apt_bool_t demo_recog_stream_open(mpf_audio_stream_t* stream, mpf_codec_t* codec)
 {
     INFOLN("demo_recog_stream_open");
+    demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)stream->obj;
+    demo_recog_engine_t* demo_engine = recog_channel->demo_engine;
+    delete recog_channel->preroll;
+    recog_channel->preroll = NULL;
+    if (demo_engine->preroll == 0) {
+        return TRUE;
+    }
+    const mpf_codec_descriptor_t* descriptor = mrcp_engine_sink_stream_codec_get(recog_channel->channel);
+    /* LPCM, 2 bytes a sample */
+    apr_size_t bytes_per_ms = (descriptor ? descriptor->sampling_rate : 8000) / 1000 * 2;
+    recog_channel->preroll_size = demo_engine->preroll * bytes_per_ms;
+    recog_channel->preroll = new PreRoll((demo_engine->preroll + demo_engine->preroll_max) * bytes_per_ms);
     return TRUE;
 }
 
@@ -425,6 +938,45 @@ static apt_bool_t demo_recog_stream_close(mpf_audio_stream_t* stream)
     return TRUE;
 }
 
+/* Hand a frame to the session through the pre-roll ring. A new session or turn is sent the audio
+   before it and what came while it was not ready, the backlog goes out RECOG_PREROLL_BURST frames a frame */
+static void demo_recog_audio_write(demo_recog_channel_t* recog_channel, const std::shared_ptr<Recognize>& recognize, const string& voiceId, const mpf_frame_t* frame)
+{
+    PreRoll* preroll = recog_channel->preroll;
+    if (!preroll) {
+        recognize->publish(frame->codec_frame.size, 0);
+        recognize->onAudio((char*)frame->codec_frame.buffer, frame->codec_frame.size);
+        return;
+    }
+    if (preroll->begin(voiceId, recognize->getTurn())) {
+        preroll->rewind(recog_channel->preroll_size);
+    }
+    if (!recognize->isReady()) {
+        /* held in the ring while the session waits for admission or the vendor handshake */
+        recognize->publish(frame->codec_frame.size, preroll->backlog());
+        recognize->onHold();
+        return;
+    }
+    if (recognize->isContinuous() && !recognize->isArmed()) {
+        /* nothing is owed between turns, the next turn takes its pre-roll when it is armed */
+        preroll->skip();
+        recognize->publish(frame->codec_frame.size, 0);
+        recognize->onAudio((char*)frame->codec_frame.buffer, frame->codec_frame.size);
+        return;
+    }
+    size_t lost = preroll->takeLost();
+    if (lost > 0) {
+        sPreRollLost += lost;
+        WARNLN("preroll overflow, lost:%d channelId:%s voiceId:%s", (int)lost, recognize->getChannelId().c_str(), voiceId.c_str());
+    }
+    size_t len = 0;
+    const char* data = preroll->read(frame->codec_frame.size * RECOG_PREROLL_BURST, len);
+    recognize->publish(frame->codec_frame.size, preroll->backlog());
+    if (data) {
+        recognize->onAudio((char*)data, (int)len);
+    }
+}
+
 /* Raise demo START-OF-INPUT event */
 static apt_bool_t demo_recog_start_of_input(demo_recog_channel_t* recog_channel)
 {
@@ -493,9 +1045,11 @@ static apt_bool_t demo_recog_recognition_complete(demo_recog_channel_t* recog_ch
     /* set request state */
     message->start_line.request_state = MRCP_REQUEST_STATE_INPROGRESS;
     demo_recog_result_load(recog_channel, message, body);
-    if (cause == RECOGNIZER_COMPLETION_CAUSE_SUCCESS) {
+    if (cause == RECOGNIZER_COMPLETION_CAUSE_SUCCESS || cause == RECOGNIZER_COMPLETION_CAUSE_NO_MATCH
+        || cause == RECOGNIZER_COMPLETION_CAUSE_NO_INPUT_TIMEOUT || cause == RECOGNIZER_COMPLETION_CAUSE_RECOGNITION_TIMEOUT) {
         message->start_line.request_state = MRCP_REQUEST_STATE_COMPLETE;
         recog_channel->recog_request = NULL;
+        demo_recog_timers_stop(recog_channel);
     }
     /* send asynch event */
     return mrcp_engine_channel_message_send(recog_channel->channel, message);
@@ -534,25 +1088,37 @@ static apt_bool_t demo_recog_stream_write(mpf_audio_stream_t* stream, const mpf_
     //     break;
     // }
 
-    // if ((frame->type & MEDIA_FRAME_TYPE_EVENT) == MEDIA_FRAME_TYPE_EVENT) {
-    //     if (frame->marker == MPF_MARKER_START_OF_EVENT) {
-    //         INFOLN("Detected Start of Event " APT_SIDRES_FMT " id:%d", MRCP_MESSAGE_SIDRES(recog_channel->recog_request), frame->event_frame.event_id);
-    //     } else if (frame->marker == MPF_MARKER_END_OF_EVENT) {
-    //         INFOLN("Detected End of Event " APT_SIDRES_FMT " id:%d duration:%d ts", MRCP_MESSAGE_SIDRES(recog_channel->recog_request), frame->event_frame.event_id, frame->event_frame.duration);
-    //     }
-    // }
-    if ((frame->type & MEDIA_FRAME_TYPE_AUDIO) != MEDIA_FRAME_TYPE_AUDIO) {
+    if ((frame->type & (MEDIA_FRAME_TYPE_AUDIO | MEDIA_FRAME_TYPE_EVENT)) == 0) {
         return TRUE;
     }
-    string voiceId = Recognize::GetVoiceId(channelId);
-    if (voiceId.empty()) {
-        return TRUE;
+    PreRoll* preroll = recog_channel->preroll;
+    /* captured whether or not a session is running, the next one starts with it */
+    if (preroll && (frame->type & MEDIA_FRAME_TYPE_AUDIO) == MEDIA_FRAME_TYPE_AUDIO) {
+        preroll->push((const char*)frame->codec_frame.buffer, frame->codec_frame.size);
     }
-    auto recognize = Recognize::GetRecognize(voiceId);
+    string voiceId = Recognize::GetVoiceId(channelId);
+    auto recognize = voiceId.empty() ? nullptr : Recognize::GetRecognize(voiceId);
     if (!recognize) {
+        if (preroll) {
+            preroll->skip();
+        }
         return TRUE;
     }
-    recognize->write((char*)frame->codec_frame.buffer, frame->codec_frame.size);
+    /* a key is taken once, at the start of its event */
+    if ((frame->type & MEDIA_FRAME_TYPE_EVENT) == MEDIA_FRAME_TYPE_EVENT && frame->marker == MPF_MARKER_START_OF_EVENT) {
+        INFOLN("Detected Start of Event, id:%d channelId:%s", frame->event_frame.event_id, channelId.c_str());
+        recognize->onDtmf(frame->event_frame.event_id);
+    }
+    if ((frame->type & MEDIA_FRAME_TYPE_AUDIO) == MEDIA_FRAME_TYPE_AUDIO) {
+        /* only the transitions reach the engine task, which runs the speech complete timer */
+        mpf_detector_event_e det_event = mpf_activity_detector_process(recog_channel->detector, frame);
+        if (det_event == MPF_DETECTOR_EVENT_ACTIVITY) {
+            demo_recog_msg_signal(DEMO_RECOG_MSG_SPEECH_START, recog_channel->channel, NULL, RECOGNIZER_COMPLETION_CAUSE_SUCCESS, NULL);
+        } else if (det_event == MPF_DETECTOR_EVENT_INACTIVITY) {
+            demo_recog_msg_signal(DEMO_RECOG_MSG_SPEECH_END, recog_channel->channel, NULL, RECOGNIZER_COMPLETION_CAUSE_SUCCESS, NULL);
+        }
+        demo_recog_audio_write(recog_channel, recognize, voiceId, frame);
+    }
     return TRUE;
 }
 
@@ -578,30 +1144,26 @@ apt_bool_t demo_recog_msg_signal(demo_recog_msg_type_e type, mrcp_engine_channel
     return status;
 }
 
-static void sendComplete(demo_recog_msg_t* demo_msg)
+static void sendComplete(demo_recog_msg_t* demo_msg, bool isDtmf)
 {
     demo_recog_channel_t* recog_channel = (demo_recog_channel_t*)demo_msg->channel->method_obj;
     mrcp_recog_completion_cause_e cause = demo_msg->cause;
     string channelId(recog_channel->channel->id.buf, recog_channel->channel->id.length);
-    if (cause == RECOGNIZER_COMPLETION_CAUSE_SUCCESS) {
-        Recognize::Del(channelId);
+    /* keypad input ends the turn whatever matched, its vendor upload was stopped already */
+    if (cause == RECOGNIZER_COMPLETION_CAUSE_SUCCESS || isDtmf) {
+        auto recognize = Recognize::GetRecognize(Recognize::GetVoiceId(channelId));
+        if (!recognize || !recognize->isReusable()) {
+            Recognize::Del(channelId);
+        }
     }
     string body;
     if (demo_msg->data) {
         char* body_str = (char*)demo_msg->data;
         demo_msg->data = nullptr;
         body = body_str;
-        delete body_str;
-    }
-    std::ostringstream oss;
-    oss << R"(<?xml version="1.0" encoding="UTF-8" ?>
-<result> 
-  <interpretation grammar="session:default" confidence="0.97">
-    <instance><nlresult>)" << body << R"(</nlresult></instance>
-    <input mode="speech"></input>
-  </interpretation>
-</result>)";
-    body = oss.str();
+        Recognize::FreeCompleteBody(body_str);
+    }
+    body = Recognize::FormatResult(body, isDtmf);
     const apt_str_t* str = mrcp_recog_completion_cause_get(cause, MRCP_VERSION_2);
     string cause_str(str->buf, str->length);
     INFOLN("sendComplete cause:%s body:%s channelId:%s", cause_str.c_str(), body.c_str(), channelId.c_str());
@@ -615,29 +1177,124 @@ static apt_bool_t demo_recog_msg_process(apt_task_t* task, apt_task_msg_t* msg)
     string channelId(recog_channel->channel->id.buf, recog_channel->channel->id.length);
     switch (demo_msg->type) {
     case DEMO_RECOG_MSG_OPEN_CHANNEL:
+        (*recog_channel->demo_engine->channels)[channelId] = recog_channel;
         /* open channel and send asynch response */
         mrcp_engine_channel_open_respond(demo_msg->channel, TRUE);
         break;
     case DEMO_RECOG_MSG_CLOSE_CHANNEL: {
+        /* no request of the channel is left in the queue, so nothing maps a session to it again */
+        Recognize::Del(channelId);
+        recog_channel->demo_engine->channels->erase(channelId);
         /* close channel, make sure there is no activity and send asynch response */
+        demo_recog_timers_stop(recog_channel);
         mrcp_engine_channel_close_respond(demo_msg->channel);
         break;
     }
     case DEMO_RECOG_MSG_START_OF_INPUT: {
+        /* the request may have completed meanwhile, and the event is sent once a request */
+        if (!recog_channel->recog_request || recog_channel->input_started) {
+            break;
+        }
+        recog_channel->input_started = TRUE;
+        demo_recog_timer_stop(recog_channel, DEMO_RECOG_TIMEOUT_NO_INPUT);
+        demo_recog_timer_start(recog_channel, DEMO_RECOG_TIMEOUT_RECOGNITION);
         apt_bool_t ret = demo_recog_start_of_input(recog_channel);
         INFOLN("send start of input, ret:%d channelId:%s", ret, channelId.c_str());
         break;
     }
+    case DEMO_RECOG_MSG_SPEECH_START:
+        demo_recog_timer_stop(recog_channel, DEMO_RECOG_TIMEOUT_SPEECH_COMPLETE);
+        break;
+    case DEMO_RECOG_MSG_SPEECH_END:
+        demo_recog_timer_start(recog_channel, DEMO_RECOG_TIMEOUT_SPEECH_COMPLETE);
+        break;
     case DEMO_RECOG_MSG_COMPLETE: {
-        sendComplete(demo_msg);
+        sendComplete(demo_msg, false);
         INFOLN("send sendComplete, channelId:%s", channelId.c_str());
         break;
     }
+    case DEMO_RECOG_MSG_DTMF_COMPLETE: {
+        sendComplete(demo_msg, true);
+        INFOLN("send dtmf sendComplete, channelId:%s", channelId.c_str());
+        break;
+    }
     case DEMO_RECOG_MSG_REQUEST_PROCESS:
         demo_recog_channel_request_dispatch(demo_msg->channel, demo_msg->request);
         break;
+    case DEMO_RECOG_MSG_ADMITTED: {
+        string* voiceId = (string*)demo_msg->data;
+        demo_msg->data = nullptr;
+        demo_recog_channel_admitted(recog_channel, demo_msg->cause, *voiceId);
+        delete voiceId;
+        break;
+    }
     default:
         break;
     }
     return TRUE;
 }
+
+/** Housekeeping, called in the context of the engine task */
+static void demo_recog_engine_timer_proc(apt_timer_t* timer, void* obj)
+{
+    demo_recog_engine_t* demo_engine = (demo_recog_engine_t*)obj;
+    demo_recog_reap(demo_engine);
+    sTimers = demo_engine->wheel->size();
+    Metrics::Flush(*demo_engine->metrics_file);
+    apt_timer_set(timer, demo_engine->timer_interval);
+}
+
+/** Tear down sessions past their age or idle limit, and orphans no channel request refers to */
+static void demo_recog_reap(demo_recog_engine_t* demo_engine)
+{
+    auto all = Recognize::GetAll();
+    sSessions = all.size();
+    for (auto& recognize : all) {
+        string channelId = recognize->getChannelId();
+        string voiceId = recognize->getVoiceId();
+        /* a channel is only touched while it is open and maps to the session */
+        demo_recog_channel_t* recog_channel = NULL;
+        auto it = demo_engine->channels->find(channelId);
+        if (it != demo_engine->channels->end() && Recognize::GetVoiceId(channelId) == voiceId) {
+            recog_channel = it->second;
+        }
+        apt_bool_t active = recog_channel && recog_channel->recog_request ? TRUE : FALSE;
+        /* a continuous stream waits between turns with no request, its keepalive does not keep it from the idle limit */
+        apt_bool_t idleTurn = recog_channel && !active && recognize->isReusable() ? TRUE : FALSE;
+        int64_t age = recognize->getAge();
+        int64_t idle = recognize->getIdleTime();
+        const char* reason = NULL;
+        if (!active && !idleTurn) {
+            reason = "orphan";
+            sReapedOrphan++;
+        } else if (demo_engine->session_max_age > 0 && age > demo_engine->session_max_age) {
+            reason = "age";
+            sReapedAge++;
+        } else if (demo_engine->session_max_idle > 0 && idle > demo_engine->session_max_idle) {
+            reason = "idle";
+            sReapedIdle++;
+        } else {
+            continue;
+        }
+        WARNLN("reap recognize, reason:%s age:%lld idle:%lld channelId:%s voiceId:%s", reason, (long long)age, (long long)idle, channelId.c_str(), voiceId.c_str());
+        Recognize::Reap(recognize);
+        if (active) {
+            demo_recog_recognition_complete(recog_channel, RECOGNIZER_COMPLETION_CAUSE_ERROR, "");
+        }
+    }
+}
+
+/** Fires the due request timeouts of all channels, called in the context of the engine task */
+static void demo_recog_wheel_timer_proc(apt_timer_t* timer, void* obj)
+{
+    demo_recog_engine_t* demo_engine = (demo_recog_engine_t*)obj;
+    demo_engine->wheel->advance(TimerWheel::NowMs());
+    apt_timer_set(timer, RECOG_WHEEL_TICK);
+}
+
+/** Rejects sessions queued for admission past their deadline, called in the context of the engine task */
+static void demo_recog_admission_timer_proc(apt_timer_t* timer, void* obj)
+{
+    Admission::Expire();
+    apt_timer_set(timer, RECOG_ADMISSION_TIMER_INTERVAL);
+}
@@ -6,6 +6,11 @@
 #include "log/Log.h"
 #include "mpf_activity_detector.h"
 #include "mrcp_recog_engine.h"
+#include "PreRoll.h"
+#include "session/SessionTable.h"
+#include "timer/TimerWheel.h"
+#include "worker/BackgroundWorker.h"
+#include <map>
 
 typedef struct demo_recog_engine_t demo_recog_engine_t;
 typedef struct demo_recog_channel_t demo_recog_channel_t;
@@ -13,6 +18,41 @@ typedef struct demo_recog_channel_t demo_recog_channel_t;
 /** Declaration of demo recognizer engine */
 struct demo_recog_engine_t {
     apt_consumer_task_t* task;
+    /** Periodic housekeeping timer, runs in the context of the engine task */
+    apt_timer_t* timer;
+    /** Housekeeping interval (msec) */
+    apr_uint32_t timer_interval;
+    /** Metrics written by the housekeeping timer, empty disables them */
+    string* metrics_file;
+    /** Expires sessions waiting for admission too long */
+    apt_timer_t* admission_timer;
+    /** Sessions of this engine published for mrcpmod-top, /<session_table>-recog */
+    SessionTable* session_table;
+    /** Runs the vendor Stop of released sessions */
+    BackgroundWorker* stop_worker;
+    /** Sessions older than this are reaped by the housekeeping timer (msec), 0 is unlimited */
+    apr_uint32_t session_max_age;
+    /** Sessions without audio or vendor events for this long are reaped (msec), 0 is unlimited */
+    apr_uint32_t session_max_idle;
+    /** One vendor stream per channel, reused by every RECOGNIZE until it fails or the params change */
+    apt_bool_t continuous;
+    /** Silent frame sent between continuous turns this often (msec), 0 sends none */
+    apr_uint32_t keepalive_interval;
+    /** Request timeouts of all channels, accessed in the engine task only */
+    TimerWheel* wheel;
+    /** Open channels by channelId, accessed in the engine task only. The reaper finds a session's
+        channel here, a channel a session points to may be gone */
+    std::map<string, demo_recog_channel_t*>* channels;
+    /** Advances the wheel a tick at a time */
+    apt_timer_t* wheel_timer;
+    /** Timeouts of requests which do not set them (msec), 0 disables one */
+    apr_size_t no_input_timeout;
+    apr_size_t recognition_timeout;
+    apr_size_t speech_complete_timeout;
+    /** Audio before a RECOGNIZE sent along with it (msec), 0 disables the pre-roll ring */
+    apr_size_t preroll;
+    /** Audio held for a session which is not ready yet on top of the pre-roll (msec) */
+    apr_size_t preroll_max;
 };
 
 /** Declaration of demo recognizer channel */
@@ -28,8 +68,24 @@ struct demo_recog_channel_t {
     mrcp_message_t* stop_response;
     /** Indicates whether input timers are started */
     apt_bool_t timers_started;
-    /** Voice activity detector */
+    /** Voice activity detector, reports the start and end of speech to the engine task */
     mpf_activity_detector_t* detector;
+    /** Timeouts of the active request (msec), 0 disables one */
+    apr_size_t no_input_timeout;
+    apr_size_t recognition_timeout;
+    apr_size_t speech_complete_timeout;
+    /** Timers of the active request on the engine's wheel, 0 when not running */
+    TimerWheel::Id no_input_timer;
+    TimerWheel::Id recognition_timer;
+    TimerWheel::Id speech_complete_timer;
+    /** START-OF-INPUT was sent for the active request */
+    apt_bool_t input_started;
+    /** Latest audio of the channel, written and read by the media thread only */
+    PreRoll* preroll;
+    /** Pre-roll length (bytes) at the codec of the stream */
+    apr_size_t preroll_size;
+    /** Vendor parameters set by SET-PARAMS, kept for the following requests */
+    std::map<string, string>* params;
 };
 
 typedef enum {
@@ -37,7 +93,11 @@ typedef enum {
     DEMO_RECOG_MSG_CLOSE_CHANNEL,
     DEMO_RECOG_MSG_REQUEST_PROCESS,
     DEMO_RECOG_MSG_START_OF_INPUT,
-    DEMO_RECOG_MSG_COMPLETE
+    DEMO_RECOG_MSG_COMPLETE,
+    DEMO_RECOG_MSG_ADMITTED,
+    DEMO_RECOG_MSG_DTMF_COMPLETE,
+    DEMO_RECOG_MSG_SPEECH_START,
+    DEMO_RECOG_MSG_SPEECH_END
 } demo_recog_msg_type_e;
 
 apt_bool_t demo_recog_msg_signal(demo_recog_msg_type_e type, mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_recog_completion_cause_e cause, void* data);
\ No newline at end of file
@@ -2,11 +2,13 @@
 #include "RecogEngine.h"
 #include "TencentRecognize.h"
 #include "mrcp_recog_header.h"
+#include <algorithm>
+#include <chrono>
 #include <mutex>
 
 string Recognize::sConfigFile = "conf/config.ini";
 
-std::shared_ptr<Recognize> Recognize::Create(string channelId)
+std::shared_ptr<Recognize> Recognize::Create(string channelId, SessionTable* table, BackgroundWorker* stopWorker)
 {
     string type;
     auto ini = std::make_shared<IniParser>();
@@ -18,20 +20,33 @@ std::shared_ptr<Recognize> Recognize::Create(string channelId)
         recognize->mChannelId = channelId;
         recognize->mRecognizeType = TENCENT;
         recognize->mIniParser = ini;
+        recognize->mBackend = type + "_asr";
         // gen unique voice_id
         boost::uuids::uuid a_uuid = boost::uuids::random_generator()();
         recognize->mVoiceId = boost::uuids::to_string(a_uuid);
+        recognize->mSlot = table->acquire(channelId, recognize->mVoiceId, recognize->mBackend);
+        recognize->mStopWorker = stopWorker;
         return recognize;
     }
     INFOLN("recognize type is not support, type:%s channelId:%s", type.c_str(), channelId.c_str());
     return nullptr;
 }
 
+Recognize::~Recognize()
+{
+    SessionTable::Release(mSlot);
+}
+
 void Recognize::setPartial(bool val)
 {
     mIsPartial = val;
 }
 
+void Recognize::setParams(const map<string, string>& val)
+{
+    mParamOverrides = val;
+}
+
 void Recognize::setRecogChannel(demo_recog_channel_t* val)
 {
     mRecogChannel = val;
@@ -42,13 +57,278 @@ string Recognize::getVoiceId()
     return mVoiceId;
 }
 
+string Recognize::getChannelId()
+{
+    return mChannelId;
+}
+
+int64_t Recognize::getAge()
+{
+    return NowMs() - mCreated;
+}
+
+int64_t Recognize::getIdleTime()
+{
+    return NowMs() - std::max(mCreated, mLastActivity.load(std::memory_order_relaxed));
+}
+
+void Recognize::touch()
+{
+    mLastActivity.store(NowMs(), std::memory_order_relaxed);
+}
+
+void Recognize::setContinuous(bool val, int keepAliveInterval)
+{
+    mIsContinuous = val;
+    mKeepAliveInterval = keepAliveInterval;
+}
+
+bool Recognize::isContinuous()
+{
+    return mIsContinuous;
+}
+
+bool Recognize::isReusable()
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    return mIsContinuous && !mIsStop && !mIsFlushed && mTicket && !mIsFailed;
+}
+
+void Recognize::cancel()
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    mIsCancel = true;
+    mIsReady = false;
+    mSlot->setState(SessionTable::STOPPED);
+}
+
+void Recognize::arm()
+{
+    mTurn++;
+    mIsArmed = true;
+    mSlot->setState(SessionTable::RUNNING);
+}
+
+void Recognize::disarm()
+{
+    mIsArmed = false;
+    if (mIsContinuous) {
+        mSlot->setState(SessionTable::IDLE);
+    }
+}
+
+bool Recognize::isArmed()
+{
+    return mIsArmed;
+}
+
+uint32_t Recognize::getTurn()
+{
+    return mTurn;
+}
+
+bool Recognize::isReady()
+{
+    return mIsReady;
+}
+
+const map<string, string>& Recognize::getParams()
+{
+    return mParamOverrides;
+}
+
+void Recognize::onAudio(char* buff, int len)
+{
+    // a continuous stream waiting for its next request is idle whatever audio the channel sends,
+    // so session_max_idle reaps one left without a RECOGNIZE, not only session_max_age
+    bool isListening = !mIsContinuous || mIsArmed;
+    if (isListening) {
+        touch();
+    }
+    if (!checkDtmf() && isListening) {
+        write(buff, len);
+        return;
+    }
+    // between turns the caller is not listened to, sparse silence keeps the vendor stream open
+    int64_t now = NowMs();
+    if (mKeepAliveInterval <= 0 || now - mLastKeepAlive < mKeepAliveInterval) {
+        return;
+    }
+    mLastKeepAlive = now;
+    mSilence.assign(len, 0);
+    write(mSilence.data(), len);
+}
+
+void Recognize::publish(int in, size_t depth)
+{
+    mSlot->addIn(in);
+    mSlot->setDepth(depth);
+}
+
+void Recognize::onHold()
+{
+    touch();
+    checkDtmf();
+}
+
+bool Recognize::checkDtmf()
+{
+    if (!mIsDtmfInput) {
+        return false;
+    }
+    std::lock_guard<std::mutex> l(mDtmfMutex);
+    DtmfCollector::State state = mDtmf.check(NowMs());
+    if (state != DtmfCollector::COLLECTING) {
+        sendDtmfComplete(state);
+    }
+    return true;
+}
+
+void Recognize::setDtmf(const DtmfCollector* dtmf)
+{
+    std::lock_guard<std::mutex> l(mDtmfMutex);
+    mHasDtmf = dtmf != nullptr;
+    if (dtmf) {
+        mDtmf = *dtmf;
+        mDtmf.reset();
+    }
+    mIsDtmfInput = false;
+}
+
+void Recognize::onDtmf(int eventId)
+{
+    if (mIsContinuous && !mIsArmed) {
+        return;
+    }
+    touch();
+    std::lock_guard<std::mutex> l(mDtmfMutex);
+    if (!mHasDtmf || !DtmfCollector::ToChar(eventId)) {
+        return;
+    }
+    if (!mIsDtmfInput.exchange(true)) {
+        INFOLN("send dtmf start of input, stop sending audio, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+        demo_recog_msg_signal(DEMO_RECOG_MSG_START_OF_INPUT, mRecogChannel->channel, nullptr, RECOGNIZER_COMPLETION_CAUSE_SUCCESS, nullptr);
+    }
+    DtmfCollector::State state = mDtmf.add(eventId, NowMs());
+    if (state != DtmfCollector::COLLECTING) {
+        sendDtmfComplete(state);
+    }
+}
+
+void Recognize::sendDtmfComplete(DtmfCollector::State state)
+{
+    // the vendor may have completed the turn first, keypad input always completes it
+    if (!takeTurn(true)) {
+        return;
+    }
+    char* body = MakeCompleteBody(mVoiceId, mDtmf.getDigits());
+    INFOLN("send dtmf complete, match:%d body:%s channelId:%s voiceId:%s", state == DtmfCollector::MATCH, body, mChannelId.c_str(), mVoiceId.c_str());
+    mrcp_recog_completion_cause_e cause = RECOGNIZER_COMPLETION_CAUSE_SUCCESS;
+    if (state != DtmfCollector::MATCH) {
+        cause = RECOGNIZER_COMPLETION_CAUSE_NO_MATCH;
+    }
+    demo_recog_msg_signal(DEMO_RECOG_MSG_DTMF_COMPLETE, mRecogChannel->channel, nullptr, cause, body);
+}
+
+bool Recognize::takeTurn(bool isCompleting)
+{
+    if (isCompleting) {
+        return mIsArmed.exchange(false);
+    }
+    return mIsArmed;
+}
+
+int64_t Recognize::NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Admission::Result Recognize::admit()
+{
+    std::weak_ptr<Recognize> weak = shared_from_this();
+    Admission::Ticket ticket;
+    uint64_t waitId = 0;
+    auto result = Admission::Acquire(mBackend, Admission::LIVE, ticket, [weak](Admission::Ticket ticket) {
+        auto self = weak.lock();
+        if (self) {
+            self->onAdmitted(ticket);
+        }
+    }, &waitId);
+    std::lock_guard<std::mutex> l(mMutex);
+    if (result == Admission::ADMITTED) {
+        mTicket = ticket;
+        mSlot->setState(SessionTable::STARTING);
+    } else if (result == Admission::QUEUED) {
+        mSlot->setState(SessionTable::QUEUED);
+    }
+    mWaitId = waitId;
+    return result;
+}
+
+// called from the thread which freed the slot, the engine task starts the session
+void Recognize::onAdmitted(Admission::Ticket ticket)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    // a released session's channel may be closed already
+    if (mIsStop || mIsCancel) {
+        return;
+    }
+    mTicket = ticket;
+    if (ticket) {
+        mSlot->setState(SessionTable::STARTING);
+    }
+    INFOLN("recognize admission done, admitted:%d channelId:%s voiceId:%s", (bool)ticket, mChannelId.c_str(), mVoiceId.c_str());
+    // posted under mMutex, so it is ahead of the close message of a channel stopping this session
+    demo_recog_msg_signal(DEMO_RECOG_MSG_ADMITTED, mRecogChannel->channel, nullptr, ticket ? RECOGNIZER_COMPLETION_CAUSE_SUCCESS : RECOGNIZER_COMPLETION_CAUSE_ERROR, new string(mVoiceId));
+}
+
+void Recognize::onVendorError(int code)
+{
+    mIsFailed = true;
+    mSlot->markVendorEvent();
+    Admission::Ticket ticket;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        ticket = mTicket;
+    }
+    auto action = Admission::OnError(ticket, code);
+    if (action == Admission::SUSPENDED) {
+        WARNLN("recognize suspend account, account:%s code:%d channelId:%s voiceId:%s", ticket->credential().name.c_str(), code, mChannelId.c_str(), mVoiceId.c_str());
+    } else if (action == Admission::KEPT) {
+        WARNLN("recognize quota error on the last account, keep it, account:%s code:%d channelId:%s voiceId:%s", ticket->credential().name.c_str(), code, mChannelId.c_str(), mVoiceId.c_str());
+    }
+}
+
+Admission::Ticket Recognize::leaveAdmission()
+{
+    Admission::Cancel(mBackend, mWaitId);
+    Admission::Ticket ticket;
+    ticket.swap(mTicket);
+    return ticket;
+}
+
 void Recognize::loadConfig()
 {
     string type;
     mIniParser->get("generic", "type", type);
-    mIniParser->get(type, "appid", mAppId);
-    mIniParser->get(type, "secretid", mSecretId);
-    mIniParser->get(type, "secretkey", mSecretKey);
+    string account;
+    {
+        // credential of the account the session was admitted to
+        std::lock_guard<std::mutex> l(mMutex);
+        if (mTicket) {
+            account = mTicket->credential().name;
+            mAppId = mTicket->credential().appId;
+            mSecretId = mTicket->credential().secretId;
+            mSecretKey = mTicket->credential().secretKey;
+        }
+    }
+    // read on every session, so config changes apply to the next RECOGNIZE
+    mParams = RecognizeParams();
+    mParams.load(*mIniParser, type + "_asr");
+    for (auto& param : mParamOverrides) {
+        mParams.set(param.first, param.second);
+    }
+    INFOLN("recognize params, %s account:%s channelId:%s voiceId:%s", mParams.toString().c_str(), account.c_str(), mChannelId.c_str(), mVoiceId.c_str());
 }
 
 std::mutex Recognize::sMutex;
@@ -95,11 +375,51 @@ void Recognize::Del(string channelId)
         Recognize::Del(channelId, voiceId);
         return;
     }
-    recognize->stop();
     Recognize::Del(channelId, voiceId);
+    Recognize::Release(recognize);
     INFOLN("delete recognize, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
 }
 
+std::vector<std::shared_ptr<Recognize>> Recognize::GetAll()
+{
+    std::vector<std::shared_ptr<Recognize>> all;
+    std::lock_guard<std::mutex> l(sMutex);
+    all.reserve(sMap.size());
+    for (auto& entry : sMap) {
+        all.push_back(entry.second);
+    }
+    return all;
+}
+
+void Recognize::Reap(std::shared_ptr<Recognize> recognize)
+{
+    {
+        std::lock_guard<std::mutex> l(sMutex);
+        sMap.erase(recognize->mVoiceId);
+        // the channel may be mapped to a later session already
+        auto it = sChannelIdMap.find(recognize->mChannelId);
+        if (it != sChannelIdMap.end() && it->second == recognize->mVoiceId) {
+            sChannelIdMap.erase(it);
+        }
+    }
+    Recognize::Release(recognize);
+}
+
+void Recognize::Release(std::shared_ptr<Recognize> recognize)
+{
+    recognize->cancel();
+    // vendor Stop may block for a network round trip, the engine task does not wait for it.
+    // The worker also holds the last reference so the destructor never runs inside a vendor callback
+    BackgroundWorker::Job job = [recognize] {
+        recognize->stop();
+    };
+    if (recognize->mStopWorker) {
+        recognize->mStopWorker->post(job);
+    } else {
+        job();
+    }
+}
+
 void Recognize::Set(string channelId, std::shared_ptr<Recognize> val)
 {
     std::lock_guard<std::mutex> l(sMutex);
@@ -111,24 +431,86 @@ void Recognize::Set(string channelId, std::shared_ptr<Recognize> val)
 
 void Recognize::sendStartOfInput()
 {
+    touch();
+    mSlot->markVendorEvent();
+    if (mIsCancel) {
+        return;
+    }
+    if ((mIsContinuous && !mIsArmed) || mIsDtmfInput) {
+        INFOLN("drop start of input between turns or after dtmf input, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+        return;
+    }
     INFOLN("send start of input, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
     demo_recog_msg_signal(DEMO_RECOG_MSG_START_OF_INPUT, mRecogChannel->channel, nullptr, RECOGNIZER_COMPLETION_CAUSE_SUCCESS, nullptr);
 }
 
+string Recognize::GetConfigFile()
+{
+    return sConfigFile;
+}
+
+char* Recognize::MakeCompleteBody(const string& voiceId, const string& text)
+{
+    size_t size = voiceId.size() + 1 + text.size();
+    char* body = new char[size + 1];
+    memcpy(body, voiceId.data(), voiceId.size());
+    body[voiceId.size()] = '|';
+    memcpy(body + voiceId.size() + 1, text.data(), text.size());
+    body[size] = '\0';
+    return body;
+}
+
+void Recognize::FreeCompleteBody(char* body)
+{
+    delete[] body;
+}
+
+string Recognize::FormatResult(const string& body, bool isDtmf)
+{
+    static const char sHead[] = R"(<?xml version="1.0" encoding="UTF-8" ?>
+<result> 
+  <interpretation grammar="session:default" confidence="0.97">
+    <instance><nlresult>)";
+    static const char sTail[] = R"(</nlresult></instance>
+    <input mode="speech"></input>
+  </interpretation>
+</result>)";
+    static const char sDtmfTail[] = R"(</nlresult></instance>
+    <input mode="dtmf"></input>
+  </interpretation>
+</result>)";
+    string result;
+    result.reserve(sizeof(sHead) + body.size() + sizeof(sDtmfTail));
+    result.append(sHead, sizeof(sHead) - 1);
+    result.append(body);
+    if (isDtmf) {
+        result.append(sDtmfTail, sizeof(sDtmfTail) - 1);
+    } else {
+        result.append(sTail, sizeof(sTail) - 1);
+    }
+    return result;
+}
+
 void Recognize::sendComplete(string text)
 {
-    text = mVoiceId + "|" + text;
-    char* body = nullptr;
-    if (!text.empty()) {
-        int size = text.size() + 1;
-        body = new char[size]();
-        memset(body, 0, size);
-        memcpy(body, text.c_str(), text.size());
+    touch();
+    mSlot->markVendorEvent();
+    // released, its channel may be closed already
+    if (mIsCancel) {
+        INFOLN("drop complete of a released session, text:%s channelId:%s voiceId:%s", text.c_str(), mChannelId.c_str(), mVoiceId.c_str());
+        return;
     }
-    INFOLN("send complete, partial:%d body:%s channelId:%s voiceId:%s", mIsPartial, body, mChannelId.c_str(), mVoiceId.c_str());
     mrcp_recog_completion_cause_e cause = RECOGNIZER_COMPLETION_CAUSE_SUCCESS;
     if (mIsPartial) {
         cause = RECOGNIZER_COMPLETION_CAUSE_PARTIAL_MATCH;
     }
+    // a continuous stream keeps producing sentences, only the first final one of a turn completes it,
+    // and keypad input owns the turn once a key was pressed
+    if (mIsDtmfInput || ((mIsContinuous || mHasDtmf) && !takeTurn(cause != RECOGNIZER_COMPLETION_CAUSE_PARTIAL_MATCH))) {
+        INFOLN("drop complete between turns or after dtmf input, text:%s channelId:%s voiceId:%s", text.c_str(), mChannelId.c_str(), mVoiceId.c_str());
+        return;
+    }
+    char* body = MakeCompleteBody(mVoiceId, text);
+    INFOLN("send complete, partial:%d body:%s channelId:%s voiceId:%s", mIsPartial, body, mChannelId.c_str(), mVoiceId.c_str());
     demo_recog_msg_signal(DEMO_RECOG_MSG_COMPLETE, mRecogChannel->channel, nullptr, cause, body);
 }
@@ -2,29 +2,78 @@
 
 #include "log/Log.h"
 #include "ini/IniParser.h"
+#include "admission/Admission.h"
+#include "session/SessionTable.h"
+#include "RecognizeParams.h"
+#include "DtmfCollector.h"
+#include "worker/BackgroundWorker.h"
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 struct demo_recog_channel_t;
 
 #define RECOGNIZE_TYPE_TENCENT "tencent"
 
-class Recognize {
+class Recognize : public std::enable_shared_from_this<Recognize> {
 public:
     enum RecognizeType {
         NONE,
         TENCENT
     };
-    static std::shared_ptr<Recognize> Create(string channelId);
+    /** the session publishes itself in table, its vendor session is torn down on stopWorker, owned by the engine */
+    static std::shared_ptr<Recognize> Create(string channelId, SessionTable* table, BackgroundWorker* stopWorker);
 
-    virtual ~Recognize() = default;
+    virtual ~Recognize();
     void setPartial(bool val);
+    /** SET-PARAMS and RECOGNIZE values, applied over the config defaults by init() */
+    void setParams(const map<string, string>& val);
     void setRecogChannel(demo_recog_channel_t* val);
     string getVoiceId();
+    string getChannelId();
+    /** ms since the session was created, and since audio or a vendor event last arrived */
+    int64_t getAge();
+    int64_t getIdleTime();
+    void touch();
+    /** keep the vendor stream open across RECOGNIZE turns, audio between turns is replaced by a
+        silent frame every keepAliveInterval ms so the vendor does not close the idle stream */
+    void setContinuous(bool val, int keepAliveInterval);
+    bool isContinuous();
+    /** continuous, started and not failed or stopped, so the next turn can take it over */
+    bool isReusable();
+    /** results are delivered only while a turn is armed, the first completing one disarms it */
+    void arm();
+    void disarm();
+    bool isArmed();
+    /** counts arm() calls, a new turn of a continuous session is sent its own pre-roll */
+    uint32_t getTurn();
+    /** the vendor stream is started and takes audio, until it is stopped or flushed */
+    bool isReady();
+    const map<string, string>& getParams();
+    /** one frame of channel audio, from the media thread */
+    void onAudio(char* buff, int len);
+    /** media thread: a frame of in bytes came for the session and depth bytes of it wait to be sent */
+    void publish(int in, size_t depth);
+    /** a frame held back while the session is not ready, it counts as activity and runs the interdigit timeout */
+    void onHold();
+    /** keypad input of the turn is matched against dtmf, nullptr takes speech only */
+    void setDtmf(const DtmfCollector* dtmf);
+    /** start of an RFC 4733 event, from the media thread, the vendor gets no audio once a key was pressed */
+    void onDtmf(int eventId);
 
+    /** take a slot of the vendor backend before init(), QUEUED ends with a DEMO_RECOG_MSG_ADMITTED message */
+    Admission::Result admit();
     virtual int init() = 0;
+    /** blocks for the vendor's Stop(), run on the background worker by Release() */
     virtual void stop() = 0;
+    /** the session takes no more audio and signals nothing to its channel, its vendor session is left to stop() */
+    void cancel();
     virtual int write(char* buff, int len) = 0;
+    /** stop sending audio and ask the vendor for the result of what it got, the session can not be reused */
+    virtual void flush() = 0;
+    /** error code of the vendor, a quota error takes the account out of rotation */
+    void onVendorError(int code);
     void sendStartOfInput();
     void sendComplete(string text);
 
@@ -33,9 +82,33 @@ public:
     static void Del(string channelId, string voiceId);
     static void Del(string channelId);
     static void Set(string channelId, std::shared_ptr<Recognize> val);
+    /** sessions in the map, for the reaper */
+    static std::vector<std::shared_ptr<Recognize>> GetAll();
+    /** remove the session, whichever channel it is mapped from, and release it */
+    static void Reap(std::shared_ptr<Recognize> recognize);
+    /** cancel at once, the vendor session is stopped and released on the background worker */
+    static void Release(std::shared_ptr<Recognize> recognize);
+    static string GetConfigFile();
+    /** body handed from the vendor thread to the engine task, freed there by FreeCompleteBody().
+        On the heap, a continuous session completes turns for as long as the call lasts */
+    static char* MakeCompleteBody(const string& voiceId, const string& text);
+    static void FreeCompleteBody(char* body);
+    /** NLSML result of a RECOGNITION-COMPLETE event */
+    static string FormatResult(const string& body, bool isDtmf = false);
 
 protected:
     void loadConfig();
+    static int64_t NowMs();
+    void onAdmitted(Admission::Ticket ticket);
+    /** false until a key was pressed, then ends the turn once the interdigit timeout passed */
+    bool checkDtmf();
+    /** under mDtmfMutex, ends the turn with the digits collected */
+    void sendDtmfComplete(DtmfCollector::State state);
+    /** a result may go out while the turn is armed, a completing one disarms it, a partial match
+        leaves it armed for the sentences to come */
+    bool takeTurn(bool isCompleting);
+    /** under mMutex, the ticket is handed to the caller to be given back once the lock is released */
+    Admission::Ticket leaveAdmission();
 
 protected:
     static string sConfigFile;
@@ -43,15 +116,46 @@ protected:
     demo_recog_channel_t* mRecogChannel = nullptr;
     string mChannelId;
     string mVoiceId;
+    /** row of the session in the engine's session table, for mrcpmod-top */
+    SessionTable::Slot* mSlot = SessionTable::Scratch();
+    /** engine worker, a session without one stops in the caller */
+    BackgroundWorker* mStopWorker = nullptr;
+
+    int64_t mCreated = NowMs();
+    std::atomic<int64_t> mLastActivity { 0 };
 
     std::mutex mMutex;
     bool mIsStop = false;
+    bool mIsFlushed = false;
+    /** vendor backend the session counts against, <type>_asr */
+    string mBackend;
+    Admission::Ticket mTicket;
+    uint64_t mWaitId = 0;
     RecognizeType mRecognizeType = NONE;
     std::shared_ptr<IniParser> mIniParser;
     std::string mAppId;
     std::string mSecretId;
     std::string mSecretKey;
     bool mIsPartial = false;
+    bool mIsContinuous = false;
+    int mKeepAliveInterval = 0;
+    std::atomic<bool> mIsArmed { true };
+    std::atomic<uint32_t> mTurn { 0 };
+    std::atomic<bool> mIsReady { false };
+    std::atomic<bool> mIsFailed { false };
+    /** released by the engine, nothing is signalled to its channel any more */
+    std::atomic<bool> mIsCancel { false };
+    /** digits grammar of the turn, guarded by mDtmfMutex */
+    std::mutex mDtmfMutex;
+    bool mHasDtmf = false;
+    DtmfCollector mDtmf;
+    /** a key was pressed, vendor audio and results are dropped from then on */
+    std::atomic<bool> mIsDtmfInput { false };
+    /** keepalive between turns, media thread only */
+    std::vector<char> mSilence;
+    int64_t mLastKeepAlive = 0;
+    map<string, string> mParamOverrides;
+    RecognizeParams mParams;
 
     static std::mutex sMutex;
     static map<string, string> sChannelIdMap;
@@ -0,0 +1,107 @@
+#include "RecognizeParams.h"
+#include "log/Log.h"
+#include <stdlib.h>
+#include <sstream>
+
+namespace {
+struct Field {
+    const char* name;
+    int RecognizeParams::*intValue;
+    string RecognizeParams::*stringValue;
+    int min;
+    int max;
+};
+
+const Field sFields[] = {
+    { "engine_model_type", nullptr, &RecognizeParams::engineModelType, 0, 0 },
+    { "need_vad", &RecognizeParams::needVad, nullptr, 0, 1 },
+    { "vad_silence_time", &RecognizeParams::vadSilenceTime, nullptr, 0, 10000 },
+    { "max_speak_time", &RecognizeParams::maxSpeakTime, nullptr, 0, 90000 },
+    { "hotword_id", nullptr, &RecognizeParams::hotwordId, 0, 0 },
+    { "customization_id", nullptr, &RecognizeParams::customizationId, 0, 0 },
+    { "filter_dirty", &RecognizeParams::filterDirty, nullptr, 0, 2 },
+    { "filter_modal", &RecognizeParams::filterModal, nullptr, 0, 2 },
+    { "filter_punc", &RecognizeParams::filterPunc, nullptr, 0, 1 },
+    { "convert_num_mode", &RecognizeParams::convertNumMode, nullptr, 0, 3 },
+    { "word_info", &RecognizeParams::wordInfo, nullptr, 0, 2 },
+};
+
+const Field* FindField(const string& name)
+{
+    for (auto& field : sFields) {
+        if (name == field.name) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+}
+
+RecognizeParams::SetResult RecognizeParams::set(const string& name, const string& value)
+{
+    const Field* field = FindField(name);
+    if (!field) {
+        return UNKNOWN_NAME;
+    }
+    if (field->stringValue) {
+        if (field->stringValue == &RecognizeParams::engineModelType && value.empty()) {
+            return ILLEGAL_VALUE;
+        }
+        this->*field->stringValue = value;
+        return OK;
+    }
+    char* end = nullptr;
+    long n = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || n < field->min || n > field->max) {
+        return ILLEGAL_VALUE;
+    }
+    this->*field->intValue = (int)n;
+    return OK;
+}
+
+bool RecognizeParams::get(const string& name, string& value) const
+{
+    const Field* field = FindField(name);
+    if (!field) {
+        return false;
+    }
+    value = field->stringValue ? this->*field->stringValue : std::to_string(this->*field->intValue);
+    return true;
+}
+
+void RecognizeParams::load(IniParser& ini, const string& section)
+{
+    auto sections = ini.get();
+    auto it = sections.find(section);
+    if (it == sections.end()) {
+        return;
+    }
+    for (auto& pair : it->second) {
+        if (set(pair.first, pair.second) != OK) {
+            WARNLN("invalid recognize param in config, section:%s name:%s value:%s", section.c_str(), pair.first.c_str(), pair.second.c_str());
+        }
+    }
+}
+
+string RecognizeParams::toString() const
+{
+    std::ostringstream oss;
+    string value;
+    for (auto& field : sFields) {
+        get(field.name, value);
+        oss << (&field == sFields ? "" : " ") << field.name << ":" << value;
+    }
+    return oss.str();
+}
+
+const std::vector<string>& RecognizeParams::Names()
+{
+    static const std::vector<string> names = []() {
+        std::vector<string> names;
+        for (auto& field : sFields) {
+            names.push_back(field.name);
+        }
+        return names;
+    }();
+    return names;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ini/IniParser.h"
+#include <string>
+#include <vector>
+
+using std::string;
+
+/**
+ * Vendor recognition knobs trading latency for accuracy, named as in Vendor-Specific-Parameters.
+ * Deployment defaults are read from the [<type>_asr] config section on every RECOGNIZE, a channel
+ * keeps the values SET-PARAMS gave it between requests and a RECOGNIZE may override them once.
+ */
+class RecognizeParams {
+public:
+    enum SetResult {
+        OK,
+        UNKNOWN_NAME,
+        ILLEGAL_VALUE
+    };
+
+    string engineModelType = "8k_zh";
+    int needVad = 1;
+    /** ms of silence that ends a sentence, 0 keeps the vendor default */
+    int vadSilenceTime = 0;
+    /** ms after which a sentence is cut, 0 keeps the vendor default */
+    int maxSpeakTime = 0;
+    string hotwordId;
+    string customizationId;
+    int filterDirty = 1;
+    int filterModal = 1;
+    int filterPunc = 1;
+    int convertNumMode = 1;
+    int wordInfo = 0;
+
+    SetResult set(const string& name, const string& value);
+    bool get(const string& name, string& value) const;
+    /** keys missing from the section keep their current value */
+    void load(IniParser& ini, const string& section);
+    string toString() const;
+
+    static const std::vector<string>& Names();
+};
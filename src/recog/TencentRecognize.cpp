@@ -14,6 +14,7 @@ static void OnFail(SpeechRecognitionResponse *rsp) {
         WARNLN("recognize is nullptr, voiceId:%s", rsp->voice_id.c_str());
         return;
     }
+    recognize->onVendorError(rsp->code);
     recognize->sendComplete("");
 }
 
@@ -69,15 +70,21 @@ int TencentRecognize::init()
     recognizer->SetOnRecognitionResultChanged(OnRecognitionResultChange);
     recognizer->SetOnSentenceBegin(OnSentenceBegin);
     recognizer->SetOnSentenceEnd(OnSentenceEnd);
-    recognizer->SetEngineModelType("8k_zh");
-    recognizer->SetNeedVad(1); // 0：关闭 vad，1： 开启 vad。语音时长超过一分钟需要开启,如果对实时性要求较高。
-    recognizer->SetHotwordId(""); // 热词 id。用于调用对应的热词表，如果在调用语音识别服务时，不进行单独的热词 id 设置，自动生效默认热词；如果进行了单独的热词 id 设置，那么将生效单独设置的热词 id。
-    recognizer->SetCustomizationId(""); // 自学习模型 id。如不设置该参数，自动生效最后一次上线的自学习模型；如果设置了该参数，那么将生效对应的自学习模型。
-    recognizer->SetFilterDirty(1); // 0 ：不过滤脏话 1：过滤脏话
-    recognizer->SetFilterModal(1); // 0 ：不过滤语气词 1：过滤部分语气词  2:严格过滤
-    recognizer->SetFilterPunc(1); // 0 ：不过滤句末的句号 1：过滤句末的句号
-    recognizer->SetConvertNumMode(1); // 1： 根据场景智能转换为阿拉伯数字；0：全部转为中文数字。
-    recognizer->SetWordInfo(0); // 是否显示词级别时间戳。0：不显示；1：显示，不包含标点时间戳，2：显示，包含标点时间戳。时间戳信息需要自行解析 AudioRecognizeResult.resultJson 获取
+    recognizer->SetEngineModelType(mParams.engineModelType);
+    recognizer->SetNeedVad(mParams.needVad); // 0：关闭 vad，1： 开启 vad。语音时长超过一分钟需要开启,如果对实时性要求较高。
+    if (mParams.vadSilenceTime > 0) {
+        recognizer->SetVadSilenceTime(mParams.vadSilenceTime); // 语音断句检测阈值，静音时长超过该阈值会被认为断句，需配合 need_vad=1 使用。
+    }
+    if (mParams.maxSpeakTime > 0) {
+        recognizer->SetMaxSpeakTime(mParams.maxSpeakTime); // 强制断句，一句话持续超过该时长(ms)即断句。
+    }
+    recognizer->SetHotwordId(mParams.hotwordId); // 热词 id。用于调用对应的热词表，如果在调用语音识别服务时，不进行单独的热词 id 设置，自动生效默认热词；如果进行了单独的热词 id 设置，那么将生效单独设置的热词 id。
+    recognizer->SetCustomizationId(mParams.customizationId); // 自学习模型 id。如不设置该参数，自动生效最后一次上线的自学习模型；如果设置了该参数，那么将生效对应的自学习模型。
+    recognizer->SetFilterDirty(mParams.filterDirty); // 0 ：不过滤脏话 1：过滤脏话
+    recognizer->SetFilterModal(mParams.filterModal); // 0 ：不过滤语气词 1：过滤部分语气词  2:严格过滤
+    recognizer->SetFilterPunc(mParams.filterPunc); // 0 ：不过滤句末的句号 1：过滤句末的句号
+    recognizer->SetConvertNumMode(mParams.convertNumMode); // 1： 根据场景智能转换为阿拉伯数字；0：全部转为中文数字。
+    recognizer->SetWordInfo(mParams.wordInfo); // 是否显示词级别时间戳。0：不显示；1：显示，不包含标点时间戳，2：显示，包含标点时间戳。时间戳信息需要自行解析 AudioRecognizeResult.resultJson 获取
     INFOLN("begin recognizer start, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
     int ret = recognizer->Start();
     if (ret < 0) {
@@ -86,18 +93,32 @@ int TencentRecognize::init()
         return -1;
     }
     INFOLN("end recognizer start, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+    std::lock_guard<std::mutex> l(mMutex);
     mSpeechRecognizer.reset(recognizer);
+    // stopped while starting, the session is registered before init() so the channel can stop it
+    if (mIsStop) {
+        mSpeechRecognizer->Stop();
+    }
+    mIsReady = !mIsStop;
+    if (mIsReady) {
+        mSlot->setState(SessionTable::RUNNING);
+        mSlot->markVendorEvent();
+    }
     return 0;
 }
 
 void TencentRecognize::stop()
 {
+    Admission::Ticket ticket;
     std::lock_guard<std::mutex> l(mMutex);
     if (mIsStop) {
         return;
     }
     mIsStop = true;
-    if (mSpeechRecognizer) {
+    mIsReady = false;
+    mSlot->setState(SessionTable::STOPPED);
+    ticket = leaveAdmission();
+    if (mSpeechRecognizer && !mIsFlushed) {
         INFOLN("stop tencent recognize, channelId:%s", mChannelId.c_str());
         mSpeechRecognizer->Stop();
     }
@@ -106,9 +127,29 @@ void TencentRecognize::stop()
 int TencentRecognize::write(char* buff, int len)
 {
     std::lock_guard<std::mutex> l(mMutex);
-    if (mIsStop) {
+    // nothing is sent while the session waits for admission
+    if (mIsStop || mIsFlushed || !mSpeechRecognizer) {
         return 0;
     }
     mSpeechRecognizer->Write(buff, len);
+    mSlot->addOut(len);
     return 0;
 }
+
+void TencentRecognize::flush()
+{
+    SpeechRecognizer* recognizer = nullptr;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        if (mIsStop || mIsFlushed || !mSpeechRecognizer) {
+            return;
+        }
+        mIsFlushed = true;
+        mIsReady = false;
+        recognizer = mSpeechRecognizer.get();
+    }
+    // the end of the audio makes the vendor send the last sentence, its callbacks may lock mMutex.
+    // the recognizer lives as long as the session, and stop() leaves a flushed one alone
+    INFOLN("flush tencent recognize, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+    recognizer->Stop();
+}
@@ -22,6 +22,7 @@ public:
     virtual int init();
     virtual void stop();
     virtual int write(char* buff, int len);
+    virtual void flush();
 
 private:
     std::unique_ptr<SpeechRecognizer> mSpeechRecognizer;
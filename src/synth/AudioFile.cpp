@@ -0,0 +1,154 @@
+#include "AudioFile.h"
+#include "log/Log.h"
+#include "dsp/Resampler.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::mutex AudioFile::sMutex;
+map<string, std::shared_ptr<const AudioFile>> AudioFile::sFiles;
+
+AudioFile::~AudioFile()
+{
+    if (mMap) {
+        munmap(mMap, mMapSize);
+    }
+}
+
+const int16_t* AudioFile::data() const
+{
+    return mData;
+}
+
+size_t AudioFile::samples() const
+{
+    return mSamples;
+}
+
+std::shared_ptr<const AudioFile> AudioFile::Open(const string& baseDir, const string& src, int sampleRate)
+{
+    string name = src;
+    if (name.compare(0, 7, "file://") == 0) {
+        name = name.substr(7);
+    }
+    // only files below the configured directory may be played
+    if (baseDir.empty() || name.empty() || name.find("..") != string::npos || name.find("://") != string::npos) {
+        WARNLN("audio src is not allowed, dir:%s src:%s", baseDir.c_str(), src.c_str());
+        return nullptr;
+    }
+    string path = name[0] == '/' ? name : baseDir + "/" + name;
+    if (path.compare(0, baseDir.size(), baseDir) != 0 || path[baseDir.size()] != '/') {
+        WARNLN("audio src is outside audio dir, dir:%s src:%s", baseDir.c_str(), src.c_str());
+        return nullptr;
+    }
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        WARNLN("audio file not found, path:%s", path.c_str());
+        return nullptr;
+    }
+    string key = path + "@" + std::to_string(sampleRate);
+    std::lock_guard<std::mutex> l(sMutex);
+    auto it = sFiles.find(key);
+    if (it != sFiles.end() && it->second->mModifyTime == st.st_mtime && it->second->mMapSize == (size_t)st.st_size) {
+        return it->second;
+    }
+    auto file = Map(path, sampleRate);
+    if (!file) {
+        sFiles.erase(key);
+        return nullptr;
+    }
+    file->mModifyTime = st.st_mtime;
+    sFiles[key] = file;
+    INFOLN("map audio file, path:%s samples:%zu rate:%d", path.c_str(), file->mSamples, file->mSampleRate);
+    return file;
+}
+
+std::shared_ptr<AudioFile> AudioFile::Map(const string& path, int sampleRate)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        WARNLN("open audio file failed, path:%s", path.c_str());
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 2) {
+        close(fd);
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        WARNLN("mmap audio file failed, path:%s", path.c_str());
+        return nullptr;
+    }
+    std::shared_ptr<AudioFile> file(new AudioFile());
+    file->mPath = path;
+    file->mMap = addr;
+    file->mMapSize = st.st_size;
+    file->mSampleRate = sampleRate;
+    if (memcmp(addr, "RIFF", 4) == 0) {
+        if (!file->parseWav()) {
+            return nullptr;
+        }
+    } else {
+        // headerless pcm is taken to be at the session rate
+        file->mData = (const int16_t*)addr;
+        file->mSamples = st.st_size / sizeof(int16_t);
+        file->mFileRate = sampleRate;
+    }
+    if (file->mFileRate != sampleRate) {
+        INFOLN("resample audio file, path:%s from:%d to:%d", path.c_str(), file->mFileRate, sampleRate);
+        Resampler resampler(file->mFileRate, sampleRate);
+        resampler.process(file->mData, file->mSamples, file->mResampled);
+        file->mData = file->mResampled.data();
+        file->mSamples = file->mResampled.size();
+        munmap(file->mMap, file->mMapSize);
+        file->mMap = nullptr;
+        return file;
+    }
+    // playback walks the mapping sequentially from the media thread
+    madvise(addr, st.st_size, MADV_WILLNEED);
+    return file;
+}
+
+bool AudioFile::parseWav()
+{
+    const uint8_t* p = (const uint8_t*)mMap;
+    if (mMapSize < 12 || memcmp(p + 8, "WAVE", 4) != 0) {
+        WARNLN("invalid wav header, path:%s", mPath.c_str());
+        return false;
+    }
+    bool hasFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= mMapSize) {
+        uint32_t chunkSize = p[pos + 4] | (p[pos + 5] << 8) | (p[pos + 6] << 16) | ((uint32_t)p[pos + 7] << 24);
+        const uint8_t* chunk = p + pos + 8;
+        if (memcmp(p + pos, "fmt ", 4) == 0 && chunkSize >= 16 && pos + 8 + 16 <= mMapSize) {
+            int format = chunk[0] | (chunk[1] << 8);
+            int channels = chunk[2] | (chunk[3] << 8);
+            int rate = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | (chunk[7] << 24);
+            int bits = chunk[14] | (chunk[15] << 8);
+            if (format != 1 || channels != 1 || bits != 16) {
+                WARNLN("wav is not 16 bit mono pcm, path:%s format:%d channels:%d bits:%d", mPath.c_str(), format, channels, bits);
+                return false;
+            }
+            if (rate <= 0) {
+                WARNLN("wav has no sample rate, path:%s", mPath.c_str());
+                return false;
+            }
+            mFileRate = rate;
+            hasFormat = true;
+        } else if (memcmp(p + pos, "data", 4) == 0 && hasFormat) {
+            size_t size = std::min((size_t)chunkSize, mMapSize - pos - 8);
+            mData = (const int16_t*)chunk;
+            mSamples = size / sizeof(int16_t);
+            return true;
+        }
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+    WARNLN("wav has no playable data chunk, path:%s", mPath.c_str());
+    return false;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+using std::map;
+using std::string;
+
+/**
+ * Read-only memory mapped recording, 16 bit mono pcm either raw or inside a wav container.
+ * The header is validated once when the file is mapped, playback reads the mapping directly.
+ * A wav at another rate is resampled once and kept in memory instead.
+ * Files are shared process wide per rate and reloaded only when they change on disk.
+ */
+class AudioFile {
+public:
+    ~AudioFile();
+
+    /** map baseDir/src, nullptr when it is missing, escapes baseDir or is not 16 bit mono pcm */
+    static std::shared_ptr<const AudioFile> Open(const string& baseDir, const string& src, int sampleRate);
+
+    const int16_t* data() const;
+    size_t samples() const;
+
+private:
+    AudioFile() = default;
+    static std::shared_ptr<AudioFile> Map(const string& path, int sampleRate);
+    bool parseWav();
+
+    string mPath;
+    void* mMap = nullptr;
+    size_t mMapSize = 0;
+    const int16_t* mData = nullptr;
+    size_t mSamples = 0;
+    int mSampleRate = 0;
+    int mFileRate = 0;
+    std::vector<int16_t> mResampled;
+    time_t mModifyTime = 0;
+
+    static std::mutex sMutex;
+    static map<string, std::shared_ptr<const AudioFile>> sFiles;
+};
@@ -0,0 +1,47 @@
+#include "BufferBudget.h"
+#include "metrics/Metrics.h"
+
+std::atomic<size_t> BufferBudget::sMaxBytes { 0 };
+std::atomic<size_t> BufferBudget::sUsed { 0 };
+
+static std::atomic<int64_t>& sBufferBytes = Metrics::Get("synth_buffer_bytes");
+static std::atomic<int64_t>& sBufferBytesPeak = Metrics::Get("synth_buffer_bytes_peak");
+
+void BufferBudget::Configure(size_t maxBytes)
+{
+    sMaxBytes = maxBytes;
+}
+
+bool BufferBudget::TryAcquire(size_t bytes)
+{
+    size_t maxBytes = sMaxBytes;
+    size_t used = sUsed.load(std::memory_order_relaxed);
+    do {
+        if (maxBytes > 0 && used + bytes > maxBytes) {
+            return false;
+        }
+    } while (!sUsed.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+    Update(used + bytes);
+    return true;
+}
+
+void BufferBudget::Acquire(size_t bytes)
+{
+    Update(sUsed.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void BufferBudget::Release(size_t bytes)
+{
+    Update(sUsed.fetch_sub(bytes, std::memory_order_relaxed) - bytes);
+}
+
+size_t BufferBudget::Used()
+{
+    return sUsed.load(std::memory_order_relaxed);
+}
+
+void BufferBudget::Update(size_t used)
+{
+    sBufferBytes = used;
+    Metrics::SetMax(sBufferBytesPeak, used);
+}
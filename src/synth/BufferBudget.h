@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * Process wide budget for buffered synthesizer audio: ring buffers plus segments staged in memory.
+ * Sessions which would go over it get shorter rings and spill staged audio to disk, so memory stays
+ * bounded however many channels play at once.
+ */
+class BufferBudget {
+public:
+    /** 0 disables the limit, usage is still tracked */
+    static void Configure(size_t maxBytes);
+    /** take bytes when they fit in the budget */
+    static bool TryAcquire(size_t bytes);
+    /** take bytes regardless of the budget, for the minimum a session needs to play at all */
+    static void Acquire(size_t bytes);
+    static void Release(size_t bytes);
+    static size_t Used();
+
+private:
+    static void Update(size_t used);
+
+    static std::atomic<size_t> sMaxBytes;
+    static std::atomic<size_t> sUsed;
+};
@@ -0,0 +1,159 @@
+#include "PromptCache.h"
+#include "dsp/ImaAdpcm.h"
+#include "metrics/Metrics.h"
+#include <chrono>
+#include <sstream>
+
+std::mutex PromptCache::sMutex;
+map<string, PromptCache::Entry> PromptCache::sEntries;
+std::list<string> PromptCache::sLru;
+size_t PromptCache::sBytes = 0;
+size_t PromptCache::sMaxBytes = 0;
+size_t PromptCache::sMaxEntryBytes = 0;
+bool PromptCache::sIsCompress = false;
+
+static std::atomic<int64_t>& sHits = Metrics::Get("synth_prompt_cache_hits_total");
+static std::atomic<int64_t>& sMisses = Metrics::Get("synth_prompt_cache_misses_total");
+static std::atomic<int64_t>& sEvictions = Metrics::Get("synth_prompt_cache_evictions_total");
+static std::atomic<int64_t>& sCacheBytes = Metrics::Get("synth_prompt_cache_bytes");
+static std::atomic<int64_t>& sCacheEntries = Metrics::Get("synth_prompt_cache_entries");
+static std::atomic<int64_t>& sDecodeBlocks = Metrics::Get("synth_prompt_decode_blocks_total");
+// a block decodes in well under a microsecond, counted in ns so the sum does not truncate to nothing
+static std::atomic<int64_t>& sDecodeTime = Metrics::Get("synth_prompt_decode_us_total", 1000);
+
+bool PromptCache::Clip::isCompressed() const
+{
+    return !adpcm.empty();
+}
+
+size_t PromptCache::Clip::bytes() const
+{
+    return pcm.size() * sizeof(int16_t) + adpcm.size();
+}
+
+string PromptCache::MakeKey(const string& text, const string& voiceName, int sampleRate, int speed, int volume, const string& codec)
+{
+    // collapse whitespace runs and trim, so layout differences in the SPEAK body share an entry
+    string normalized;
+    bool space = false;
+    for (char c : text) {
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            space = !normalized.empty();
+            continue;
+        }
+        if (space) {
+            normalized.push_back(' ');
+            space = false;
+        }
+        normalized.push_back(c);
+    }
+    std::ostringstream oss;
+    oss << voiceName << "|" << sampleRate << "|" << speed << "|" << volume << "|" << codec << "|" << normalized;
+    return oss.str();
+}
+
+void PromptCache::Configure(size_t maxBytes, size_t maxEntryBytes, bool compress)
+{
+    std::lock_guard<std::mutex> l(sMutex);
+    sMaxBytes = maxBytes;
+    sMaxEntryBytes = maxEntryBytes;
+    sIsCompress = compress;
+    Evict();
+}
+
+bool PromptCache::IsEnabled()
+{
+    std::lock_guard<std::mutex> l(sMutex);
+    return sMaxBytes > 0;
+}
+
+size_t PromptCache::MaxEntrySamples()
+{
+    std::lock_guard<std::mutex> l(sMutex);
+    if (sIsCompress) {
+        return sMaxEntryBytes / ImaAdpcm::BLOCK_BYTES * ImaAdpcm::BLOCK_SAMPLES;
+    }
+    return sMaxEntryBytes / sizeof(int16_t);
+}
+
+PromptCache::Audio PromptCache::Get(const string& key)
+{
+    std::lock_guard<std::mutex> l(sMutex);
+    if (sMaxBytes == 0) {
+        return nullptr;
+    }
+    auto it = sEntries.find(key);
+    if (it == sEntries.end()) {
+        sMisses++;
+        return nullptr;
+    }
+    sLru.splice(sLru.begin(), sLru, it->second.lru);
+    sHits++;
+    return it->second.audio;
+}
+
+bool PromptCache::Contains(const string& key)
+{
+    std::lock_guard<std::mutex> l(sMutex);
+    return sEntries.find(key) != sEntries.end();
+}
+
+void PromptCache::Put(const string& key, std::vector<int16_t>&& pcm)
+{
+    if (pcm.empty()) {
+        return;
+    }
+    bool compress;
+    {
+        std::lock_guard<std::mutex> l(sMutex);
+        compress = sIsCompress;
+    }
+    auto clip = std::make_shared<Clip>();
+    clip->samples = pcm.size();
+    if (compress) {
+        clip->adpcm.resize(ImaAdpcm::BlockCount(pcm.size()) * ImaAdpcm::BLOCK_BYTES);
+        ImaAdpcm::Encode(pcm.data(), pcm.size(), clip->adpcm.data());
+    } else {
+        clip->pcm.swap(pcm);
+    }
+    Audio audio = clip;
+    size_t bytes = audio->bytes();
+    std::lock_guard<std::mutex> l(sMutex);
+    if (bytes > sMaxEntryBytes || bytes > sMaxBytes) {
+        return;
+    }
+    auto it = sEntries.find(key);
+    if (it != sEntries.end()) {
+        sBytes -= it->second.audio->bytes();
+        sLru.erase(it->second.lru);
+        sEntries.erase(it);
+    }
+    sLru.push_front(key);
+    Entry entry;
+    entry.audio = audio;
+    entry.lru = sLru.begin();
+    sEntries.emplace(key, entry);
+    sBytes += bytes;
+    Evict();
+}
+
+void PromptCache::Evict()
+{
+    while (sBytes > sMaxBytes && !sLru.empty()) {
+        auto it = sEntries.find(sLru.back());
+        sBytes -= it->second.audio->bytes();
+        sEntries.erase(it);
+        sLru.pop_back();
+        sEvictions++;
+    }
+    sCacheBytes = sBytes;
+    sCacheEntries = sEntries.size();
+}
+
+void PromptCache::Decode(const Clip& clip, size_t block, int16_t* out)
+{
+    auto begin = std::chrono::steady_clock::now();
+    ImaAdpcm::DecodeBlock(&clip.adpcm[block * ImaAdpcm::BLOCK_BYTES], out);
+    sDecodeTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    sDecodeBlocks++;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::map;
+using std::string;
+
+/**
+ * Process wide LRU cache of synthesized prompts, bounded by stored bytes.
+ * Entries are kept as IMA-ADPCM when compression is on, a quarter of the pcm size,
+ * and decoded a block at a time by the reader.
+ */
+class PromptCache {
+public:
+    struct Clip {
+        size_t samples = 0;
+        /** either pcm or ImaAdpcm blocks holding samples */
+        std::vector<int16_t> pcm;
+        std::vector<uint8_t> adpcm;
+
+        bool isCompressed() const;
+        size_t bytes() const;
+    };
+    typedef std::shared_ptr<const Clip> Audio;
+
+    static string MakeKey(const string& text, const string& voiceName, int sampleRate, int speed, int volume, const string& codec);
+    static void Configure(size_t maxBytes, size_t maxEntryBytes, bool compress);
+    static bool IsEnabled();
+    /** longest prompt, in pcm samples, an entry can hold */
+    static size_t MaxEntrySamples();
+
+    static Audio Get(const string& key);
+    /** lookup without touching LRU order or hit/miss counters */
+    static bool Contains(const string& key);
+    /** compressed here when enabled, call it off the media thread */
+    static void Put(const string& key, std::vector<int16_t>&& pcm);
+    /** decode ImaAdpcm block index of a compressed clip, out holds ImaAdpcm::BLOCK_SAMPLES */
+    static void Decode(const Clip& clip, size_t block, int16_t* out);
+
+private:
+    struct Entry {
+        Audio audio;
+        std::list<string>::iterator lru;
+    };
+
+    static void Evict();
+
+    static std::mutex sMutex;
+    static map<string, Entry> sEntries;
+    /** most recently used first */
+    static std::list<string> sLru;
+    static size_t sBytes;
+    static size_t sMaxBytes;
+    static size_t sMaxEntryBytes;
+    static bool sIsCompress;
+};
@@ -0,0 +1,176 @@
+#include "PromptWarmer.h"
+#include "Synthesizer.h"
+#include "metrics/Metrics.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#define WARMUP_SECTION "prompt_warmup"
+#define DEFAULT_WARMUP_CONCURRENCY 2
+#define DEFAULT_WARMUP_TIMEOUT 30000
+
+std::vector<PromptWarmer::Prompt> PromptWarmer::sPrompts;
+std::vector<std::thread> PromptWarmer::sThreads;
+std::atomic<size_t> PromptWarmer::sNext { 0 };
+std::atomic<size_t> PromptWarmer::sDone { 0 };
+std::atomic<size_t> PromptWarmer::sFailed { 0 };
+std::atomic<bool> PromptWarmer::sIsStop { false };
+int PromptWarmer::sTimeout = DEFAULT_WARMUP_TIMEOUT;
+SessionTable* PromptWarmer::sSessionTable = nullptr;
+BackgroundWorker* PromptWarmer::sStartWorker = nullptr;
+BackgroundWorker* PromptWarmer::sStopWorker = nullptr;
+
+static std::atomic<int64_t>& sWarmupDone = Metrics::Get("synth_warmup_done_total");
+static std::atomic<int64_t>& sWarmupFailed = Metrics::Get("synth_warmup_failed_total");
+
+void PromptWarmer::Start(IniParser& ini, SessionTable* table, BackgroundWorker* startWorker, BackgroundWorker* stopWorker)
+{
+    Stop();
+    sSessionTable = table;
+    sStartWorker = startWorker;
+    sStopWorker = stopWorker;
+    sPrompts.clear();
+    LoadPrompts(ini, sPrompts);
+    if (sPrompts.empty()) {
+        return;
+    }
+    if (!PromptCache::IsEnabled()) {
+        WARNLN("prompt cache is disabled, skip warm up, prompts:%zu", sPrompts.size());
+        return;
+    }
+    int concurrency = 0;
+    ini.get(WARMUP_SECTION, "concurrency", concurrency);
+    if (concurrency <= 0) {
+        concurrency = DEFAULT_WARMUP_CONCURRENCY;
+    }
+    ini.get(WARMUP_SECTION, "timeout", sTimeout);
+    if (sTimeout <= 0) {
+        sTimeout = DEFAULT_WARMUP_TIMEOUT;
+    }
+    sNext = 0;
+    sDone = 0;
+    sFailed = 0;
+    sIsStop = false;
+    INFOLN("begin prompt warm up, prompts:%zu concurrency:%d", sPrompts.size(), concurrency);
+    for (int i = 0; i < concurrency && i < (int)sPrompts.size(); i++) {
+        sThreads.emplace_back(PromptWarmer::Run, i);
+    }
+}
+
+void PromptWarmer::Stop()
+{
+    sIsStop = true;
+    for (auto& t : sThreads) {
+        t.join();
+    }
+    sThreads.clear();
+}
+
+void PromptWarmer::LoadPrompts(IniParser& ini, std::vector<Prompt>& prompts)
+{
+    Prompt prompt;
+    // prompt_xxx=voice|text entries of the section
+    auto sections = ini.get();
+    auto section = sections.find(WARMUP_SECTION);
+    if (section != sections.end()) {
+        for (auto it = section->second.begin(); it != section->second.end(); it++) {
+            if (it->first.compare(0, 6, "prompt") == 0 && ParsePrompt(it->second, prompt)) {
+                prompts.push_back(prompt);
+            }
+        }
+    }
+    // one voice|text per line, # starts a comment
+    string fileName;
+    ini.get(WARMUP_SECTION, "file", fileName);
+    if (!fileName.empty()) {
+        std::ifstream ifs(fileName);
+        if (!ifs) {
+            WARNLN("open warm up file failed, file:%s", fileName.c_str());
+        }
+        string line;
+        while (std::getline(ifs, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            if (ParsePrompt(line, prompt)) {
+                prompts.push_back(prompt);
+            }
+        }
+    }
+    // the cache is keyed by rate, warm every prompt at each rate sessions negotiate
+    string rates = "8000";
+    ini.get(WARMUP_SECTION, "rates", rates);
+    std::vector<Prompt> all;
+    std::istringstream iss(rates);
+    string rate;
+    while (std::getline(iss, rate, ',')) {
+        for (auto& p : prompts) {
+            all.push_back(p);
+            all.back().sampleRate = atoi(rate.c_str());
+        }
+    }
+    prompts.swap(all);
+}
+
+bool PromptWarmer::ParsePrompt(const string& line, Prompt& prompt)
+{
+    size_t pos = line.find('|');
+    if (pos == string::npos || pos + 1 >= line.size()) {
+        WARNLN("invalid warm up prompt, expect voice|text, line:%s", line.c_str());
+        return false;
+    }
+    prompt.voiceName = line.substr(0, pos);
+    prompt.text = line.substr(pos + 1);
+    return true;
+}
+
+void PromptWarmer::Run(int index)
+{
+    while (!sIsStop) {
+        size_t i = sNext++;
+        if (i >= sPrompts.size()) {
+            break;
+        }
+        if (Warm(sPrompts[i], index)) {
+            sWarmupDone++;
+            sDone++;
+        } else {
+            sWarmupFailed++;
+            sFailed++;
+        }
+        INFOLN("prompt warm up progress, done:%zu failed:%zu total:%zu", sDone.load(), sFailed.load(), sPrompts.size());
+    }
+}
+
+bool PromptWarmer::Warm(const Prompt& prompt, int index)
+{
+    string channelId = "warmup-" + std::to_string(index);
+    auto synthesizer = Synthesizer::Create(channelId, sSessionTable, sStartWorker, sStopWorker);
+    if (!synthesizer) {
+        return false;
+    }
+    synthesizer->setVoiceName(prompt.voiceName);
+    synthesizer->setText(prompt.text);
+    synthesizer->setFormat("LPCM", prompt.sampleRate);
+    synthesizer->setCacheOnly(true);
+    // live sessions go first when the vendor account is busy
+    synthesizer->setPriority(Admission::WARMUP);
+    // registered first, vendor callbacks look the session up by voiceId
+    Synthesizer::Set(channelId, synthesizer);
+    int ret = synthesizer->start();
+    if (ret < 0) {
+        WARNLN("prompt warm up start failed, ret:%d voiceName:%s text:%s", ret, prompt.voiceName.c_str(), prompt.text.c_str());
+        Synthesizer::Del(channelId);
+        return false;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    while (!synthesizer->isEnd() && !sIsStop) {
+        if (std::chrono::steady_clock::now() - begin > std::chrono::milliseconds(sTimeout)) {
+            WARNLN("prompt warm up timeout, voiceName:%s text:%s", prompt.voiceName.c_str(), prompt.text.c_str());
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    Synthesizer::Del(channelId);
+    return PromptCache::Contains(synthesizer->getCacheKey());
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ini/IniParser.h"
+#include "session/SessionTable.h"
+#include "worker/BackgroundWorker.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Synthesizes a configured list of prompts in the background so the prompt cache is hot
+ * before traffic arrives. Start() returns at once, Stop() aborts and joins the workers.
+ */
+class PromptWarmer {
+public:
+    struct Prompt {
+        string voiceName;
+        string text;
+        int sampleRate = 8000;
+    };
+
+    /** the warm-up sessions are published in table and use the engine's workers */
+    static void Start(IniParser& ini, SessionTable* table, BackgroundWorker* startWorker, BackgroundWorker* stopWorker);
+    static void Stop();
+
+private:
+    static void LoadPrompts(IniParser& ini, std::vector<Prompt>& prompts);
+    static bool ParsePrompt(const string& line, Prompt& prompt);
+    static void Run(int index);
+    static bool Warm(const Prompt& prompt, int index);
+
+    static std::vector<Prompt> sPrompts;
+    static std::vector<std::thread> sThreads;
+    static std::atomic<size_t> sNext;
+    static std::atomic<size_t> sDone;
+    static std::atomic<size_t> sFailed;
+    static std::atomic<bool> sIsStop;
+    static int sTimeout;
+    static SessionTable* sSessionTable;
+    static BackgroundWorker* sStartWorker;
+    static BackgroundWorker* sStopWorker;
+};
@@ -0,0 +1,82 @@
+#include "SharedAudio.h"
+#include "BufferBudget.h"
+#include <algorithm>
+#include <cstring>
+
+SharedAudio::SharedAudio(size_t maxSamples)
+{
+    mMaxChunks = (maxSamples + CHUNK_SAMPLES - 1) / CHUNK_SAMPLES;
+    mChunks.reset(new std::unique_ptr<int16_t[]>[mMaxChunks]);
+}
+
+SharedAudio::~SharedAudio()
+{
+    size_t chunks = (mWritten + CHUNK_SAMPLES - 1) / CHUNK_SAMPLES;
+    BufferBudget::Release(chunks * CHUNK_SAMPLES * sizeof(int16_t));
+}
+
+size_t SharedAudio::append(const int16_t* samples, size_t count)
+{
+    size_t kept = 0;
+    while (kept < count) {
+        size_t chunk = mWritten / CHUNK_SAMPLES;
+        size_t offset = mWritten % CHUNK_SAMPLES;
+        if (chunk >= mMaxChunks) {
+            break;
+        }
+        if (!mChunks[chunk]) {
+            // shared by all readers, so taken from the budget unconditionally
+            mChunks[chunk].reset(new int16_t[CHUNK_SAMPLES]);
+            BufferBudget::Acquire(CHUNK_SAMPLES * sizeof(int16_t));
+        }
+        size_t n = std::min(count - kept, (size_t)CHUNK_SAMPLES - offset);
+        memcpy(mChunks[chunk].get() + offset, samples + kept, n * sizeof(int16_t));
+        kept += n;
+        mWritten += n;
+    }
+    mSize.store(mWritten, std::memory_order_release);
+    return kept;
+}
+
+void SharedAudio::finish()
+{
+    mIsEnd.store(true, std::memory_order_release);
+}
+
+bool SharedAudio::isEnd() const
+{
+    return mIsEnd.load(std::memory_order_acquire);
+}
+
+size_t SharedAudio::size() const
+{
+    return mSize.load(std::memory_order_acquire);
+}
+
+size_t SharedAudio::read(size_t pos, int16_t* out, size_t count) const
+{
+    size_t size = mSize.load(std::memory_order_acquire);
+    if (pos >= size) {
+        return 0;
+    }
+    count = std::min(count, size - pos);
+    size_t done = 0;
+    while (done < count) {
+        size_t chunk = (pos + done) / CHUNK_SAMPLES;
+        size_t offset = (pos + done) % CHUNK_SAMPLES;
+        size_t n = std::min(count - done, (size_t)CHUNK_SAMPLES - offset);
+        memcpy(out + done, mChunks[chunk].get() + offset, n * sizeof(int16_t));
+        done += n;
+    }
+    return done;
+}
+
+void SharedAudio::attach()
+{
+    mReaders++;
+}
+
+int SharedAudio::detach()
+{
+    return --mReaders;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Append-only pcm of one synthesis shared by every channel playing the same prompt.
+ * One producer appends, any number of readers copy out with their own cursor and never lock:
+ * samples live in fixed chunks that never move and are published by a release store of the size.
+ */
+class SharedAudio {
+public:
+    explicit SharedAudio(size_t maxSamples);
+    ~SharedAudio();
+    SharedAudio(const SharedAudio&) = delete;
+    SharedAudio& operator=(const SharedAudio&) = delete;
+
+    /** producer side, returns the samples kept, the rest is dropped past maxSamples */
+    size_t append(const int16_t* samples, size_t count);
+    void finish();
+
+    /** reader side */
+    bool isEnd() const;
+    size_t size() const;
+    size_t read(size_t pos, int16_t* out, size_t count) const;
+
+    void attach();
+    /** returns the readers left */
+    int detach();
+
+private:
+    enum {
+        CHUNK_SAMPLES = 4096
+    };
+
+    std::unique_ptr<std::unique_ptr<int16_t[]>[]> mChunks;
+    size_t mMaxChunks = 0;
+    /** written by the producer only */
+    size_t mWritten = 0;
+    std::atomic<size_t> mSize { 0 };
+    std::atomic<bool> mIsEnd { false };
+    std::atomic<int> mReaders { 0 };
+};
@@ -0,0 +1,87 @@
+#include "SpillBuffer.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+#define SPILL_READ_SIZE 65536
+
+static std::atomic<int64_t>& sSpillBytes = Metrics::Get("synth_spill_bytes_total");
+
+SpillBuffer::~SpillBuffer()
+{
+    closeFile();
+}
+
+bool SpillBuffer::isSpilled() const
+{
+    return mFd >= 0;
+}
+
+size_t SpillBuffer::memorySize() const
+{
+    return mMemory.size();
+}
+
+void SpillBuffer::appendMemory(const char* data, size_t len)
+{
+    mMemory.append(data, len);
+}
+
+bool SpillBuffer::appendFile(const string& dir, const char* data, size_t len)
+{
+    if (mFd < 0) {
+        string name = (dir.empty() ? string("/tmp") : dir) + "/mrcpmod-spill-XXXXXX";
+        std::vector<char> path(name.begin(), name.end());
+        path.push_back('\0');
+        mFd = mkstemp(path.data());
+        if (mFd < 0) {
+            WARNLN("create spill file failed, dir:%s", dir.c_str());
+            return false;
+        }
+        // nothing else opens it, the space goes back as soon as it is closed
+        unlink(path.data());
+        mFileSize = 0;
+    }
+    while (len > 0) {
+        ssize_t n = write(mFd, data, len);
+        if (n <= 0) {
+            WARNLN("write spill file failed, size:%zu", mFileSize);
+            return false;
+        }
+        data += n;
+        len -= n;
+        mFileSize += n;
+        sSpillBytes += n;
+    }
+    return true;
+}
+
+void SpillBuffer::drain(const std::function<void(const char*, size_t)>& sink)
+{
+    if (!mMemory.empty()) {
+        sink(mMemory.data(), mMemory.size());
+        string().swap(mMemory);
+    }
+    if (mFd < 0) {
+        return;
+    }
+    std::vector<char> buff(SPILL_READ_SIZE);
+    if (lseek(mFd, 0, SEEK_SET) == 0) {
+        ssize_t n;
+        while ((n = read(mFd, buff.data(), buff.size())) > 0) {
+            sink(buff.data(), n);
+        }
+    }
+    closeFile();
+}
+
+void SpillBuffer::closeFile()
+{
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+        mFileSize = 0;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <string>
+
+using std::string;
+
+/**
+ * Audio of a segment synthesized ahead of its turn. It is kept in memory while the caller allows,
+ * after the first overflow everything goes to an unlinked temp file so the order is kept.
+ */
+class SpillBuffer {
+public:
+    SpillBuffer() = default;
+    ~SpillBuffer();
+    SpillBuffer(const SpillBuffer&) = delete;
+    SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+    bool isSpilled() const;
+    size_t memorySize() const;
+    void appendMemory(const char* data, size_t len);
+    /** false when the temp file can not be created or written */
+    bool appendFile(const string& dir, const char* data, size_t len);
+    /** hand everything to sink in order and empty the buffer */
+    void drain(const std::function<void(const char*, size_t)>& sink);
+
+private:
+    void closeFile();
+
+    string mMemory;
+    int mFd = -1;
+    size_t mFileSize = 0;
+};
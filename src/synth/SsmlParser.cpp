@@ -0,0 +1,207 @@
+#include "SsmlParser.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+bool SsmlParser::IsSsml(const string& body)
+{
+    size_t pos = body.find_first_not_of(" \t\r\n");
+    if (pos == string::npos) {
+        return false;
+    }
+    return body.compare(pos, 5, "<?xml") == 0 || body.compare(pos, 6, "<speak") == 0;
+}
+
+bool SsmlParser::Parse(const string& body, std::vector<Item>& items)
+{
+    bool newSentence = true;
+    // depth of <audio> elements, their content is fallback text rather than spoken text
+    int audioDepth = 0;
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t lt = body.find('<', pos);
+        if (lt == string::npos) {
+            lt = body.size();
+        }
+        if (lt > pos) {
+            string text = DecodeEntities(body.substr(pos, lt - pos));
+            if (audioDepth > 0 && !items.empty() && items.back().type == Item::AUDIO) {
+                items.back().text += text;
+            } else if (audioDepth == 0) {
+                AppendText(items, text, newSentence);
+            }
+        }
+        if (lt >= body.size()) {
+            break;
+        }
+        if (body.compare(lt, 4, "<!--") == 0) {
+            size_t end = body.find("-->", lt);
+            if (end == string::npos) {
+                return false;
+            }
+            pos = end + 3;
+            continue;
+        }
+        size_t gt = body.find('>', lt);
+        if (gt == string::npos) {
+            return false;
+        }
+        string tag = body.substr(lt + 1, gt - lt - 1);
+        pos = gt + 1;
+        if (tag.empty() || tag[0] == '?' || tag[0] == '!') {
+            continue;
+        }
+        bool isClose = tag[0] == '/';
+        bool isEmpty = tag[tag.size() - 1] == '/';
+        size_t nameBegin = isClose ? 1 : 0;
+        size_t nameEnd = tag.find_first_of(" \t\r\n/", nameBegin);
+        string name = tag.substr(nameBegin, nameEnd == string::npos ? string::npos : nameEnd - nameBegin);
+        if (name == "s" || name == "p" || name == "speak") {
+            newSentence = true;
+        } else if (name == "break" && !isClose) {
+            Item item;
+            item.type = Item::BREAK;
+            item.time = ParseTime(tag);
+            items.push_back(item);
+            newSentence = true;
+        } else if (name == "audio") {
+            if (isClose) {
+                audioDepth = audioDepth > 0 ? audioDepth - 1 : 0;
+                continue;
+            }
+            Item item;
+            item.type = Item::AUDIO;
+            item.src = Attribute(tag, "src");
+            item.time = 0;
+            items.push_back(item);
+            newSentence = true;
+            if (!isEmpty) {
+                audioDepth++;
+            }
+        } else if (name == "sub" && !isClose) {
+            string alias = Attribute(tag, "alias");
+            size_t end = body.find("</sub>", pos);
+            if (!alias.empty() && end != string::npos) {
+                AppendText(items, alias, newSentence);
+                pos = end + 6;
+            }
+        }
+    }
+    return true;
+}
+
+void SsmlParser::AppendText(std::vector<Item>& items, const string& text, bool& newSentence)
+{
+    if (text.find_first_not_of(" \t\r\n") == string::npos) {
+        if (!items.empty() && items.back().type == Item::TEXT) {
+            items.back().text += " ";
+        }
+        return;
+    }
+    if (newSentence || items.empty() || items.back().type != Item::TEXT) {
+        Item item;
+        item.type = Item::TEXT;
+        item.time = 0;
+        items.push_back(item);
+        newSentence = false;
+    }
+    items.back().text += text;
+}
+
+string SsmlParser::Attribute(const string& tag, const string& name)
+{
+    size_t pos = 0;
+    while ((pos = tag.find(name, pos)) != string::npos) {
+        size_t eq = tag.find_first_not_of(" \t", pos + name.size());
+        bool isWord = pos > 0 && !isspace((unsigned char)tag[pos - 1]);
+        if (isWord || eq == string::npos || tag[eq] != '=') {
+            pos += name.size();
+            continue;
+        }
+        size_t quote = tag.find_first_of("\"'", eq);
+        if (quote == string::npos) {
+            return "";
+        }
+        size_t end = tag.find(tag[quote], quote + 1);
+        if (end == string::npos) {
+            return "";
+        }
+        return DecodeEntities(tag.substr(quote + 1, end - quote - 1));
+    }
+    return "";
+}
+
+int SsmlParser::ParseTime(const string& tag)
+{
+    string time = Attribute(tag, "time");
+    if (!time.empty()) {
+        double val = atof(time.c_str());
+        if (time.find("ms") != string::npos) {
+            return (int)val;
+        }
+        return (int)(val * 1000);
+    }
+    string strength = Attribute(tag, "strength");
+    if (strength == "none") {
+        return 0;
+    } else if (strength == "x-weak") {
+        return 100;
+    } else if (strength == "weak") {
+        return 250;
+    } else if (strength == "strong") {
+        return 750;
+    } else if (strength == "x-strong") {
+        return 1000;
+    }
+    return 500;
+}
+
+string SsmlParser::DecodeEntities(const string& text)
+{
+    static const char* const names[] = { "lt;", "gt;", "amp;", "quot;", "apos;", nullptr };
+    static const char values[] = { '<', '>', '&', '"', '\'' };
+    string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '&') {
+            out.push_back(text[i]);
+            continue;
+        }
+        bool decoded = false;
+        for (int n = 0; names[n]; n++) {
+            if (text.compare(i + 1, strlen(names[n]), names[n]) == 0) {
+                out.push_back(values[n]);
+                i += strlen(names[n]);
+                decoded = true;
+                break;
+            }
+        }
+        size_t semi = text.find(';', i);
+        if (!decoded && i + 1 < text.size() && text[i + 1] == '#' && semi != string::npos) {
+            bool isHex = i + 2 < text.size() && (text[i + 2] == 'x' || text[i + 2] == 'X');
+            unsigned long cp = strtoul(text.c_str() + i + (isHex ? 3 : 2), nullptr, isHex ? 16 : 10);
+            // utf-8 encode the code point
+            if (cp < 0x80) {
+                out.push_back((char)cp);
+            } else if (cp < 0x800) {
+                out.push_back((char)(0xC0 | (cp >> 6)));
+                out.push_back((char)(0x80 | (cp & 0x3F)));
+            } else if (cp < 0x10000) {
+                out.push_back((char)(0xE0 | (cp >> 12)));
+                out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (cp & 0x3F)));
+            } else {
+                out.push_back((char)(0xF0 | (cp >> 18)));
+                out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+                out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (cp & 0x3F)));
+            }
+            i = semi;
+            decoded = true;
+        }
+        if (!decoded) {
+            out.push_back('&');
+        }
+    }
+    return out;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+using std::string;
+
+/**
+ * Minimal SSML reader for the synth path. Turns a <speak> document into an ordered list of
+ * text, recorded audio and silence items. Unknown elements are dropped but their text is kept.
+ */
+class SsmlParser {
+public:
+    struct Item {
+        enum Type {
+            TEXT,
+            AUDIO,
+            BREAK
+        };
+        Type type;
+        /** TEXT: text to synthesize, AUDIO: fallback text when the file can not be played */
+        string text;
+        /** AUDIO: src attribute */
+        string src;
+        /** BREAK: silence length (ms) */
+        int time;
+    };
+
+    static bool IsSsml(const string& body);
+    static bool Parse(const string& body, std::vector<Item>& items);
+
+private:
+    static string Attribute(const string& tag, const string& name);
+    static int ParseTime(const string& tag);
+    static string DecodeEntities(const string& text);
+    static void AppendText(std::vector<Item>& items, const string& text, bool& newSentence);
+};
@@ -28,15 +28,34 @@
  */
 #include "SynthEngine.h"
 #include "Synthesizer.h"
-#include <thread>
-#include <chrono>
+#include "PromptCache.h"
+#include "PromptWarmer.h"
+#include "BufferBudget.h"
+#include "metrics/Metrics.h"
+#include "session/SessionTable.h"
+#include "worker/BackgroundWorker.h"
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
 
 #define SYNTH_ENGINE_TASK_NAME "Synth Engine"
+#define SYNTH_ENGINE_TIMER_INTERVAL 10000
+#define SYNTH_ADMISSION_TIMER_INTERVAL 100
+#define SYNTH_SESSION_MAX_AGE 3600000
+#define SYNTH_SESSION_MAX_IDLE 60000
+#define SYNTH_SESSION_TABLE_SIZE 1024
+#define SYNTH_WORKER_THREADS 4
 
 typedef struct demo_synth_engine_t demo_synth_engine_t;
 typedef struct demo_synth_channel_t demo_synth_channel_t;
 typedef struct demo_synth_msg_t demo_synth_msg_t;
 
+static std::atomic<int64_t>& sSessions = Metrics::Get("synth_sessions");
+static std::atomic<int64_t>& sReapedAge = Metrics::Get("synth_reaped_age_total");
+static std::atomic<int64_t>& sReapedIdle = Metrics::Get("synth_reaped_idle_total");
+static std::atomic<int64_t>& sReapedOrphan = Metrics::Get("synth_reaped_orphan_total");
+
 /** Declaration of synthesizer engine methods */
 static apt_bool_t demo_synth_engine_destroy(mrcp_engine_t* engine);
 static apt_bool_t demo_synth_engine_open(mrcp_engine_t* engine);
@@ -83,6 +102,29 @@ static const mpf_audio_stream_vtable_t audio_stream_vtable = {
 /** Declaration of demo synthesizer engine */
 struct demo_synth_engine_t {
     apt_consumer_task_t* task;
+    /** Periodic housekeeping timer, runs in the context of the engine task */
+    apt_timer_t* timer;
+    /** Housekeeping interval (msec) */
+    apr_uint32_t timer_interval;
+    /** Metrics written by the housekeeping timer, empty disables them */
+    string* metrics_file;
+    /** Expires sessions waiting for admission too long */
+    apt_timer_t* admission_timer;
+    /** Sessions of this engine published for mrcpmod-top, /<session_table>-synth */
+    SessionTable* session_table;
+    /** Opens the vendor sessions of admitted requests, apart from teardown so hangups do not hold up admission */
+    BackgroundWorker* start_worker;
+    /** Runs the vendor Stop of released sessions */
+    BackgroundWorker* stop_worker;
+    /** Sessions older than this are reaped by the housekeeping timer (msec), 0 is unlimited */
+    apr_uint32_t session_max_age;
+    /** Sessions neither synthesizing nor played for this long are reaped (msec), 0 is unlimited */
+    apr_uint32_t session_max_idle;
+    /** Apply Prosody-Rate/Prosody-Volume locally to the synthesized audio */
+    apt_bool_t local_prosody;
+    /** Open channels by channelId, accessed in the engine task only. The reaper finds a session's
+        channel here, a channel a session points to may be gone */
+    std::map<string, demo_synth_channel_t*>* channels;
 };
 
 /** Declaration of demo synthesizer channel */
@@ -100,6 +142,9 @@ struct demo_synth_channel_t {
     apr_size_t time_to_complete;
     /** Is paused */
     apt_bool_t paused;
+    /** Session playing on the channel, set and cleared by the engine task and read by the media
+        thread with std::atomic_load, so a frame takes no lock of the session map */
+    std::shared_ptr<Synthesizer>* synthesizer;
 };
 
 typedef enum {
@@ -114,10 +159,14 @@ struct demo_synth_msg_t {
     demo_synth_msg_type_e type;
     mrcp_engine_channel_t* channel;
     mrcp_message_t* request;
+    void* data;
 };
 
-static apt_bool_t demo_synth_msg_signal(demo_synth_msg_type_e type, mrcp_engine_channel_t* channel, mrcp_message_t* request);
+static apt_bool_t demo_synth_msg_signal(demo_synth_msg_type_e type, mrcp_engine_channel_t* channel, mrcp_message_t* request, void* data = NULL);
 static apt_bool_t demo_synth_msg_process(apt_task_t* task, apt_task_msg_t* msg);
+static void demo_synth_engine_timer_proc(apt_timer_t* timer, void* obj);
+static void demo_synth_reap(demo_synth_engine_t* demo_engine);
+static void demo_synth_admission_timer_proc(apt_timer_t* timer, void* obj);
 
 /** Declare this macro to set plugin version */
 MM_MRCP_PLUGIN_VERSION_DECLARE
@@ -154,6 +203,17 @@ mrcp_plugin_create(apr_pool_t* pool)
     if (vtable) {
         vtable->process_msg = demo_synth_msg_process;
     }
+    demo_engine->timer = apt_consumer_task_timer_create(demo_engine->task, demo_synth_engine_timer_proc, demo_engine, pool);
+    demo_engine->timer_interval = SYNTH_ENGINE_TIMER_INTERVAL;
+    demo_engine->metrics_file = new string();
+    demo_engine->admission_timer = apt_consumer_task_timer_create(demo_engine->task, demo_synth_admission_timer_proc, demo_engine, pool);
+    demo_engine->session_table = new SessionTable();
+    demo_engine->start_worker = new BackgroundWorker(SYNTH_WORKER_THREADS);
+    demo_engine->stop_worker = new BackgroundWorker(SYNTH_WORKER_THREADS);
+    demo_engine->channels = new std::map<string, demo_synth_channel_t*>();
+    demo_engine->session_max_age = SYNTH_SESSION_MAX_AGE;
+    demo_engine->session_max_idle = SYNTH_SESSION_MAX_IDLE;
+    demo_engine->local_prosody = FALSE;
 
     INFOLN("end create synthesizer engine");
     /* create engine base */
@@ -174,6 +234,16 @@ static apt_bool_t demo_synth_engine_destroy(mrcp_engine_t* engine)
         apt_task_destroy(task);
         demo_engine->task = NULL;
     }
+    delete demo_engine->metrics_file;
+    demo_engine->metrics_file = NULL;
+    delete demo_engine->session_table;
+    demo_engine->session_table = NULL;
+    delete demo_engine->start_worker;
+    demo_engine->start_worker = NULL;
+    delete demo_engine->stop_worker;
+    demo_engine->stop_worker = NULL;
+    delete demo_engine->channels;
+    demo_engine->channels = NULL;
     INFOLN("end destroy synthesizer engine");
     return TRUE;
 }
@@ -183,10 +253,79 @@ static apt_bool_t demo_synth_engine_open(mrcp_engine_t* engine)
 {
     INFOLN("begin open synthesizer engine");
     demo_synth_engine_t* demo_engine = (demo_synth_engine_t*)engine->obj;
+    IniParser ini;
+    int cacheSize = 0;
+    int cacheEntrySize = 0;
+    int metricsInterval = 0;
+    int memoryBudget = 0;
+    int localProsody = 0;
+    int cacheCompress = 0;
+    int arenaSlabCache = -1;
+    int maxAge = SYNTH_SESSION_MAX_AGE;
+    int maxIdle = SYNTH_SESSION_MAX_IDLE;
+    int sessionTableSize = SYNTH_SESSION_TABLE_SIZE;
+    int workerThreads = SYNTH_WORKER_THREADS;
+    string sessionTable = "mrcpmod";
+    string metricsDir;
+    string type;
+    ini.setFileName(Synthesizer::GetConfigFile());
+    ini.get("generic", "session_max_age", maxAge);
+    ini.get("generic", "session_max_idle", maxIdle);
+    demo_engine->session_max_age = std::max(maxAge, 0);
+    demo_engine->session_max_idle = std::max(maxIdle, 0);
+    ini.get("generic", "type", type);
+    ini.get("generic", "prompt_cache_size", cacheSize);
+    ini.get("generic", "prompt_cache_entry_size", cacheEntrySize);
+    ini.get("generic", "prompt_cache_compress", cacheCompress);
+    ini.get("generic", "metrics_dir", metricsDir);
+    ini.get("generic", "metrics_interval", metricsInterval);
+    ini.get("generic", "synth_memory_budget", memoryBudget);
+    ini.get("generic", "synth_local_prosody", localProsody);
+    ini.get("generic", "arena_slab_cache", arenaSlabCache);
+    ini.get("generic", "worker_threads", workerThreads);
+    if (workerThreads > 0) {
+        demo_engine->start_worker->setMaxThreads(workerThreads);
+        demo_engine->stop_worker->setMaxThreads(workerThreads);
+    }
+    if (arenaSlabCache >= 0) {
+        Arena::Configure(arenaSlabCache);
+    }
+    demo_engine->local_prosody = localProsody != 0 ? TRUE : FALSE;
+    PromptCache::Configure((size_t)cacheSize * 1024 * 1024, (size_t)cacheEntrySize * 1024, cacheCompress != 0);
+    INFOLN("prompt cache, size:%dMB entry_size:%dKB compress:%d", cacheSize, cacheEntrySize, cacheCompress);
+    BufferBudget::Configure((size_t)std::max(memoryBudget, 0) * 1024 * 1024);
+    INFOLN("synthesizer buffer budget, size:%dMB", memoryBudget);
+    for (auto& account : Admission::Load(ini, type, "tts")) {
+        INFOLN("admission account, backend:%s account:%s limit:%d weight:%d", (type + "_tts").c_str(), account.credential.name.c_str(), account.limit, account.weight);
+    }
+    ini.get("generic", "session_table", sessionTable);
+    ini.get("generic", "session_table_size", sessionTableSize);
+    if (!sessionTable.empty() && sessionTableSize > 0) {
+        string name = "/" + sessionTable + "-synth";
+        if (demo_engine->session_table->open(name, sessionTableSize)) {
+            INFOLN("session table open, name:%s size:%d", name.c_str(), sessionTableSize);
+        } else {
+            ERRLN("session table open failed, name:%s size:%d err:%s", name.c_str(), sessionTableSize, strerror(errno));
+        }
+    }
+    if (!metricsDir.empty()) {
+        *demo_engine->metrics_file = metricsDir + "/synth.prom";
+    }
+    if (metricsInterval > 0) {
+        demo_engine->timer_interval = metricsInterval;
+    }
     if (demo_engine->task) {
         apt_task_t* task = apt_consumer_task_base_get(demo_engine->task);
         apt_task_start(task);
     }
+    if (demo_engine->timer) {
+        apt_timer_set(demo_engine->timer, demo_engine->timer_interval);
+    }
+    if (demo_engine->admission_timer) {
+        apt_timer_set(demo_engine->admission_timer, SYNTH_ADMISSION_TIMER_INTERVAL);
+    }
+    /* runs in the background, engine open does not wait for it */
+    PromptWarmer::Start(ini, demo_engine->session_table, demo_engine->start_worker, demo_engine->stop_worker);
     INFOLN("end open synthesizer engine");
     return mrcp_engine_open_respond(engine, TRUE);
 }
@@ -196,6 +335,17 @@ static apt_bool_t demo_synth_engine_close(mrcp_engine_t* engine)
 {
     INFOLN("begin close synthesizer engine");
     demo_synth_engine_t* demo_engine = (demo_synth_engine_t*)engine->obj;
+    PromptWarmer::Stop();
+    /* finish admitted starts, then the vendor teardown of stopped sessions */
+    demo_engine->start_worker->stop();
+    demo_engine->stop_worker->stop();
+    if (demo_engine->timer) {
+        apt_timer_kill(demo_engine->timer);
+    }
+    if (demo_engine->admission_timer) {
+        apt_timer_kill(demo_engine->admission_timer);
+    }
+    demo_engine->session_table->close();
     if (demo_engine->task) {
         apt_task_t* task = apt_consumer_task_base_get(demo_engine->task);
         apt_task_terminate(task, TRUE);
@@ -218,12 +368,22 @@ static mrcp_engine_channel_t* demo_synth_engine_channel_create(mrcp_engine_t* en
     synth_channel->stop_response = NULL;
     synth_channel->time_to_complete = 0;
     synth_channel->paused = FALSE;
+    synth_channel->synthesizer = new std::shared_ptr<Synthesizer>();
 
     capabilities = mpf_source_stream_capabilities_create(pool);
     mpf_codec_capabilities_add(
         &capabilities->codecs,
         MPF_SAMPLE_RATE_8000 | MPF_SAMPLE_RATE_16000,
         "LPCM");
+    /* encoded by the synthesizer, so the media engine has nothing to transcode */
+    mpf_codec_capabilities_add(
+        &capabilities->codecs,
+        MPF_SAMPLE_RATE_8000,
+        "PCMU");
+    mpf_codec_capabilities_add(
+        &capabilities->codecs,
+        MPF_SAMPLE_RATE_8000,
+        "PCMA");
 
     /* create media termination */
     termination = mrcp_engine_audio_termination_create(
@@ -248,14 +408,17 @@ static mrcp_engine_channel_t* demo_synth_engine_channel_create(mrcp_engine_t* en
 static apt_bool_t demo_synth_channel_destroy(mrcp_engine_channel_t* channel)
 {
     INFOLN("synthesizer channel destroy");
-    /* nothing to destroy */
+    demo_synth_channel_t* synth_channel = (demo_synth_channel_t*)channel->method_obj;
+    delete synth_channel->synthesizer;
+    synth_channel->synthesizer = NULL;
     return TRUE;
 }
 
 /** Open engine channel (asynchronous response MUST be sent)*/
 static apt_bool_t demo_synth_channel_open(mrcp_engine_channel_t* channel)
 {
-    INFOLN("demo_synth_channel_open");
+    string channelId(channel->id.buf, channel->id.length);
+    INFOLN("demo_synth_channel_open, channelId:%s", channelId.c_str());
     return demo_synth_msg_signal(DEMO_SYNTH_MSG_OPEN_CHANNEL, channel, NULL);
 }
 
@@ -264,7 +427,7 @@ static apt_bool_t demo_synth_channel_close(mrcp_engine_channel_t* channel)
 {
     string channelId(channel->id.buf, channel->id.length);
     INFOLN("demo_synth_channel_close, channelId:%s", channelId.c_str());
-    Synthesizer::Del(channelId);
+    /* the session is removed by the engine task, after the requests queued ahead of the close */
     return demo_synth_msg_signal(DEMO_SYNTH_MSG_CLOSE_CHANNEL, channel, NULL);
 }
 
@@ -276,37 +439,7 @@ static apt_bool_t demo_synth_channel_request_process(mrcp_engine_channel_t* chan
     string channelId(request->channel_id.session_id.buf, request->channel_id.session_id.length);
     string resource(request->channel_id.resource_name.buf, request->channel_id.resource_name.length);
     INFOLN("demo_synth_channel_request_process, msgType:%d method:%s channelId:%s resource:%s", msgType, method.c_str(), channelId.c_str(), resource.c_str());
-    
-    apt_bool_t needSendResponse = FALSE;
-    switch (request->start_line.method_id) {
-    case SYNTHESIZER_SET_PARAMS:
-        break;
-    case SYNTHESIZER_GET_PARAMS:
-        break;
-    case SYNTHESIZER_SPEAK:
-        needSendResponse = TRUE;
-        break;
-    case SYNTHESIZER_STOP:
-        break;
-    case SYNTHESIZER_PAUSE:
-        break;
-    case SYNTHESIZER_RESUME:
-        break;
-    case SYNTHESIZER_BARGE_IN_OCCURRED:
-        break;
-    case SYNTHESIZER_CONTROL:
-        break;
-    case SYNTHESIZER_DEFINE_LEXICON:
-        break;
-    default:
-        break;
-    }
-    if (needSendResponse == TRUE) {
-        mrcp_message_t* response = mrcp_response_create(request, request->pool);
-        response->start_line.request_state = MRCP_REQUEST_STATE_INPROGRESS;
-        /* send asynchronous response for not handled request */
-        mrcp_engine_channel_message_send(channel, response);
-    }
+    /* SPEAK is answered by the engine task, which owns the channel's active request */
     return demo_synth_msg_signal(DEMO_SYNTH_MSG_REQUEST_PROCESS, channel, request);
 }
 
@@ -341,23 +474,83 @@ static void sendError(demo_synth_channel_t* synth_channel)
     }
 }
 
-/** Process SPEAK request */
-static apt_bool_t demo_synth_channel_speak(mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_message_t* response)
+/** Prosody-Rate as speaking rate factor, 1.0 leaves it unchanged */
+static float demo_synth_prosody_rate(const mrcp_prosody_rate_t* rate)
 {
-    string channelId(channel->id.buf, channel->id.length);
-    demo_synth_channel_t* synth_channel = (demo_synth_channel_t*)channel->method_obj;
-    const mpf_codec_descriptor_t* descriptor = mrcp_engine_source_stream_codec_get(channel);
+    float factor = 1.0f;
+    if (rate->type == PROSODY_RATE_TYPE_LABEL) {
+        switch (rate->value.label) {
+        case PROSODY_RATE_XSLOW:
+            factor = 0.6f;
+            break;
+        case PROSODY_RATE_SLOW:
+            factor = 0.8f;
+            break;
+        case PROSODY_RATE_FAST:
+            factor = 1.25f;
+            break;
+        case PROSODY_RATE_XFAST:
+            factor = 1.6f;
+            break;
+        default:
+            break;
+        }
+    } else if (rate->type == PROSODY_RATE_TYPE_RELATIVE_CHANGE) {
+        if (rate->value.relative.type == PROSODY_RELATIVE_CHANGE_PERCENT) {
+            factor = 1.0f + rate->value.relative.value.percent / 100.0f;
+        } else {
+            factor = rate->value.relative.value.relative;
+        }
+    }
+    return std::min(2.0f, std::max(0.5f, factor));
+}
+
+/** Prosody-Volume as gain, 1.0 leaves it unchanged */
+static float demo_synth_prosody_volume(const mrcp_prosody_volume_t* volume)
+{
+    float gain = 1.0f;
+    if (volume->type == PROSODY_VOLUME_TYPE_LABEL) {
+        switch (volume->value.label) {
+        case PROSODY_VOLUME_SILENT:
+            gain = 0.0f;
+            break;
+        case PROSODY_VOLUME_XSOFT:
+            gain = 0.25f;
+            break;
+        case PROSODY_VOLUME_SOFT:
+            gain = 0.5f;
+            break;
+        case PROSODY_VOLUME_LOUD:
+            gain = 1.5f;
+            break;
+        case PROSODY_VOLUME_XLOUD:
+            gain = 2.0f;
+            break;
+        default:
+            break;
+        }
+    } else if (volume->type == PROSODY_VOLUME_TYPE_NUMERIC) {
+        /* 0 - 100, 100 is the recorded level */
+        gain = volume->value.numeric / 100.0f;
+    } else if (volume->type == PROSODY_VOLUME_TYPE_RELATIVE_CHANGE) {
+        if (volume->value.relative.type == PROSODY_RELATIVE_CHANGE_PERCENT) {
+            gain = 1.0f + volume->value.relative.value.percent / 100.0f;
+        } else {
+            gain = volume->value.relative.value.relative;
+        }
+    }
+    return std::min(4.0f, std::max(0.0f, gain));
+}
+
+/** Create synthesizer for SPEAK request, nothing is synthesized yet */
+static std::shared_ptr<Synthesizer> demo_synth_synthesizer_create(demo_synth_channel_t* synth_channel, mrcp_message_t* request, const mpf_codec_descriptor_t* descriptor)
+{
+    string channelId(synth_channel->channel->id.buf, synth_channel->channel->id.length);
     string body(request->body.buf, request->body.length);
     string voiceName;
-    
-    INFOLN("begin demo_synth_channel_speak text:%s channelId:%s", body.c_str(), channelId.c_str());
-    synth_channel->speak_request = request;
-    if (!descriptor) {
-        WARNLN("Failed to Get Codec Descriptor " APT_SIDRES_FMT, MRCP_MESSAGE_SIDRES(request));
-        sendError(synth_channel);
-        return TRUE;
-    }
-    
+    float rate = 1.0f;
+    float volume = 1.0f;
+
     mrcp_synth_header_t* req_synth_header;
     /* get synthesizer header */
     req_synth_header = (mrcp_synth_header_t*)mrcp_resource_header_get(request);
@@ -371,32 +564,84 @@ static apt_bool_t demo_synth_channel_speak(mrcp_engine_channel_t* channel, mrcp_
             voiceName = req_synth_header->voice_param.name.buf;
             INFOLN("Set Voice Name [%s], channelId:%s", voiceName.c_str(), channelId.c_str());
         }
+        /* rendered from the same synthesis, so the vendor and the prompt cache see one variant */
+        if (synth_channel->demo_engine->local_prosody == TRUE) {
+            if (mrcp_resource_header_property_check(request, SYNTHESIZER_HEADER_PROSODY_RATE) == TRUE) {
+                rate = demo_synth_prosody_rate(&req_synth_header->prosody_param.rate);
+            }
+            if (mrcp_resource_header_property_check(request, SYNTHESIZER_HEADER_PROSODY_VOLUME) == TRUE) {
+                volume = demo_synth_prosody_volume(&req_synth_header->prosody_param.volume);
+            }
+            INFOLN("Set Prosody, rate:%.2f volume:%.2f channelId:%s", rate, volume, channelId.c_str());
+        }
     }
 
-    string voiceId = Synthesizer::GetVoiceId(channelId);
-    if (!voiceId.empty()) {
-        WARNLN("channel is already synthesize, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
-        sendError(synth_channel);
-        return TRUE;
-    }
-    auto synthesizer = Synthesizer::Create(channelId);
+    auto synthesizer = Synthesizer::Create(channelId, synth_channel->demo_engine->session_table, synth_channel->demo_engine->start_worker, synth_channel->demo_engine->stop_worker);
     if (NULL == synthesizer) {
         ERRLN("create synthesizer error, channelId:%s", channelId.c_str());
-        sendError(synth_channel);
-        return TRUE;
+        return nullptr;
     }
     synthesizer->setSynthChannel(synth_channel);
     synthesizer->setVoiceName(voiceName);
     synthesizer->setText(body);
-    voiceId = synthesizer->getVoiceId();
-    int ret = synthesizer->init();
+    string codecName(descriptor->name.buf, descriptor->name.length);
+    synthesizer->setFormat(codecName, descriptor->sampling_rate);
+    synthesizer->setProsody(rate, volume);
+    INFOLN("create synthesizer, voiceName:%s codec:%s rate:%d text:%s channelId:%s voiceId:%s", voiceName.c_str(), codecName.c_str(), descriptor->sampling_rate, body.c_str(), channelId.c_str(), synthesizer->getVoiceId().c_str());
+    return synthesizer;
+}
+
+/** Map the channel to its session, a null one removes the session the channel maps to, in the context of the engine task */
+static void demo_synth_session_set(demo_synth_channel_t* synth_channel, std::shared_ptr<Synthesizer> synthesizer)
+{
+    string channelId(synth_channel->channel->id.buf, synth_channel->channel->id.length);
+    if (synthesizer) {
+        Synthesizer::Set(channelId, synthesizer);
+    } else {
+        Synthesizer::Del(channelId);
+    }
+    std::atomic_store(synth_channel->synthesizer, synthesizer);
+}
+
+/** Process SPEAK request */
+static apt_bool_t demo_synth_channel_speak(mrcp_engine_channel_t* channel, mrcp_message_t* request, mrcp_message_t* response)
+{
+    string channelId(channel->id.buf, channel->id.length);
+    demo_synth_channel_t* synth_channel = (demo_synth_channel_t*)channel->method_obj;
+    const mpf_codec_descriptor_t* descriptor = mrcp_engine_source_stream_codec_get(channel);
+    string body(request->body.buf, request->body.length);
+    
+    INFOLN("begin demo_synth_channel_speak text:%s channelId:%s", body.c_str(), channelId.c_str());
+    /* the server queues a SPEAK arriving while another one is in progress, so it never gets here */
+    if (synth_channel->speak_request) {
+        WARNLN("channel is already synthesize, channelId:%s", channelId.c_str());
+        response->start_line.status_code = MRCP_STATUS_CODE_METHOD_NOT_VALID;
+        response->start_line.request_state = MRCP_REQUEST_STATE_COMPLETE;
+        mrcp_engine_channel_message_send(channel, response);
+        return TRUE;
+    }
+    synth_channel->speak_request = request;
+    response->start_line.request_state = MRCP_REQUEST_STATE_INPROGRESS;
+    mrcp_engine_channel_message_send(channel, response);
+    if (!descriptor) {
+        WARNLN("Failed to Get Codec Descriptor " APT_SIDRES_FMT, MRCP_MESSAGE_SIDRES(request));
+        sendError(synth_channel);
+        return TRUE;
+    }
+    auto synthesizer = demo_synth_synthesizer_create(synth_channel, request, descriptor);
+    if (!synthesizer) {
+        sendError(synth_channel);
+        return TRUE;
+    }
+    string voiceId = synthesizer->getVoiceId();
+    int ret = synthesizer->start();
     if (ret < 0) {
         ERRLN("synthesizer init error, ret:%d channelId:%s voiceId:%s", ret, channelId.c_str(), voiceId.c_str());
         sendError(synth_channel);
         return TRUE;
     }
-    Synthesizer::Set(channelId, synthesizer);
-    INFOLN("end demo_synth_channel_speak voiceName:%s text:%s channelId:%s voiceId:%s", voiceName.c_str(), body.c_str(), channelId.c_str(), voiceId.c_str());
+    demo_synth_session_set(synth_channel, synthesizer);
+    INFOLN("end demo_synth_channel_speak, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
     return TRUE;
 }
 
@@ -405,8 +650,8 @@ static apt_bool_t demo_synth_channel_stop(mrcp_engine_channel_t* channel, mrcp_m
 {
     string channelId(channel->id.buf, channel->id.length);
     INFOLN("begin synthesizer stop, channelId:%s", channelId.c_str());
-    Synthesizer::Del(channelId);
     demo_synth_channel_t* synth_channel = (demo_synth_channel_t*)channel->method_obj;
+    demo_synth_session_set(synth_channel, nullptr);
     /* store the request, make sure there is no more activity and only then send the response */
     synth_channel->stop_response = response;
     synth_channel->speak_request = NULL;
@@ -561,25 +806,24 @@ static apt_bool_t demo_synth_stream_read(mpf_audio_stream_t* stream, mpf_frame_t
         return TRUE;
     }
     
-    string voiceId = Synthesizer::GetVoiceId(channelId);
-    if (voiceId.empty()) {
-        return TRUE;
-    }
-    auto synthesizer = Synthesizer::GetSynthesizer(voiceId);
+    auto synthesizer = std::atomic_load(synth_channel->synthesizer);
     if (!synthesizer) {
         return TRUE;
     }
     frame->type |= MEDIA_FRAME_TYPE_AUDIO;
     int ret = synthesizer->read((char*)frame->codec_frame.buffer, frame->codec_frame.size);
-    if (ret < 0) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        demo_synth_msg_signal(DEMO_SYNTH_MSG_SEND_COMPLETE, synth_channel->channel, NULL);
-        return TRUE;
+    if (ret < 0 && synthesizer->setCompleteSignaled()) {
+        /* last sample has been played out, complete only once */
+        string* voiceId = new string(synthesizer->getVoiceId());
+        if (!demo_synth_msg_signal(DEMO_SYNTH_MSG_SEND_COMPLETE, synth_channel->channel, NULL, voiceId)) {
+            ERRLN("signal speak complete failed, channelId:%s voiceId:%s", channelId.c_str(), voiceId->c_str());
+            delete voiceId;
+        }
     }
     return TRUE;
 }
 
-static apt_bool_t demo_synth_msg_signal(demo_synth_msg_type_e type, mrcp_engine_channel_t* channel, mrcp_message_t* request)
+static apt_bool_t demo_synth_msg_signal(demo_synth_msg_type_e type, mrcp_engine_channel_t* channel, mrcp_message_t* request, void* data)
 {
     apt_bool_t status = FALSE;
     demo_synth_channel_t* demo_channel = (demo_synth_channel_t*)channel->method_obj;
@@ -594,6 +838,7 @@ static apt_bool_t demo_synth_msg_signal(demo_synth_msg_type_e type, mrcp_engine_
         demo_msg->type = type;
         demo_msg->channel = channel;
         demo_msg->request = request;
+        demo_msg->data = data;
         status = apt_task_msg_signal(task, msg);
     }
     return status;
@@ -603,7 +848,17 @@ static void sendComplete(demo_synth_msg_t* demo_msg)
 {
     demo_synth_channel_t* synth_channel = (demo_synth_channel_t*)demo_msg->channel->method_obj;
     string channelId(synth_channel->channel->id.buf, synth_channel->channel->id.length);
-    Synthesizer::Del(channelId);
+    string* data = (string*)demo_msg->data;
+    string voiceId = *data;
+    demo_msg->data = NULL;
+    delete data;
+    /* stopped before the message got here, the channel may be playing the next request already */
+    if (Synthesizer::GetVoiceId(channelId) != voiceId) {
+        INFOLN("completed synthesizer is gone, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
+        return;
+    }
+    demo_synth_session_set(synth_channel, nullptr);
+    Synthesizer::RenewParked(channelId);
     if (!synth_channel->speak_request) {
         WARNLN("speak request is NULL when sendComplate, channelId:%s", channelId.c_str());
         return;
@@ -635,12 +890,20 @@ static void sendComplete(demo_synth_msg_t* demo_msg)
 static apt_bool_t demo_synth_msg_process(apt_task_t* task, apt_task_msg_t* msg)
 {
     demo_synth_msg_t* demo_msg = (demo_synth_msg_t*)msg->data;
+    demo_synth_channel_t* synth_channel = (demo_synth_channel_t*)demo_msg->channel->method_obj;
+    string channelId(synth_channel->channel->id.buf, synth_channel->channel->id.length);
     switch (demo_msg->type) {
     case DEMO_SYNTH_MSG_OPEN_CHANNEL:
+        (*synth_channel->demo_engine->channels)[channelId] = synth_channel;
+        Synthesizer::OpenParked(channelId);
         /* open channel and send asynch response */
         mrcp_engine_channel_open_respond(demo_msg->channel, TRUE);
         break;
     case DEMO_SYNTH_MSG_CLOSE_CHANNEL:
+        /* no request of the channel is left in the queue, so nothing maps a session to it again */
+        demo_synth_session_set(synth_channel, nullptr);
+        Synthesizer::DropParked(channelId);
+        synth_channel->demo_engine->channels->erase(channelId);
         /* close channel, make sure there is no activity and send asynch response */
         mrcp_engine_channel_close_respond(demo_msg->channel);
         break;
@@ -656,3 +919,65 @@ static apt_bool_t demo_synth_msg_process(apt_task_t* task, apt_task_msg_t* msg)
     }
     return TRUE;
 }
+
+/** Housekeeping, called in the context of the engine task */
+static void demo_synth_engine_timer_proc(apt_timer_t* timer, void* obj)
+{
+    demo_synth_engine_t* demo_engine = (demo_synth_engine_t*)obj;
+    demo_synth_reap(demo_engine);
+    Metrics::Flush(*demo_engine->metrics_file);
+    apt_timer_set(timer, demo_engine->timer_interval);
+}
+
+/** Tear down sessions past their age or idle limit, and orphans no channel request refers to */
+static void demo_synth_reap(demo_synth_engine_t* demo_engine)
+{
+    auto all = Synthesizer::GetAll();
+    sSessions = all.size();
+    for (auto& synthesizer : all) {
+        string channelId = synthesizer->getChannelId();
+        string voiceId = synthesizer->getVoiceId();
+        /* warm up sessions have no channel, the warmer ends them on its own timeout */
+        if (!synthesizer->getSynthChannel()) {
+            continue;
+        }
+        /* a channel is only touched while it is open and maps to the session */
+        demo_synth_channel_t* synth_channel = NULL;
+        auto it = demo_engine->channels->find(channelId);
+        if (it != demo_engine->channels->end() && Synthesizer::GetVoiceId(channelId) == voiceId) {
+            synth_channel = it->second;
+        }
+        bool active = synth_channel && synth_channel->speak_request;
+        int64_t age = synthesizer->getAge();
+        int64_t idle = synthesizer->getIdleTime();
+        const char* reason = NULL;
+        if (!active) {
+            reason = "orphan";
+            sReapedOrphan++;
+        } else if (demo_engine->session_max_age > 0 && age > demo_engine->session_max_age) {
+            reason = "age";
+            sReapedAge++;
+        } else if (demo_engine->session_max_idle > 0 && !synth_channel->paused && idle > demo_engine->session_max_idle) {
+            reason = "idle";
+            sReapedIdle++;
+        } else {
+            continue;
+        }
+        WARNLN("reap synthesizer, reason:%s age:%lld idle:%lld channelId:%s voiceId:%s", reason, (long long)age, (long long)idle, channelId.c_str(), voiceId.c_str());
+        Synthesizer::Reap(synthesizer);
+        if (synth_channel) {
+            std::atomic_store(synth_channel->synthesizer, std::shared_ptr<Synthesizer>());
+        }
+        if (active) {
+            sendError(synth_channel);
+        }
+    }
+}
+
+/** Rejects sessions queued for admission past their deadline, called in the context of the engine task */
+static void demo_synth_admission_timer_proc(apt_timer_t* timer, void* obj)
+{
+    Admission::Expire();
+    Synthesizer::ExpireParked();
+    apt_timer_set(timer, SYNTH_ADMISSION_TIMER_INTERVAL);
+}
@@ -1,11 +1,45 @@
 #include "Synthesizer.h"
 #include "SynthEngine.h"
 #include "TencentSynthesizer.h"
+#include "AudioFile.h"
+#include "SsmlParser.h"
+#include "TextSplitter.h"
+#include "BufferBudget.h"
+#include "metrics/Metrics.h"
+#include "dsp/G711.h"
+#include "dsp/ImaAdpcm.h"
+#include <sstream>
+#include <chrono>
+#include <cmath>
 #include <mutex>
 
+#define DEFAULT_WATCHDOG_TIMEOUT 10000
+#define DEFAULT_BUFFER_TIME 30000
+#define DEFAULT_SEGMENT_LENGTH 300
+#define DEFAULT_STAGE_SIZE 4096
+/** shortest ring a session gets when the buffer budget is exhausted (ms) */
+#define MIN_BUFFER_TIME 2000
+#define DEFAULT_COALESCE_MAX_TIME 600000
+#define DEFAULT_SLOT_LINGER 2000
+
+static std::atomic<int64_t>& sBackpressure = Metrics::Get("synth_backpressure_total");
+static std::atomic<int64_t>& sCoalesced = Metrics::Get("synth_coalesced_total");
+static std::atomic<int64_t>& sSlotReused = Metrics::Get("synth_slot_reused_total");
+static std::atomic<int64_t>& sSlotParked = Metrics::Get("synth_slot_parked");
+
+/** run job on worker, or in the caller for a session created without engine workers */
+static void Post(BackgroundWorker* worker, BackgroundWorker::Job job)
+{
+    if (worker) {
+        worker->post(std::move(job));
+    } else {
+        job();
+    }
+}
+
 string Synthesizer::sConfigFile = "conf/config.ini";
 
-std::shared_ptr<Synthesizer> Synthesizer::Create(string channelId)
+std::shared_ptr<Synthesizer> Synthesizer::Create(string channelId, SessionTable* table, BackgroundWorker* startWorker, BackgroundWorker* stopWorker)
 {
     string type;
     auto ini = std::make_shared<IniParser>();
@@ -17,15 +51,25 @@ std::shared_ptr<Synthesizer> Synthesizer::Create(string channelId)
         synthesizer->mChannelId = channelId;
         synthesizer->mSynthesizerType = TENCENT;
         synthesizer->mIniParser = ini;
+        synthesizer->mBackend = type + "_tts";
         // gen unique voice_id
         boost::uuids::uuid a_uuid = boost::uuids::random_generator()();
         synthesizer->mVoiceId = boost::uuids::to_string(a_uuid);
+        synthesizer->mSlot = table->acquire(channelId, synthesizer->mVoiceId, synthesizer->mBackend);
+        synthesizer->mStartWorker = startWorker;
+        synthesizer->mStopWorker = stopWorker;
         return synthesizer;
     }
     INFOLN("synthesizer type is not support, type:%s channelId:%s", type.c_str(), channelId.c_str());
     return nullptr;
 }
 
+Synthesizer::~Synthesizer()
+{
+    BufferBudget::Release(mBufferBytes + mStagedBytes);
+    SessionTable::Release(mSlot);
+}
+
 void Synthesizer::setSynthChannel(demo_synth_channel_t* val)
 {
     mSynthChannel = val;
@@ -41,23 +85,559 @@ void Synthesizer::setText(string val)
     mText = val;
 }
 
+void Synthesizer::setFormat(const string& codecName, int sampleRate)
+{
+    if (codecName == "PCMU") {
+        mEncoding = PCMU;
+    } else if (codecName == "PCMA") {
+        mEncoding = PCMA;
+    } else {
+        mEncoding = LPCM;
+    }
+    if (sampleRate > 0) {
+        mSampleRate = sampleRate;
+    }
+}
+
+void Synthesizer::setProsody(float rate, float volume)
+{
+    mProsodyRate = rate;
+    mProsodyVolume = volume;
+}
+
 string Synthesizer::getVoiceId()
 {
     return mVoiceId;
 }
 
+string Synthesizer::getChannelId()
+{
+    return mChannelId;
+}
+
+demo_synth_channel_t* Synthesizer::getSynthChannel()
+{
+    return mSynthChannel;
+}
+
+int64_t Synthesizer::getAge()
+{
+    return NowMs() - mCreated;
+}
+
+int64_t Synthesizer::getIdleTime()
+{
+    return NowMs() - std::max(mCreated, std::max(mLastActivity.load(), mLastRead.load(std::memory_order_relaxed)));
+}
+
+void Synthesizer::setCacheOnly(bool val)
+{
+    mIsCacheOnly = val;
+}
+
+void Synthesizer::cancel()
+{
+    mIsCancel = true;
+    mSlot->setState(SessionTable::STOPPED);
+    wakePush();
+}
+
+void Synthesizer::setPriority(Admission::Priority val)
+{
+    mPriority = val;
+}
+
+bool Synthesizer::isEnd()
+{
+    return mIsEnd;
+}
+
+string Synthesizer::getCacheKey()
+{
+    return mCacheKey;
+}
+
 void Synthesizer::loadConfig()
 {
     string type;
     mIniParser->get("generic", "type", type);
-    mIniParser->get(type, "appid", mAppId);
-    mIniParser->get(type, "secretid", mSecretId);
-    mIniParser->get(type, "secretkey", mSecretKey);
+    mIniParser->get("generic", "synth_watchdog_timeout", mWatchdogTimeout);
+    if (mWatchdogTimeout <= 0) {
+        mWatchdogTimeout = DEFAULT_WATCHDOG_TIMEOUT;
+    }
+    mIniParser->get("generic", "synth_buffer_time", mBufferTime);
+    if (mBufferTime <= 0) {
+        mBufferTime = DEFAULT_BUFFER_TIME;
+    }
+    mIniParser->get("generic", "synth_segment_length", mSegmentLength);
+    if (mSegmentLength <= 0) {
+        mSegmentLength = DEFAULT_SEGMENT_LENGTH;
+    }
+    mIniParser->get("generic", "synth_audio_dir", mAudioDir);
+    int stageSize = 0;
+    mIniParser->get("generic", "synth_stage_size", stageSize);
+    mStageSize = (size_t)(stageSize > 0 ? stageSize : DEFAULT_STAGE_SIZE) * 1024;
+    mIniParser->get("generic", "synth_spill_dir", mSpillDir);
+    int coalesce = 1;
+    mIniParser->get("generic", "synth_coalesce", coalesce);
+    mIsCoalesce = coalesce != 0;
+    mIniParser->get("generic", "synth_coalesce_max_time", mCoalesceMaxTime);
+    if (mCoalesceMaxTime <= 0) {
+        mCoalesceMaxTime = DEFAULT_COALESCE_MAX_TIME;
+    }
+    mSlotLinger = DEFAULT_SLOT_LINGER;
+    mIniParser->get("generic", "synth_slot_linger", mSlotLinger);
+    // ask the vendor for the session rate when it has it, otherwise the nearest rate above it
+    string rates;
+    mIniParser->get(type, "sample_rates", rates);
+    std::istringstream iss(rates);
+    string item;
+    int above = 0;
+    int highest = 0;
+    mVendorSampleRate = 0;
+    while (std::getline(iss, item, ',')) {
+        int rate = atoi(item.c_str());
+        if (rate == mSampleRate) {
+            mVendorSampleRate = rate;
+        }
+        if (rate > mSampleRate && (above == 0 || rate < above)) {
+            above = rate;
+        }
+        highest = std::max(highest, rate);
+    }
+    if (mVendorSampleRate == 0) {
+        mVendorSampleRate = above > 0 ? above : (highest > 0 ? highest : mSampleRate);
+    }
+}
+
+int Synthesizer::start()
+{
+    loadConfig();
+    if (fabsf(mProsodyRate - 1.0f) > 0.01f) {
+        mStretch.reset(new TimeStretch(mSampleRate, mProsodyRate));
+    }
+    mCacheKey = PromptCache::MakeKey(mText, mVoiceName, mSampleRate, mSpeed, mVolume, mCodec);
+    // warming a prompt is not a play of it, it stays out of the hit and miss counters
+    if (mIsCacheOnly && PromptCache::Contains(mCacheKey)) {
+        INFOLN("prompt already cached, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+        mIsEnd = true;
+        return 0;
+    }
+    auto cached = mIsCacheOnly ? nullptr : PromptCache::Get(mCacheKey);
+    if (cached) {
+        INFOLN("play synthesizer from prompt cache, samples:%zu compressed:%d channelId:%s voiceId:%s", cached->samples, cached->isCompressed(), mChannelId.c_str(), mVoiceId.c_str());
+        if (cached->isCompressed()) {
+            addClipPart(cached);
+        } else {
+            addAudioPart(cached->pcm.data(), cached->samples, cached);
+        }
+        mIsEnd = true;
+        mSlot->setState(SessionTable::RUNNING);
+        return 0;
+    }
+    if (joinInflight()) {
+        mSlot->setState(SessionTable::RUNNING);
+        return 0;
+    }
+    if (!buildParts()) {
+        return -1;
+    }
+    // only pure vendor output is cached and shared, recordings are already cheap to play
+    bool isPlain = true;
+    for (auto& part : mParts) {
+        if (part.type != Part::TEXT) {
+            isPlain = false;
+        }
+    }
+    mIsCacheFill = PromptCache::IsEnabled() && isPlain;
+    if (mIsCacheOnly && !mIsCacheFill) {
+        return -1;
+    }
+    setSegmentCount(mSegments.size());
+    if (mSegments.empty()) {
+        INFOLN("nothing to synthesize, parts:%zu channelId:%s voiceId:%s", mParts.size(), mChannelId.c_str(), mVoiceId.c_str());
+        mIsEnd = true;
+        mSlot->setState(SessionTable::RUNNING);
+        return 0;
+    }
+    initBuffer();
+    if (mVendorSampleRate != mSampleRate) {
+        INFOLN("resample synthesizer, from:%d to:%d channelId:%s voiceId:%s", mVendorSampleRate, mSampleRate, mChannelId.c_str(), mVoiceId.c_str());
+        mResampler.reset(new Resampler(mVendorSampleRate, mSampleRate));
+    }
+    if (mIsCoalesce && !mIsCacheOnly && isPlain) {
+        leadInflight();
+    }
+    // the vendor session needs a slot of the account, the channel plays silence while waiting for one
+    std::weak_ptr<Synthesizer> weak = shared_from_this();
+    Admission::Ticket ticket;
+    auto admission = Admission::ADMITTED;
+    if (mPriority == Admission::LIVE) {
+        ticket = Unpark(mChannelId);
+    }
+    if (ticket) {
+        sSlotReused++;
+        INFOLN("synthesizer reuse the channel's slot, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+    } else {
+        admission = Admission::Acquire(mBackend, mPriority, ticket, [weak](Admission::Ticket ticket) {
+            auto self = weak.lock();
+            if (self) {
+                self->onAdmitted(ticket);
+            }
+        }, &mWaitId);
+    }
+    if (admission == Admission::REJECTED) {
+        ERRLN("synthesizer admission rejected, priority:%d channelId:%s voiceId:%s", mPriority, mChannelId.c_str(), mVoiceId.c_str());
+        leaveInflight();
+        return -1;
+    }
+    if (admission == Admission::QUEUED) {
+        INFOLN("synthesizer wait for admission, priority:%d channelId:%s voiceId:%s", mPriority, mChannelId.c_str(), mVoiceId.c_str());
+        mSlot->setState(SessionTable::QUEUED);
+        touch();
+        return 0;
+    }
+    setTicket(ticket);
+    mSlot->setState(SessionTable::STARTING);
+    int ret = init();
+    if (ret < 0) {
+        leaveInflight();
+        return ret;
+    }
+    mSlot->setState(SessionTable::RUNNING);
+    return ret;
+}
+
+// called from the thread which freed the slot, the vendor session is opened on the background worker
+void Synthesizer::onAdmitted(Admission::Ticket ticket)
+{
+    if (!ticket) {
+        WARNLN("synthesizer admission timeout, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+        failSegments();
+        return;
+    }
+    auto self = shared_from_this();
+    // not behind the teardown of hung up sessions, a burst of vendor Stop calls would hold up admission
+    Post(mStartWorker, [self, ticket] {
+        // stop() runs on the stop worker, it waits for the init() under mWorkerMutex
+        std::lock_guard<std::mutex> l(self->mWorkerMutex);
+        // released meanwhile
+        if (self->mIsStop || (self->mIsCancel && !self->mShared)) {
+            return;
+        }
+        self->setTicket(ticket);
+        self->touch();
+        self->mSlot->setState(SessionTable::STARTING);
+        INFOLN("synthesizer admitted, channelId:%s voiceId:%s", self->mChannelId.c_str(), self->mVoiceId.c_str());
+        if (self->init() < 0) {
+            ERRLN("synthesizer init error, channelId:%s voiceId:%s", self->mChannelId.c_str(), self->mVoiceId.c_str());
+            self->failSegments();
+            return;
+        }
+        self->mSlot->setState(SessionTable::RUNNING);
+    });
+}
+
+void Synthesizer::setTicket(Admission::Ticket ticket)
+{
+    // credential of the account the session was admitted to, read by init()
+    mAppId = ticket->credential().appId;
+    mSecretId = ticket->credential().secretId;
+    mSecretKey = ticket->credential().secretKey;
+    INFOLN("synthesizer account, account:%s channelId:%s voiceId:%s", ticket->credential().name.c_str(), mChannelId.c_str(), mVoiceId.c_str());
+    std::atomic_store(&mTicket, ticket);
+}
+
+void Synthesizer::onVendorError(int code)
+{
+    auto ticket = std::atomic_load(&mTicket);
+    auto action = Admission::OnError(ticket, code);
+    if (action == Admission::SUSPENDED) {
+        WARNLN("synthesizer suspend account, account:%s code:%d channelId:%s voiceId:%s", ticket->credential().name.c_str(), code, mChannelId.c_str(), mVoiceId.c_str());
+    } else if (action == Admission::KEPT) {
+        WARNLN("synthesizer quota error on the last account, keep it, account:%s code:%d channelId:%s voiceId:%s", ticket->credential().name.c_str(), code, mChannelId.c_str(), mVoiceId.c_str());
+    }
+}
+
+void Synthesizer::leaveAdmission()
+{
+    Admission::Cancel(mBackend, mWaitId);
+    park(std::atomic_exchange(&mTicket, Admission::Ticket()));
+}
+
+void Synthesizer::park(Admission::Ticket ticket)
+{
+    if (!ticket || mPriority != Admission::LIVE || mSlotLinger <= 0 || mChannelId.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> l(sParkedMutex);
+    auto it = sParked.find(mChannelId);
+    // a closed channel keeps nothing, nor does a backend other sessions are waiting for
+    if (it == sParked.end() || Admission::HasWaiters(mBackend)) {
+        return;
+    }
+    Parked& parked = it->second;
+    if (!parked.ticket) {
+        sSlotParked++;
+    }
+    // a slot parked before is given back when the swapped out ticket goes, after the lock
+    parked.ticket.swap(ticket);
+    parked.backend = mBackend;
+    parked.until = NowMs() + mSlotLinger;
+    parked.linger = mSlotLinger;
+}
+
+Admission::Ticket Synthesizer::Unpark(const string& channelId)
+{
+    Admission::Ticket ticket;
+    {
+        std::lock_guard<std::mutex> l(sParkedMutex);
+        auto it = sParked.find(channelId);
+        if (it == sParked.end() || !it->second.ticket) {
+            return ticket;
+        }
+        ticket.swap(it->second.ticket);
+        sSlotParked--;
+    }
+    if (!Admission::IsUsable(ticket)) {
+        INFOLN("drop the channel's slot, its account left rotation, channelId:%s", channelId.c_str());
+        ticket.reset();
+    }
+    return ticket;
+}
+
+void Synthesizer::ExpireParked()
+{
+    std::vector<Admission::Ticket> expired;
+    {
+        std::lock_guard<std::mutex> l(sParkedMutex);
+        int64_t now = NowMs();
+        for (auto& entry : sParked) {
+            Parked& parked = entry.second;
+            // past the linger time, or wanted by a session waiting for the backend
+            if (!parked.ticket || (parked.until > now && !Admission::HasWaiters(parked.backend))) {
+                continue;
+            }
+            expired.push_back(std::move(parked.ticket));
+            parked.ticket.reset();
+            sSlotParked--;
+        }
+    }
+    // released here, a slot given back may admit a waiter and run its callback
+    expired.clear();
+}
+
+void Synthesizer::RenewParked(const string& channelId)
+{
+    std::lock_guard<std::mutex> l(sParkedMutex);
+    auto it = sParked.find(channelId);
+    if (it != sParked.end() && it->second.ticket) {
+        it->second.until = NowMs() + it->second.linger;
+    }
+}
+
+void Synthesizer::OpenParked(const string& channelId)
+{
+    std::lock_guard<std::mutex> l(sParkedMutex);
+    sParked[channelId];
+}
+
+void Synthesizer::DropParked(const string& channelId)
+{
+    Admission::Ticket ticket;
+    std::lock_guard<std::mutex> l(sParkedMutex);
+    auto it = sParked.find(channelId);
+    if (it == sParked.end()) {
+        return;
+    }
+    ticket.swap(it->second.ticket);
+    sParked.erase(it);
+    if (ticket) {
+        sSlotParked--;
+    }
+}
+
+void Synthesizer::failSegments()
+{
+    for (size_t i = 0; i < mSegments.size(); i++) {
+        onSynthesisFail(i);
+    }
+}
+
+// another channel synthesizes the same prompt right now, read its audio instead of opening a vendor session
+bool Synthesizer::joinInflight()
+{
+    if (!mIsCoalesce || mIsCacheOnly) {
+        return false;
+    }
+    std::shared_ptr<Synthesizer> leader;
+    {
+        std::lock_guard<std::mutex> l(sInflightMutex);
+        auto it = sInflight.find(mCacheKey);
+        if (it == sInflight.end()) {
+            return false;
+        }
+        leader = it->second.lock();
+    }
+    if (!leader || !leader->mShared) {
+        return false;
+    }
+    mShared = leader->mShared;
+    mSharedLeader = leader;
+    mShared->attach();
+    Part part;
+    part.type = Part::SHARED;
+    mParts.push_back(part);
+    touch();
+    sCoalesced++;
+    INFOLN("join synthesizer in flight, samples:%zu channelId:%s voiceId:%s leaderVoiceId:%s", mShared->size(), mChannelId.c_str(), mVoiceId.c_str(), leader->mVoiceId.c_str());
+    return true;
+}
+
+void Synthesizer::leadInflight()
+{
+    mShared = std::make_shared<SharedAudio>((size_t)mSampleRate * mCoalesceMaxTime / 1000);
+    mShared->attach();
+    std::lock_guard<std::mutex> l(sInflightMutex);
+    sInflight[mCacheKey] = shared_from_this();
+}
+
+void Synthesizer::leaveInflight()
+{
+    std::lock_guard<std::mutex> l(sInflightMutex);
+    auto it = sInflight.find(mCacheKey);
+    if (it == sInflight.end()) {
+        return;
+    }
+    auto leader = it->second.lock();
+    if (!leader || leader.get() == this) {
+        sInflight.erase(it);
+    }
+}
+
+bool Synthesizer::buildParts()
+{
+    if (!SsmlParser::IsSsml(mText)) {
+        addTextPart(mText);
+    } else {
+        std::vector<SsmlParser::Item> items;
+        if (!SsmlParser::Parse(mText, items)) {
+            WARNLN("parse ssml failed, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+            return false;
+        }
+        for (auto& item : items) {
+            if (item.type == SsmlParser::Item::TEXT) {
+                addTextPart(item.text);
+            } else if (item.type == SsmlParser::Item::BREAK) {
+                addSilencePart(item.time);
+            } else {
+                auto file = AudioFile::Open(mAudioDir, item.src, mSampleRate);
+                if (file) {
+                    addAudioPart(file->data(), file->samples(), file);
+                } else {
+                    WARNLN("audio can not be played, use fallback text, src:%s text:%s channelId:%s", item.src.c_str(), item.text.c_str(), mChannelId.c_str());
+                    addTextPart(item.text);
+                }
+            }
+        }
+    }
+    mPartEnd.reset(new std::atomic<int64_t>[mParts.size()]);
+    for (size_t i = 0; i < mParts.size(); i++) {
+        mPartEnd[i] = -1;
+    }
+    return true;
+}
+
+void Synthesizer::addTextPart(const string& text)
+{
+    auto segments = TextSplitter::Split(text, mSegmentLength);
+    if (segments.empty()) {
+        return;
+    }
+    Part part;
+    part.type = Part::TEXT;
+    for (auto& segment : segments) {
+        mSegments.push_back(segment);
+        mSegmentPart.push_back(mParts.size());
+    }
+    part.lastSegment = mSegments.size() - 1;
+    mParts.push_back(part);
+}
+
+void Synthesizer::addAudioPart(const int16_t* data, size_t samples, std::shared_ptr<const void> holder)
+{
+    Part part;
+    part.type = Part::AUDIO;
+    part.data = data;
+    part.samples = samples;
+    part.holder = holder;
+    mParts.push_back(part);
+}
+
+void Synthesizer::addClipPart(PromptCache::Audio clip)
+{
+    Part part;
+    part.type = Part::CLIP;
+    part.samples = clip->samples;
+    part.clip = clip;
+    mParts.push_back(part);
+}
+
+void Synthesizer::addSilencePart(int time)
+{
+    Part part;
+    part.type = Part::SILENCE;
+    part.samples = (size_t)mSampleRate * time / 1000;
+    if (part.samples > 0) {
+        mParts.push_back(part);
+    }
+}
+
+void Synthesizer::initBuffer()
+{
+    size_t samples = (size_t)mSampleRate * mBufferTime / 1000;
+    size_t minSamples = std::min(samples, (size_t)mSampleRate * MIN_BUFFER_TIME / 1000);
+    // the ring rounds up to a power of two, budget what it really allocates
+    size_t capacity = 1;
+    while (capacity < samples) {
+        capacity <<= 1;
+    }
+    // under memory pressure settle for a shorter ring, the vendor is just held back sooner
+    bool isAcquired = BufferBudget::TryAcquire(capacity * sizeof(int16_t));
+    while (!isAcquired && capacity / 2 >= minSamples) {
+        capacity /= 2;
+        isAcquired = BufferBudget::TryAcquire(capacity * sizeof(int16_t));
+    }
+    if (!isAcquired) {
+        WARNLN("synthesizer buffer budget exhausted, samples:%zu used:%zu channelId:%s", capacity, BufferBudget::Used(), mChannelId.c_str());
+        BufferBudget::Acquire(capacity * sizeof(int16_t));
+    }
+    mBufferBytes = capacity * sizeof(int16_t);
+    mAudioData.reset(new SpscRingBuffer<int16_t>(capacity));
+}
+
+int64_t Synthesizer::NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Synthesizer::touch()
+{
+    mLastActivity = NowMs();
+}
+
+string Synthesizer::GetConfigFile()
+{
+    return sConfigFile;
 }
 
 std::mutex Synthesizer::sMutex;
 map<string, string> Synthesizer::sChannelIdMap;
 map<string, std::shared_ptr<Synthesizer>> Synthesizer::sMap;
+std::mutex Synthesizer::sInflightMutex;
+map<string, std::weak_ptr<Synthesizer>> Synthesizer::sInflight;
+std::mutex Synthesizer::sParkedMutex;
+map<string, Synthesizer::Parked> Synthesizer::sParked;
 
 string Synthesizer::GetVoiceId(string channelId)
 {
@@ -99,11 +679,67 @@ void Synthesizer::Del(string channelId)
         Synthesizer::Del(channelId, voiceId);
         return;
     }
-    synthesizer->stop();
     Synthesizer::Del(channelId, voiceId);
+    Synthesizer::Release(synthesizer);
     INFOLN("delete synthesizer, channelId:%s voiceId:%s", channelId.c_str(), voiceId.c_str());
 }
 
+void Synthesizer::Release(std::shared_ptr<Synthesizer> synthesizer)
+{
+    synthesizer->cancel();
+    auto shared = synthesizer->mShared;
+    if (shared) {
+        int readers = shared->detach();
+        auto leader = synthesizer->mSharedLeader;
+        if (!leader) {
+            if (readers > 0) {
+                // other channels still read this synthesis, the followers keep it alive
+                INFOLN("keep synthesizing for coalesced channels, readers:%d channelId:%s voiceId:%s", readers, synthesizer->mChannelId.c_str(), synthesizer->mVoiceId.c_str());
+                return;
+            }
+            synthesizer->leaveInflight();
+        } else if (readers == 0 && leader->mIsCancel) {
+            // last reader of a leader whose own channel is gone
+            leader->leaveInflight();
+            Post(leader->mStopWorker, [leader] {
+                std::lock_guard<std::mutex> l(leader->mWorkerMutex);
+                leader->stop();
+            });
+        }
+    }
+    // vendor Stop may block for a network round trip, the worker also holds the last reference
+    // so the destructor never runs inside a vendor callback
+    Post(synthesizer->mStopWorker, [synthesizer] {
+        std::lock_guard<std::mutex> l(synthesizer->mWorkerMutex);
+        synthesizer->stop();
+    });
+}
+
+std::vector<std::shared_ptr<Synthesizer>> Synthesizer::GetAll()
+{
+    std::vector<std::shared_ptr<Synthesizer>> all;
+    std::lock_guard<std::mutex> l(sMutex);
+    all.reserve(sMap.size());
+    for (auto& entry : sMap) {
+        all.push_back(entry.second);
+    }
+    return all;
+}
+
+void Synthesizer::Reap(std::shared_ptr<Synthesizer> synthesizer)
+{
+    {
+        std::lock_guard<std::mutex> l(sMutex);
+        sMap.erase(synthesizer->mVoiceId);
+        // the channel may be mapped to a later session already
+        auto it = sChannelIdMap.find(synthesizer->mChannelId);
+        if (it != sChannelIdMap.end() && it->second == synthesizer->mVoiceId) {
+            sChannelIdMap.erase(it);
+        }
+    }
+    Synthesizer::Release(synthesizer);
+}
+
 void Synthesizer::Set(string channelId, std::shared_ptr<Synthesizer> val)
 {
     std::lock_guard<std::mutex> l(sMutex);
@@ -113,39 +749,408 @@ void Synthesizer::Set(string channelId, std::shared_ptr<Synthesizer> val)
     sMap.emplace(val->mVoiceId, val);
 }
 
+// called from the media thread, must never block
 int Synthesizer::read(char* buff, int size)
 {
-    memset(buff, 0, size);
-    std::unique_lock<std::mutex> l(mMutex);
-    mCv.wait(l, [this, size] { return mIsStop || mIsEnd || mAudioData.size() >= size; });
-    if (mAudioData.size() < size) {
-        INFOLN("audio data is not enough, audio_data:%d size:%d voiceId:%s", mAudioData.size(), size, mVoiceId.c_str());
-        size = mAudioData.size();
+    mLastRead.store(NowMs(), std::memory_order_relaxed);
+    size_t samples = size / sizeof(int16_t);
+    int16_t* pcm = (int16_t*)buff;
+    if (mEncoding != LPCM) {
+        // G.711 has one byte per sample, render pcm aside and encode it into the frame
+        samples = size;
+        if (mFrame.size() < samples) {
+            mFrame.resize(samples);
+        }
+        pcm = mFrame.data();
     }
-    // INFOLN("audio data size, audio_data:%d size:%d voiceId:%s", mAudioData.size(), size, mVoiceId.c_str());
-    if (size <= 0) {
+    int ret = mStretch ? readStretched(pcm, samples) : readSamples(pcm, samples);
+    mSlot->addOut(size);
+    mSlot->setDepth(mAudioData ? mAudioData->size() * sizeof(int16_t) : 0);
+    if (mProsodyVolume != 1.0f) {
+        TimeStretch::ApplyGain(pcm, samples, mProsodyVolume);
+    }
+    if (mEncoding == LPCM) {
+        return ret;
+    }
+    if (mEncoding == PCMU) {
+        G711::EncodeUlaw(mFrame.data(), (uint8_t*)buff, size);
+    } else {
+        G711::EncodeAlaw(mFrame.data(), (uint8_t*)buff, size);
+    }
+    return ret;
+}
+
+// the source is pulled faster or slower than real time, underruns are played as silence unstretched
+int Synthesizer::readStretched(int16_t* out, size_t samples)
+{
+    if (mIsStop || mIsCancel) {
+        return readSamples(out, samples);
+    }
+    if (mStretchIn.size() < samples) {
+        mStretchIn.resize(samples);
+    }
+    while (mStretch->available() < samples && !mIsStretchEnd) {
+        size_t filled = 0;
+        if (readSamples(mStretchIn.data(), samples, &filled) < 0) {
+            mIsStretchEnd = true;
+            mStretch->flush();
+            break;
+        }
+        if (filled == 0) {
+            break;
+        }
+        mStretch->push(mStretchIn.data(), filled);
+    }
+    size_t n = mStretch->pop(out, samples);
+    memset(out + n, 0, (samples - n) * sizeof(int16_t));
+    if (n == 0 && mIsStretchEnd) {
         return -1;
     }
-    std::vector<char> vec(mAudioData.begin(), mAudioData.begin() + size);
-    memcpy(buff, vec.data(), size);
-    mAudioData.erase(mAudioData.begin(), mAudioData.begin() + size);
     return 0;
 }
 
-void Synthesizer::pushData(char* data, int len)
+int Synthesizer::readSamples(int16_t* out, size_t samples, size_t* filledOut)
 {
-    std::unique_lock<std::mutex> l(mMutex);
-    if (mIsStop || mIsEnd) {
+    if (filledOut) {
+        *filledOut = 0;
+    }
+    if (mIsStop || mIsCancel) {
+        if (mAudioData) {
+            mAudioData->clear();
+        }
+        wakePush();
+        memset(out, 0, samples * sizeof(int16_t));
+        return -1;
+    }
+    size_t filled = 0;
+    while (filled < samples && mPart < mParts.size()) {
+        const Part& part = mParts[mPart];
+        size_t want = samples - filled;
+        if (part.type == Part::AUDIO || part.type == Part::SILENCE) {
+            size_t n = std::min(want, part.samples - mPartPos);
+            if (part.type == Part::AUDIO) {
+                memcpy(out + filled, part.data + mPartPos, n * sizeof(int16_t));
+            } else {
+                memset(out + filled, 0, n * sizeof(int16_t));
+            }
+            filled += n;
+            mPartPos += n;
+            if (mPartPos == part.samples) {
+                mPart++;
+                mPartPos = 0;
+            }
+            continue;
+        }
+        if (part.type == Part::CLIP) {
+            size_t block = mPartPos / ImaAdpcm::BLOCK_SAMPLES;
+            size_t offset = mPartPos % ImaAdpcm::BLOCK_SAMPLES;
+            if (block != mBlockIndex) {
+                mBlock.resize(ImaAdpcm::BLOCK_SAMPLES);
+                PromptCache::Decode(*part.clip, block, mBlock.data());
+                mBlockIndex = block;
+            }
+            size_t n = std::min(want, std::min(part.samples - mPartPos, (size_t)ImaAdpcm::BLOCK_SAMPLES - offset));
+            memcpy(out + filled, mBlock.data() + offset, n * sizeof(int16_t));
+            filled += n;
+            mPartPos += n;
+            if (mPartPos == part.samples) {
+                mPart++;
+                mPartPos = 0;
+                mBlockIndex = SIZE_MAX;
+            }
+            continue;
+        }
+        if (part.type == Part::SHARED) {
+            // load the end flag first, so the tail appended before it is never missed
+            bool isEnd = mShared->isEnd() || mIsEnd;
+            if (!isEnd && mShared->size() - mPartPos < want && filled == 0) {
+                break;
+            }
+            size_t n = mShared->read(mPartPos, out + filled, want);
+            mPartPos += n;
+            filled += n;
+            if (n > 0) {
+                touch();
+            }
+            if (n < want) {
+                if (!isEnd) {
+                    break;
+                }
+                mPart++;
+                mPartPos = 0;
+            }
+            continue;
+        }
+        // count the ring before loading the end mark: samples of the next part are pushed after the
+        // mark is set, so while it is unset every counted sample belongs to this part
+        size_t avail = mAudioData->size();
+        int64_t end = mPartEnd[mPart].load(std::memory_order_acquire);
+        if (end < 0 && mIsEnd) {
+            // ended by the watchdog, play what arrived and move on
+            end = mPopped + avail;
+        }
+        if (end >= 0) {
+            size_t left = (size_t)end > mPopped ? (size_t)end - mPopped : 0;
+            size_t n = left > 0 ? mAudioData->pop(out + filled, std::min(want, left)) : 0;
+            mPopped += n;
+            filled += n;
+            if (n == 0 || mPopped >= (size_t)end) {
+                mPart++;
+            }
+            continue;
+        }
+        // still synthesizing, wait for a whole frame rather than play a partial one
+        if (filled == 0 && avail < want) {
+            break;
+        }
+        size_t n = mAudioData->pop(out + filled, std::min(want, avail));
+        mPopped += n;
+        filled += n;
+        break;
+    }
+    if (filled > 0) {
+        wakePush();
+        memset(out + filled, 0, (samples - filled) * sizeof(int16_t));
+        if (filledOut) {
+            *filledOut = filled;
+        }
+        return 0;
+    }
+    memset(out, 0, samples * sizeof(int16_t));
+    if (mPart >= mParts.size()) {
+        INFOLN("synthesizer play out, underrun:%u channelId:%s voiceId:%s", mUnderrunCount, mChannelId.c_str(), mVoiceId.c_str());
+        return -1;
+    }
+    mUnderrunCount++;
+    if (NowMs() - mLastActivity > mWatchdogTimeout) {
+        WARNLN("synthesizer watchdog timeout, timeout:%d channelId:%s voiceId:%s", mWatchdogTimeout, mChannelId.c_str(), mVoiceId.c_str());
+        mIsEnd = true;
+    }
+    return 0;
+}
+
+void Synthesizer::setSegmentCount(size_t count)
+{
+    std::lock_guard<std::mutex> l(mSegmentMutex);
+    mCurrentSegment = 0;
+    mIsPushing = false;
+    mIsCacheFailed = false;
+    mSegmentData.clear();
+    mSegmentData.resize(count);
+    mSegmentEnd.assign(count, false);
+}
+
+// called from the vendor thread, waits for the media thread while the buffer is full
+void Synthesizer::pushData(size_t segment, char* data, int len)
+{
+    // a cancelled leader goes on synthesizing for the channels sharing its audio
+    if (mIsStop || mIsEnd || len <= 0 || (mIsCancel && !mShared)) {
+        return;
+    }
+    touch();
+    mSlot->addIn(len);
+    mSlot->markVendorEvent();
+    std::unique_lock<std::mutex> l(mSegmentMutex);
+    if (segment >= mSegmentEnd.size()) {
+        return;
+    }
+    // a later segment, or another vendor thread is pushing and this audio must follow what it pushes
+    if (segment != mCurrentSegment || mIsPushing) {
+        stage(segment, data, len);
+        return;
+    }
+    mIsPushing = true;
+    l.unlock();
+    pushBytes(data, len);
+    l.lock();
+    if (!advance(l)) {
+        return;
+    }
+    l.unlock();
+    finish();
+}
+
+// called with mSegmentMutex held
+void Synthesizer::stage(size_t segment, const char* data, int len)
+{
+    if (!mSegmentData[segment]) {
+        mSegmentData[segment].reset(new SpillBuffer());
+    }
+    SpillBuffer& buffer = *mSegmentData[segment];
+    // once spilled a segment stays on disk, its data must come back in order
+    if (!buffer.isSpilled() && mStagedBytes + len <= mStageSize && BufferBudget::TryAcquire(len)) {
+        buffer.appendMemory(data, len);
+        mStagedBytes += len;
+        return;
+    }
+    if (!buffer.appendFile(mSpillDir, data, len)) {
+        WARNLN("drop staged audio, segment:%zu len:%d channelId:%s voiceId:%s", segment, len, mChannelId.c_str(), mVoiceId.c_str());
+    }
+}
+
+void Synthesizer::pushBytes(const char* data, int len)
+{
+    if (len <= 0) {
+        return;
+    }
+    if (mHasCarryByte) {
+        char pair[2] = { mCarryByte, data[0] };
+        mHasCarryByte = false;
+        pushSamples((const int16_t*)pair, 1);
+        data++;
+        len--;
+    }
+    if (len % 2) {
+        mCarryByte = data[len - 1];
+        mHasCarryByte = true;
+    }
+    pushSamples((const int16_t*)data, len / 2);
+}
+
+void Synthesizer::pushSamples(const int16_t* samples, size_t count)
+{
+    if (mResampler) {
+        mResampler->process(samples, count, mResampled);
+        samples = mResampled.data();
+        count = mResampled.size();
+    }
+    if (mShared && mShared->append(samples, count) < count && !mIsSharedFull) {
+        mIsSharedFull = true;
+        WARNLN("shared audio is full, followers are cut short, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
+    }
+    if (mIsCacheFill) {
+        if (mCacheFill.size() + count <= PromptCache::MaxEntrySamples()) {
+            mCacheFill.insert(mCacheFill.end(), samples, samples + count);
+        } else {
+            mIsCacheFill = false;
+            std::vector<int16_t>().swap(mCacheFill);
+        }
+    }
+    if (mIsCacheOnly) {
+        return;
+    }
+    // a full ring blocks the vendor callback, which stops reading the vendor stream until playout
+    // catches up. It sleeps on mSpaceCv until the media thread pops, the timeout only bounds a lost wakeup
+    bool isWaiting = false;
+    while (count > 0 && !mIsStop && !mIsCancel) {
+        size_t n = mAudioData->push(samples, count);
+        samples += n;
+        count -= n;
+        mPushed += n;
+        if (count > 0) {
+            if (!isWaiting) {
+                isWaiting = true;
+                sBackpressure++;
+            }
+            std::unique_lock<std::mutex> l(mSpaceMutex);
+            mIsWaitingSpace = true;
+            mSpaceCv.wait_for(l, std::chrono::milliseconds(20), [this]() {
+                return mAudioData->available() > 0 || mIsStop || mIsCancel;
+            });
+            mIsWaitingSpace = false;
+            l.unlock();
+            // waiting on playout is progress, the watchdog must not take it for a stalled vendor
+            touch();
+        }
+    }
+}
+
+void Synthesizer::wakePush()
+{
+    if (!mIsWaitingSpace) {
         return;
     }
-    mAudioData.insert(mAudioData.end(), data, data + len);
-    mCv.notify_all();
+    // taking the lock orders the wakeup after the waiter's check of the ring
+    std::lock_guard<std::mutex> l(mSpaceMutex);
+    mSpaceCv.notify_all();
+}
+
+void Synthesizer::onSynthesisEnd(size_t segment)
+{
+    mSlot->markVendorEvent();
+    std::unique_lock<std::mutex> l(mSegmentMutex);
+    if (segment >= mSegmentEnd.size() || mSegmentEnd[segment]) {
+        return;
+    }
+    mSegmentEnd[segment] = true;
+    // the thread pushing right now moves past this segment once its push is done
+    if (mIsPushing) {
+        return;
+    }
+    mIsPushing = true;
+    if (!advance(l)) {
+        return;
+    }
+    l.unlock();
+    finish();
+}
+
+// called with mSegmentMutex held by the thread which set mIsPushing, the lock is dropped around every push
+// so the other vendor threads only ever wait for it to stage their audio, not for the ring or the disk
+bool Synthesizer::advance(std::unique_lock<std::mutex>& l)
+{
+    for (;;) {
+        if (mIsCacheFailed) {
+            mIsCacheFill = false;
+        }
+        // staged while another thread was pushing, or before the segment became current
+        if (mCurrentSegment < mSegmentData.size() && mSegmentData[mCurrentSegment]) {
+            std::unique_ptr<SpillBuffer> buffer;
+            buffer.swap(mSegmentData[mCurrentSegment]);
+            size_t memory = buffer->memorySize();
+            l.unlock();
+            buffer->drain([this](const char* data, size_t len) {
+                pushBytes(data, len);
+            });
+            BufferBudget::Release(memory);
+            l.lock();
+            mStagedBytes -= memory;
+            continue;
+        }
+        if (mCurrentSegment >= mSegmentEnd.size() || !mSegmentEnd[mCurrentSegment]) {
+            break;
+        }
+        // move on to the next segment still being synthesized
+        size_t part = mSegmentPart[mCurrentSegment];
+        if (mParts[part].lastSegment == mCurrentSegment) {
+            mPartEnd[part].store(mPushed, std::memory_order_release);
+        }
+        mCurrentSegment++;
+    }
+    mIsPushing = false;
+    return mCurrentSegment >= mSegmentEnd.size();
+}
+
+void Synthesizer::onSynthesisFail(size_t segment)
+{
+    {
+        // the pushing thread owns mIsCacheFill, it drops the fill on its way through advance()
+        std::lock_guard<std::mutex> l(mSegmentMutex);
+        mIsCacheFailed = true;
+    }
+    onSynthesisEnd(segment);
+}
+
+void Synthesizer::finish()
+{
+    // already ended by the watchdog, audio after that point was dropped
+    if (mIsEnd.exchange(true)) {
+        return;
+    }
+    if (mShared && !mSharedLeader) {
+        mShared->finish();
+        leaveInflight();
+    }
+    // the vendor is done, its slot is free before playout ends, or kept for the channel's next SPEAK
+    park(std::atomic_exchange(&mTicket, Admission::Ticket()));
+    if (mIsCacheFill && !mIsStop && (!mIsCancel || mShared)) {
+        INFOLN("put prompt cache, samples:%zu channelId:%s voiceId:%s", mCacheFill.size(), mChannelId.c_str(), mVoiceId.c_str());
+        PromptCache::Put(mCacheKey, std::move(mCacheFill));
+        mIsCacheFill = false;
+    }
 }
 
-void Synthesizer::onSynthesisEnd()
+bool Synthesizer::setCompleteSignaled()
 {
-    std::unique_lock<std::mutex> l(mMutex);
-    mIsEnd = true;
-    mAudioData.insert(mAudioData.end(), 160 * 5, 0);
-    mCv.notify_all();
+    return !mCompleteSignaled.exchange(true);
 }
@@ -2,46 +2,136 @@
 
 #include "log/Log.h"
 #include "ini/IniParser.h"
+#include "ring/SpscRingBuffer.h"
+#include "arena/Arena.h"
+#include "admission/Admission.h"
+#include "session/SessionTable.h"
+#include "dsp/Resampler.h"
+#include "dsp/TimeStretch.h"
+#include "PromptCache.h"
+#include "SpillBuffer.h"
+#include "SharedAudio.h"
+#include "worker/BackgroundWorker.h"
+#include <atomic>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <vector>
-#include <deque>
 
 struct demo_synth_channel_t;
 
 #define SYNTHESIZER_TYPE_TENCENT "tencent"
 
-class Synthesizer {
+class Synthesizer : public std::enable_shared_from_this<Synthesizer> {
 public:
     enum SynthesizerType {
         NONE,
         TENCENT
     };
+    /** encoding of the frames handed to the media engine */
+    enum Encoding {
+        LPCM,
+        PCMU,
+        PCMA
+    };
 
-    static std::shared_ptr<Synthesizer> Create(string channelId);
+    /** the session publishes itself in table, an admitted vendor session is opened on startWorker
+        and torn down on stopWorker, both owned by the engine */
+    static std::shared_ptr<Synthesizer> Create(string channelId, SessionTable* table, BackgroundWorker* startWorker, BackgroundWorker* stopWorker);
 
-    virtual ~Synthesizer() = default;
+    virtual ~Synthesizer();
     void setSynthChannel(demo_synth_channel_t* val);
     void setVoiceName(string val);
     void setText(string val);
+    /** negotiated stream codec, LPCM at 8k/16k or PCMU/PCMA */
+    void setFormat(const string& codecName, int sampleRate);
+    /** Prosody-Rate and Prosody-Volume as factors, applied locally so all variants share one synthesis */
+    void setProsody(float rate, float volume);
     string getVoiceId();
+    string getChannelId();
+    demo_synth_channel_t* getSynthChannel();
+    /** ms since the session was created, and since the vendor or the media thread last touched it */
+    int64_t getAge();
+    int64_t getIdleTime();
+    /** synthesize into the prompt cache only, nothing is played */
+    void setCacheOnly(bool val);
+    /** order of the session among those waiting for a vendor slot, LIVE by default */
+    void setPriority(Admission::Priority val);
+    bool isEnd();
+    string getCacheKey();
 
+    /** play from the prompt cache when possible, otherwise init() a vendor session once the backend admits it */
+    int start();
     virtual int init() = 0;
     virtual void stop() = 0;
+    /** stop playback and discard buffered audio from the next read, safe from any thread */
+    void cancel();
 
+    /** one codec frame, size is in bytes of the negotiated encoding */
     virtual int read(char* buff, int size);
-    virtual void pushData(char* data, int len);
-    virtual void onSynthesisEnd();
+    /** audio of a text segment, segments may be synthesized ahead and are played in order */
+    virtual void pushData(size_t segment, char* data, int len);
+    virtual void onSynthesisEnd(size_t segment);
+    virtual void onSynthesisFail(size_t segment);
+    /** error code of the vendor, a quota error takes the account out of rotation */
+    void onVendorError(int code);
+    bool setCompleteSignaled();
 
     static string GetVoiceId(string channelId);
     static std::shared_ptr<Synthesizer> GetSynthesizer(string voiceId);
     static void Del(string channelId, string voiceId);
     static void Del(string channelId);
     static void Set(string channelId, std::shared_ptr<Synthesizer> val);
+    /** sessions in the map, for the reaper */
+    static std::vector<std::shared_ptr<Synthesizer>> GetAll();
+    /** remove the session, whichever channel it is mapped from, and release it */
+    static void Reap(std::shared_ptr<Synthesizer> synthesizer);
+    /** cancel at once, the vendor session is stopped and released on the background worker */
+    static void Release(std::shared_ptr<Synthesizer> synthesizer);
+    static string GetConfigFile();
+    /** give back the slots kept for channels past their linger time, called periodically from the engine timers */
+    static void ExpireParked();
+    /** the channel's SPEAK completed, the kept slot lingers from now on rather than from the vendor's end */
+    static void RenewParked(const string& channelId);
+    /** the channel is open, a slot may be kept for it from now on */
+    static void OpenParked(const string& channelId);
+    /** the channel is closed, the slot kept for it is given back and none is kept any more */
+    static void DropParked(const string& channelId);
 
 protected:
     void loadConfig();
+    int readSamples(int16_t* out, size_t samples, size_t* filled = nullptr);
+    int readStretched(int16_t* out, size_t samples);
+    void initBuffer();
+    bool buildParts();
+    void addTextPart(const string& text);
+    void addAudioPart(const int16_t* data, size_t samples, std::shared_ptr<const void> holder);
+    void addClipPart(PromptCache::Audio clip);
+    void addSilencePart(int time);
+    void setSegmentCount(size_t count);
+    void pushBytes(const char* data, int len);
+    void pushSamples(const int16_t* samples, size_t count);
+    void stage(size_t segment, const char* data, int len);
+    /** push what was staged for the current segments and mark their ends, true once every segment ended */
+    bool advance(std::unique_lock<std::mutex>& l);
+    bool joinInflight();
+    void leadInflight();
+    void leaveInflight();
+    void finish();
+    void touch();
+    /** wake the vendor thread waiting in pushSamples for room in the ring */
+    void wakePush();
+    void onAdmitted(Admission::Ticket ticket);
+    void setTicket(Admission::Ticket ticket);
+    /** drop the wait for admission or give the slot back */
+    void leaveAdmission();
+    /** end a session which got no vendor session, what is already buffered still plays */
+    void failSegments();
+    /** keep the slot of an ended LIVE session for the channel's next SPEAK, for mSlotLinger ms */
+    void park(Admission::Ticket ticket);
+    /** the slot kept for the channel, empty when there is none or its account left rotation */
+    static Admission::Ticket Unpark(const string& channelId);
+    static int64_t NowMs();
 
 protected:
     static string sConfigFile;
@@ -51,13 +141,133 @@ protected:
     string mVoiceId;
     string mVoiceName;
     string mText;
+    /** plugin side bookkeeping of the session, released together with it */
+    Arena mArena;
+    /** row of the session in the engine's session table, for mrcpmod-top */
+    SessionTable::Slot* mSlot = SessionTable::Scratch();
+    /** engine workers, a session without them runs the jobs in the caller */
+    BackgroundWorker* mStartWorker = nullptr;
+    BackgroundWorker* mStopWorker = nullptr;
+    /** held by the worker jobs around init() and stop(), which run on different workers */
+    std::mutex mWorkerMutex;
 
     std::mutex mMutex;
-    std::condition_variable mCv;
-    bool mIsStop = false;
-    bool mIsEnd = false;
-    std::deque<char> mAudioData;
+    std::atomic<bool> mIsStop { false };
+    std::atomic<bool> mIsCancel { false };
+    std::atomic<bool> mIsEnd { false };
+    /** pcm samples, pushed by the vendor thread and read by the media thread */
+    std::unique_ptr<SpscRingBuffer<int16_t>> mAudioData;
+    /** a vendor thread waits here while the ring is full, the media thread signals after a pop */
+    std::mutex mSpaceMutex;
+    std::condition_variable mSpaceCv;
+    std::atomic<bool> mIsWaitingSpace { false };
+    /** rate of everything buffered and played, the negotiated one */
+    int mSampleRate = 8000;
+    /** rate requested from the vendor, resampled to mSampleRate when they differ */
+    int mVendorSampleRate = 8000;
+    std::unique_ptr<Resampler> mResampler;
+    std::vector<int16_t> mResampled;
+    Encoding mEncoding = LPCM;
+    /** pcm rendered before G.711 encoding, media thread only */
+    std::vector<int16_t> mFrame;
+    float mProsodyRate = 1.0f;
+    float mProsodyVolume = 1.0f;
+    /** local prosody stage, media thread only */
+    std::unique_ptr<TimeStretch> mStretch;
+    std::vector<int16_t> mStretchIn;
+    bool mIsStretchEnd = false;
+    int mSpeed = 0;
+    int mVolume = 0;
+    string mCodec = "pcm";
+    int mBufferTime = 0;
+    /** bytes of the ring buffer taken from BufferBudget */
+    size_t mBufferBytes = 0;
+    int mSegmentLength = 0;
+    string mAudioDir;
+
+    /** one piece of the playout, text is synthesized, recordings and silence are played in place */
+    struct Part {
+        enum Type {
+            TEXT,
+            AUDIO,
+            SILENCE,
+            /** audio of another channel's synthesis of the same prompt, read from mShared */
+            SHARED,
+            /** compressed prompt cache entry, decoded a block at a time */
+            CLIP
+        };
+        Type type = TEXT;
+        /** AUDIO: samples played straight from the mapping or cache entry */
+        const int16_t* data = nullptr;
+        size_t samples = 0;
+        std::shared_ptr<const void> holder;
+        PromptCache::Audio clip;
+        /** TEXT: last vendor segment of the part */
+        size_t lastSegment = 0;
+    };
+    /** built by start(), read-only afterwards */
+    std::vector<Part, ArenaAllocator<Part>> mParts { ArenaAllocator<Part>(&mArena) };
+    /** TEXT: samples pushed when the part was fully synthesized, -1 before */
+    std::unique_ptr<std::atomic<int64_t>[]> mPartEnd;
+    /** playout position, media thread only */
+    size_t mPart = 0;
+    size_t mPartPos = 0;
+    size_t mPopped = 0;
+    /** CLIP: the decoded block of part mPart, media thread only */
+    std::vector<int16_t> mBlock;
+    size_t mBlockIndex = SIZE_MAX;
+    /** samples pushed to mAudioData, by the thread holding mIsPushing */
+    size_t mPushed = 0;
+    /** text of the vendor segments and the part each belongs to */
+    std::vector<string, ArenaAllocator<string>> mSegments { ArenaAllocator<string>(&mArena) };
+    std::vector<size_t, ArenaAllocator<size_t>> mSegmentPart { ArenaAllocator<size_t>(&mArena) };
+
+    std::mutex mSegmentMutex;
+    /** segment whose audio goes straight to mAudioData */
+    size_t mCurrentSegment = 0;
+    /** a vendor thread is pushing to mAudioData without the lock, the others stage meanwhile */
+    bool mIsPushing = false;
+    /** a segment failed, the pushing thread gives up the cache fill */
+    bool mIsCacheFailed = false;
+    /** audio of later segments, staged until they become current */
+    std::vector<std::unique_ptr<SpillBuffer>, ArenaAllocator<std::unique_ptr<SpillBuffer>>> mSegmentData { ArenaAllocator<std::unique_ptr<SpillBuffer>>(&mArena) };
+    /** staged bytes held in memory, the rest is spilled to mSpillDir */
+    size_t mStagedBytes = 0;
+    size_t mStageSize = 0;
+    string mSpillDir;
+    std::vector<bool, ArenaAllocator<bool>> mSegmentEnd { ArenaAllocator<bool>(&mArena) };
+    /** odd byte left over from the previous vendor chunk */
+    char mCarryByte = 0;
+    bool mHasCarryByte = false;
+    int64_t mCreated = NowMs();
+    std::atomic<int64_t> mLastActivity { 0 };
+    /** last frame taken by the media thread */
+    std::atomic<int64_t> mLastRead { 0 };
+    std::atomic<bool> mCompleteSignaled { false };
+    int mWatchdogTimeout = 0;
+    uint32_t mUnderrunCount = 0;
+    /** prompt cache miss, filled by the vendor thread while streaming */
+    string mCacheKey;
+    std::vector<int16_t> mCacheFill;
+    bool mIsCacheFill = false;
+    bool mIsCacheOnly = false;
+    /** same prompt synthesized once for all channels playing it at the same time */
+    bool mIsCoalesce = false;
+    int mCoalesceMaxTime = 0;
+    /** leader: every sample synthesized is appended here, follower: played from here */
+    std::shared_ptr<SharedAudio> mShared;
+    /** follower: keeps the leader, and its vendor session, alive while reading */
+    std::shared_ptr<Synthesizer> mSharedLeader;
+    bool mIsSharedFull = false;
     SynthesizerType mSynthesizerType = NONE;
+    /** vendor backend the session counts against, <type>_tts */
+    string mBackend;
+    Admission::Priority mPriority = Admission::LIVE;
+    /** set by start() or the background worker, given back by finish() or stop(), use the atomic_ functions */
+    Admission::Ticket mTicket;
+    uint64_t mWaitId = 0;
+    /** ms the slot is kept for the channel after the session ends, 0 gives it back at once */
+    int mSlotLinger = 0;
     std::shared_ptr<IniParser> mIniParser;
     std::string mAppId;
     std::string mSecretId;
@@ -66,4 +276,17 @@ protected:
     static std::mutex sMutex;
     static map<string, string> sChannelIdMap;
     static map<string, std::shared_ptr<Synthesizer>> sMap;
+    /** leaders by cache key, while they synthesize */
+    static std::mutex sInflightMutex;
+    static map<string, std::weak_ptr<Synthesizer>> sInflight;
+    /** slots kept for channels between SPEAKs, by channelId. Open channels have an entry, which
+        holds a ticket while a slot is kept */
+    struct Parked {
+        Admission::Ticket ticket;
+        string backend;
+        int64_t until = 0;
+        int linger = 0;
+    };
+    static std::mutex sParkedMutex;
+    static map<string, Parked> sParked;
 };
@@ -3,6 +3,22 @@
 #include <exception>
 #include <mutex>
 
+#define DEFAULT_SEGMENT_PARALLEL 2
+
+std::mutex TencentSynthesizer::sSessionMutex;
+map<string, std::pair<std::weak_ptr<Synthesizer>, size_t>> TencentSynthesizer::sSessionMap;
+
+std::shared_ptr<Synthesizer> TencentSynthesizer::GetSynthesizer(string sessionId, size_t& segment)
+{
+    std::lock_guard<std::mutex> l(sSessionMutex);
+    auto it = sSessionMap.find(sessionId);
+    if (it == sSessionMap.end()) {
+        return nullptr;
+    }
+    segment = it->second.second;
+    return it->second.first.lock();
+}
+
 void OnSynthesisStart(SpeechSynthesisResponse* rsp)
 {
     INFOLN("OnSynthesisStart, voiceId:%s", rsp->session_id.c_str());
@@ -12,12 +28,14 @@ void OnSynthesisFail(SpeechSynthesisResponse* rsp)
 {
     string voiceId = rsp->session_id;
     INFOLN("OnSynthesisFail, voiceId:%s code:%d msg:%s", rsp->session_id.c_str(), rsp->code, rsp->message.c_str());
-    auto synthesizer = Synthesizer::GetSynthesizer(voiceId);
+    size_t segment = 0;
+    auto synthesizer = TencentSynthesizer::GetSynthesizer(voiceId, segment);
     if (!synthesizer) {
         WARNLN("synthesizer is NULL when OnSynthesisEnd, voiceId:%s", voiceId.c_str());
         return;
     }
-    synthesizer->onSynthesisEnd();
+    synthesizer->onVendorError(rsp->code);
+    synthesizer->onSynthesisFail(segment);
 }
 
 // 文本结果回调
@@ -43,11 +61,12 @@ void OnAudioResult(SpeechSynthesisResponse* rsp)
 {
     string voiceId = rsp->session_id;
     std::string& audio_data = rsp->data;
-    auto synthesizer = Synthesizer::GetSynthesizer(voiceId);
+    size_t segment = 0;
+    auto synthesizer = TencentSynthesizer::GetSynthesizer(voiceId, segment);
     if (!synthesizer) {
         return;
     }
-    synthesizer->pushData((char*)audio_data.c_str(), audio_data.size());
+    synthesizer->pushData(segment, (char*)audio_data.c_str(), audio_data.size());
 }
 
 // 识别完成回调
@@ -56,15 +75,16 @@ void OnSynthesisEnd(SpeechSynthesisResponse* rsp)
     string voiceId = rsp->session_id;
     std::string& audio_data = rsp->data;
     INFOLN("OnSynthesisEnd, voiceId:%s audio_data len:%d", rsp->session_id.c_str(), audio_data.size());
-    auto synthesizer = Synthesizer::GetSynthesizer(voiceId);
+    size_t segment = 0;
+    auto synthesizer = TencentSynthesizer::GetSynthesizer(voiceId, segment);
     if (!synthesizer) {
         WARNLN("synthesizer is NULL when OnSynthesisEnd, voiceId:%s", voiceId.c_str());
         return;
     }
     if (audio_data.size() > 0) {
-        synthesizer->pushData((char*)audio_data.c_str(), audio_data.size());
+        synthesizer->pushData(segment, (char*)audio_data.c_str(), audio_data.size());
     }
-    synthesizer->onSynthesisEnd();
+    synthesizer->onSynthesisEnd(segment);
 }
 
 TencentSynthesizer::~TencentSynthesizer()
@@ -75,14 +95,44 @@ TencentSynthesizer::~TencentSynthesizer()
 
 int TencentSynthesizer::init()
 {
-    loadConfig();
-    SpeechSynthesizer* synthesizer = new SpeechSynthesizer(mAppId, mSecretId, mSecretKey, mVoiceId);
+    mIniParser->get("generic", "synth_segment_parallel", mSegmentParallel);
+    if (mSegmentParallel <= 0) {
+        mSegmentParallel = DEFAULT_SEGMENT_PARALLEL;
+    }
+    size_t count = mSegments.size();
+    mSessionIds.resize(count);
+    mSpeechSynthesizers.resize(count);
+    mSegmentDone.assign(count, false);
+    mSegmentsStarted = 1;
+    INFOLN("synthesizer start segments, segments:%zu channelId:%s voiceId:%s", count, mChannelId.c_str(), mVoiceId.c_str());
+    // first segment synchronously so start errors reach the SPEAK, the rest pipelined behind it
+    if (startSegment(0) < 0) {
+        return -1;
+    }
+    if (count > 1) {
+        mSegmentThread = std::thread(&TencentSynthesizer::runSegments, this, std::weak_ptr<Synthesizer>(shared_from_this()));
+    }
+    return 0;
+}
+
+int TencentSynthesizer::startSegment(size_t segment)
+{
+    // the first segment keeps the voiceId as vendor session id, so logs line up
+    string sessionId = mVoiceId;
+    if (segment > 0) {
+        sessionId = boost::uuids::to_string(boost::uuids::random_generator()());
+    }
+    mSessionIds[segment] = sessionId;
+    {
+        std::lock_guard<std::mutex> l(sSessionMutex);
+        sSessionMap[sessionId] = std::make_pair(std::weak_ptr<Synthesizer>(shared_from_this()), segment);
+    }
+    SpeechSynthesizer* synthesizer = new SpeechSynthesizer(mAppId, mSecretId, mSecretKey, sessionId);
     synthesizer->SetOnSynthesisStart(OnSynthesisStart);
     synthesizer->SetOnSynthesisFail(OnSynthesisFail);
     synthesizer->SetOnSynthesisEnd(OnSynthesisEnd);
     synthesizer->SetOnTextResult(OnTextResult);
     synthesizer->SetOnAudioResult(OnAudioResult);
-    mAudioData.insert(mAudioData.end(), 160 * 5, 0);
 
     uint64_t voiceType = 1001;
     try {
@@ -91,34 +141,100 @@ int TencentSynthesizer::init()
         WARNLN("voiceName do not convert to long, voiceType:%ld voiceName:%s err:%s", voiceType, mVoiceName.c_str(), e.what());
     }
     synthesizer->SetVoiceType(voiceType);
-    synthesizer->SetCodec("pcm");
-    synthesizer->SetSampleRate(8000);
-    synthesizer->SetSpeed(0);
-    synthesizer->SetVolume(0);
-    synthesizer->SetText(mText);
+    synthesizer->SetCodec(mCodec);
+    synthesizer->SetSampleRate(mVendorSampleRate);
+    synthesizer->SetSpeed(mSpeed);
+    synthesizer->SetVolume(mVolume);
+    synthesizer->SetText(mSegments[segment]);
     synthesizer->SetEnableSubtitle(true);
-    INFOLN("begin synthesizer start, voiceType:%ld channelId:%s voiceId:%s", voiceType, mChannelId.c_str(), mVoiceId.c_str());
+    INFOLN("begin synthesizer start, segment:%zu voiceType:%ld channelId:%s voiceId:%s sessionId:%s", segment, voiceType, mChannelId.c_str(), mVoiceId.c_str(), sessionId.c_str());
+    touch();
     int ret = synthesizer->Start();
     if (ret < 0) {
-        ERRLN("synthesizer start failed, ret:%d channelId:%s voiceId:%s", ret, mChannelId.c_str(), mVoiceId.c_str());
+        ERRLN("synthesizer start failed, ret:%d segment:%zu channelId:%s voiceId:%s", ret, segment, mChannelId.c_str(), mVoiceId.c_str());
+        std::lock_guard<std::mutex> l(sSessionMutex);
+        sSessionMap.erase(sessionId);
         delete synthesizer;
         return -1;
     }
-    INFOLN("end synthesizer start, channelId:%s voiceId:%s", mChannelId.c_str(), mVoiceId.c_str());
-    mSpeechSynthesizer.reset(synthesizer);
+    INFOLN("end synthesizer start, segment:%zu channelId:%s voiceId:%s", segment, mChannelId.c_str(), mVoiceId.c_str());
+    std::lock_guard<std::mutex> l(mMutex);
+    mSpeechSynthesizers[segment].reset(synthesizer);
+    if (mIsStop) {
+        synthesizer->Stop("user stop");
+    }
     return 0;
 }
 
-void TencentSynthesizer::stop()
+void TencentSynthesizer::runSegments(std::weak_ptr<Synthesizer> weak)
+{
+    for (size_t i = 1; i < mSegments.size(); i++) {
+        {
+            // no reference is held while waiting, a destructor on another thread stops and joins this one
+            std::unique_lock<std::mutex> l(mMutex);
+            mSegmentCv.wait(l, [this] { return mIsStop || mSegmentsStarted - mSegmentsDone < (size_t)mSegmentParallel; });
+            if (mIsStop) {
+                return;
+            }
+            mSegmentsStarted++;
+        }
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        if (startSegment(i) < 0) {
+            // skip it, the segments behind it still play in order
+            onSynthesisFail(i);
+        }
+        // the last reference may be this one, then the session was destroyed here and detached the thread
+        self.reset();
+        if (weak.expired()) {
+            return;
+        }
+    }
+}
+
+void TencentSynthesizer::onSynthesisEnd(size_t segment)
 {
+    Synthesizer::onSynthesisEnd(segment);
     std::lock_guard<std::mutex> l(mMutex);
-    if (mIsStop) {
-        return;
+    if (segment < mSegmentDone.size() && !mSegmentDone[segment]) {
+        mSegmentDone[segment] = true;
+        mSegmentsDone++;
+        mSegmentCv.notify_all();
+    }
+}
+
+void TencentSynthesizer::stop()
+{
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        if (mIsStop) {
+            return;
+        }
+        mIsStop = true;
+        mSegmentCv.notify_all();
+    }
+    wakePush();
+    if (mSegmentThread.joinable()) {
+        // only the segment thread itself detaches, when it dropped the last reference,
+        // it touches nothing of the session afterwards. Any other thread waits for it
+        if (mSegmentThread.get_id() == std::this_thread::get_id()) {
+            mSegmentThread.detach();
+        } else {
+            mSegmentThread.join();
+        }
+    }
+    for (size_t i = 0; i < mSpeechSynthesizers.size(); i++) {
+        if (mSpeechSynthesizers[i]) {
+            INFOLN("stop tencent synthesizer, segment:%zu channelId:%s", i, mChannelId.c_str());
+            mSpeechSynthesizers[i]->Stop("user stop");
+        }
     }
-    mIsStop = true;
-    if (mSpeechSynthesizer) {
-        INFOLN("stop tencent recognize, channelId:%s", mChannelId.c_str());
-        mSpeechSynthesizer->Stop("user stop");
+    // the account's slot is free once the vendor sessions on it are closed
+    leaveAdmission();
+    std::lock_guard<std::mutex> l(sSessionMutex);
+    for (auto& sessionId : mSessionIds) {
+        sSessionMap.erase(sessionId);
     }
-    mCv.notify_all();
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Synthesizer.h"
+#include <condition_variable>
+#include <thread>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <time.h>
@@ -20,7 +22,28 @@ public:
     ~TencentSynthesizer();
     virtual int init();
     virtual void stop();
+    virtual void onSynthesisEnd(size_t segment);
+
+    /** find the synthesizer and text segment a vendor session belongs to */
+    static std::shared_ptr<Synthesizer> GetSynthesizer(string sessionId, size_t& segment);
 
 private:
-    std::unique_ptr<SpeechSynthesizer> mSpeechSynthesizer;
+    int startSegment(size_t segment);
+    /** holds the session only while starting a segment, so it never keeps it alive on its own */
+    void runSegments(std::weak_ptr<Synthesizer> weak);
+
+    /** one vendor session per text segment */
+    std::vector<string> mSessionIds;
+    std::vector<std::unique_ptr<SpeechSynthesizer>> mSpeechSynthesizers;
+    int mSegmentParallel = 0;
+    /** segments started and ended, guarded by mMutex */
+    size_t mSegmentsStarted = 0;
+    std::vector<bool> mSegmentDone;
+    size_t mSegmentsDone = 0;
+    std::condition_variable mSegmentCv;
+    /** starts the segments after the first one, at most mSegmentParallel in flight */
+    std::thread mSegmentThread;
+
+    static std::mutex sSessionMutex;
+    static map<string, std::pair<std::weak_ptr<Synthesizer>, size_t>> sSessionMap;
 };
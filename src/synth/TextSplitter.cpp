@@ -0,0 +1,79 @@
+#include "TextSplitter.h"
+#include <cctype>
+#include <cstring>
+
+static const char* const SENTENCE_MARKS[] = { "。", "！", "？", "；", "…", "!", "?", ";", "\n", nullptr };
+static const char* const CLAUSE_MARKS[] = { "，", "、", "：", ",", ":", nullptr };
+
+std::vector<string> TextSplitter::Split(const string& text, size_t maxLen)
+{
+    std::vector<string> segments;
+    string sentence;
+    for (size_t i = 0; i < text.size();) {
+        size_t len = MarkLength(text, i, SENTENCE_MARKS);
+        // an ascii period ends a sentence only before whitespace or the end, not in 3.14
+        if (len == 0 && text[i] == '.' && (i + 1 == text.size() || isspace((unsigned char)text[i + 1]))) {
+            len = 1;
+        }
+        if (len == 0) {
+            sentence.push_back(text[i++]);
+            continue;
+        }
+        sentence.append(text, i, len);
+        i += len;
+        SplitLong(sentence, maxLen, segments);
+        sentence.clear();
+    }
+    SplitLong(sentence, maxLen, segments);
+    return segments;
+}
+
+size_t TextSplitter::MarkLength(const string& text, size_t pos, const char* const* marks)
+{
+    for (; *marks; marks++) {
+        size_t len = strlen(*marks);
+        if (text.compare(pos, len, *marks) == 0) {
+            return len;
+        }
+    }
+    return 0;
+}
+
+void TextSplitter::SplitLong(const string& sentence, size_t maxLen, std::vector<string>& out)
+{
+    size_t begin = 0;
+    while (begin < sentence.size()) {
+        size_t end = sentence.size();
+        if (maxLen > 0 && end - begin > maxLen) {
+            // cut after the last clause mark that fits, else at the length limit
+            end = 0;
+            for (size_t i = begin; i < begin + maxLen;) {
+                size_t len = MarkLength(sentence, i, CLAUSE_MARKS);
+                i += len ? len : 1;
+                if (len && i <= begin + maxLen) {
+                    end = i;
+                }
+            }
+            if (end == 0) {
+                end = Utf8Boundary(sentence, begin + maxLen);
+            }
+            if (end <= begin) {
+                end = begin + maxLen;
+            }
+        }
+        string segment = sentence.substr(begin, end - begin);
+        if (segment.find_first_not_of(" \t\r\n") != string::npos) {
+            out.push_back(segment);
+        }
+        begin = end;
+    }
+}
+
+size_t TextSplitter::Utf8Boundary(const string& text, size_t pos)
+{
+    // step back over continuation bytes 10xxxxxx
+    while (pos > 0 && pos < text.size() && ((unsigned char)text[pos] & 0xC0) == 0x80) {
+        pos--;
+    }
+    return pos;
+}
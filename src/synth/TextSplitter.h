@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+using std::string;
+
+/**
+ * Splits a SPEAK body into sentences, and sentences longer than maxLen bytes into clauses,
+ * so synthesis can start on the first sentence. Splits never cut a utf-8 sequence.
+ */
+class TextSplitter {
+public:
+    static std::vector<string> Split(const string& text, size_t maxLen);
+
+private:
+    static size_t MarkLength(const string& text, size_t pos, const char* const* marks);
+    static void SplitLong(const string& sentence, size_t maxLen, std::vector<string>& out);
+    static size_t Utf8Boundary(const string& text, size_t pos);
+};
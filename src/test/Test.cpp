@@ -0,0 +1,762 @@
+/*
+ * Tests of the plugin's session logic and of its self-contained parts (rings, codecs, parsers,
+ * admission, timers), run outside the server:
+ *     mrcpmod_test [--filter name]
+ * Vendor sessions are stood in for by subclasses which take the vendor's part by hand, every case
+ * prints PASS or FAIL and the exit code is the number of failed cases.
+ */
+#include "PreRoll.h"
+#include "Recognize.h"
+#include "SsmlParser.h"
+#include "Synthesizer.h"
+#include "TextSplitter.h"
+#include "admission/Admission.h"
+#include "ini/IniParser.h"
+#include "dsp/G711.h"
+#include "dsp/ImaAdpcm.h"
+#include "dsp/Resampler.h"
+#include "dsp/TimeStretch.h"
+#include "ring/SpscRingBuffer.h"
+#include "session/SessionTable.h"
+#include "timer/TimerWheel.h"
+#include "worker/BackgroundWorker.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace {
+
+#define TEST_CONFIG_FILE "/tmp/mrcpmod_test.ini"
+
+struct Case {
+    string name;
+    std::function<void()> run;
+};
+
+int sFailures = 0;
+
+#define CHECK(expr)                                                                  \
+    do {                                                                             \
+        if (!(expr)) {                                                               \
+            fprintf(stderr, "    %s:%d check failed: %s\n", __FILE__, __LINE__, #expr); \
+            sFailures++;                                                             \
+            return;                                                                  \
+        }                                                                            \
+    } while (0)
+
+void WriteConfig()
+{
+    std::ofstream ofs(TEST_CONFIG_FILE);
+    ofs << "[generic]\n"
+        << "type=test\n"
+        << "synth_buffer_time=10000\n"
+        << "synth_coalesce=0\n"
+        << "synth_watchdog_timeout=3600000\n"
+        << "[test]\n"
+        << "appid=1234567890\n"
+        << "sample_rates=8000\n";
+}
+
+/** the test plays the vendor: pushData() and onSynthesisEnd() are called by hand, the playout is read back */
+class TestSynthesizer : public Synthesizer {
+public:
+    explicit TestSynthesizer(const string& channelId)
+    {
+        mChannelId = channelId;
+        mVoiceId = channelId;
+        mIniParser = std::make_shared<IniParser>();
+        mIniParser->setFileName(TEST_CONFIG_FILE);
+    }
+    int init() override
+    {
+        // a vendor session starting, as far as the watchdog is concerned
+        touch();
+        return 0;
+    }
+    void stop() override
+    {
+    }
+    void push(size_t segment, int16_t value, size_t samples)
+    {
+        std::vector<int16_t> data(samples, value);
+        pushData(segment, (char*)data.data(), (int)(samples * sizeof(int16_t)));
+    }
+    /** the samples played, underrun silence left out, until the playout ends */
+    std::vector<int16_t> play(size_t frame, const std::function<bool()>& isDone = nullptr)
+    {
+        std::vector<int16_t> out;
+        std::vector<int16_t> buff(frame);
+        for (;;) {
+            // a playout stuck after the vendor is done gives up rather than spin
+            bool isVendorDone = isDone && isDone();
+            size_t filled = 0;
+            if (readSamples(buff.data(), frame, &filled) < 0) {
+                break;
+            }
+            out.insert(out.end(), buff.begin(), buff.begin() + filled);
+            if (filled == 0 && isVendorDone) {
+                break;
+            }
+            if (filled == 0) {
+                std::this_thread::yield();
+            }
+        }
+        return out;
+    }
+};
+
+/** the test plays the vendor and the engine: only the turn's arming is driven, nothing is sent */
+class TestRecognize : public Recognize {
+public:
+    int init() override
+    {
+        return 0;
+    }
+    void stop() override
+    {
+    }
+    int write(char* buff, int len) override
+    {
+        return len;
+    }
+    void flush() override
+    {
+    }
+    using Recognize::takeTurn;
+};
+
+/** runs of equal samples, e.g. 1,1,0,2 gives { 1, 2 }, { 0, 1 }, { 2, 1 } */
+std::vector<std::pair<int16_t, size_t>> Runs(const std::vector<int16_t>& samples)
+{
+    std::vector<std::pair<int16_t, size_t>> runs;
+    for (int16_t sample : samples) {
+        if (runs.empty() || runs.back().first != sample) {
+            runs.emplace_back(sample, 0);
+        }
+        runs.back().second++;
+    }
+    return runs;
+}
+
+// text, a break of 20ms at 8k, text: two vendor segments with 160 silent samples between them
+#define TEST_SSML "<speak>first<break time=\"20ms\"/>second</speak>"
+#define TEST_BREAK_SAMPLES 160
+
+std::vector<Case> MakeCases()
+{
+    std::vector<Case> cases;
+
+    // the next part's audio is in the ring before the reader reaches the end of the current part
+    cases.push_back(Case { "synth_part_boundary", []() {
+        auto synthesizer = std::make_shared<TestSynthesizer>("test-boundary");
+        synthesizer->setText(TEST_SSML);
+        synthesizer->setFormat("LPCM", 8000);
+        CHECK(synthesizer->start() == 0);
+        synthesizer->push(0, 1, 1000);
+        // staged while segment 0 is current, moved into the ring right after part 0's end is marked
+        synthesizer->push(1, 2, 700);
+        synthesizer->onSynthesisEnd(0);
+        synthesizer->onSynthesisEnd(1);
+        auto runs = Runs(synthesizer->play(97));
+        CHECK(runs.size() == 3);
+        CHECK(runs[0].first == 1 && runs[0].second == 1000);
+        CHECK(runs[1].first == 0 && runs[1].second == TEST_BREAK_SAMPLES);
+        CHECK(runs[2].first == 2 && runs[2].second == 700);
+    } });
+
+    // same while the vendor thread pushes, the reader must never run into the next part early
+    cases.push_back(Case { "synth_part_boundary_threaded", []() {
+        for (int i = 0; i < 1000; i++) {
+            auto synthesizer = std::make_shared<TestSynthesizer>("test-boundary-" + std::to_string(i));
+            synthesizer->setText(TEST_SSML);
+            synthesizer->setFormat("LPCM", 8000);
+            CHECK(synthesizer->start() == 0);
+            std::atomic<bool> isDone { false };
+            std::thread vendor([&]() {
+                for (int n = 0; n < 10; n++) {
+                    synthesizer->push(0, 1, 37);
+                    synthesizer->push(1, 2, 41);
+                }
+                synthesizer->onSynthesisEnd(0);
+                for (int n = 0; n < 10; n++) {
+                    synthesizer->push(1, 2, 41);
+                }
+                synthesizer->onSynthesisEnd(1);
+                isDone = true;
+            });
+            auto runs = Runs(synthesizer->play(160, [&]() { return isDone.load(); }));
+            vendor.join();
+            CHECK(runs.size() == 3);
+            CHECK(runs[0].first == 1 && runs[0].second == 370);
+            CHECK(runs[1].first == 0 && runs[1].second == TEST_BREAK_SAMPLES);
+            CHECK(runs[2].first == 2 && runs[2].second == 820);
+        }
+    } });
+
+    // every sample pushed is stretched, the output is input / rate, plus at most the window's tail
+    cases.push_back(Case { "stretch_flush_length", []() {
+        static const float rates[] = { 0.5f, 0.8f, 1.25f, 2.0f };
+        static const size_t lengths[] = { 100, 1000, 8000, 12345 };
+        for (float rate : rates) {
+            for (size_t length : lengths) {
+                TimeStretch stretch(8000, rate);
+                std::vector<int16_t> in(length);
+                for (size_t i = 0; i < length; i++) {
+                    in[i] = (int16_t)(8000 * sin(i * 0.1));
+                }
+                int16_t frame[160];
+                size_t out = 0;
+                for (size_t i = 0; i < length; i += 160) {
+                    stretch.push(&in[i], std::min((size_t)160, length - i));
+                    while (size_t n = stretch.pop(frame, 160)) {
+                        out += n;
+                    }
+                }
+                stretch.flush();
+                while (size_t n = stretch.pop(frame, 160)) {
+                    out += n;
+                }
+                double expected = length / rate;
+                // 30ms window at 8k
+                CHECK(out >= expected && out <= expected + 240);
+            }
+        }
+    } });
+
+    // a continuous turn in partial mode: partial matches go out and leave it armed, the final one
+    // disarms it, and results up to the next RECOGNIZE are dropped
+    cases.push_back(Case { "recog_continuous_partial", []() {
+        auto recognize = std::make_shared<TestRecognize>();
+        recognize->setContinuous(true, 0);
+        recognize->setPartial(true);
+        for (int turn = 0; turn < 2; turn++) {
+            recognize->arm();
+            for (int n = 0; n < 3; n++) {
+                CHECK(recognize->takeTurn(false));
+                CHECK(recognize->isArmed());
+            }
+            CHECK(recognize->takeTurn(true));
+            CHECK(!recognize->isArmed());
+            CHECK(!recognize->takeTurn(false));
+            CHECK(!recognize->takeTurn(true));
+        }
+    } });
+
+    // keepalive frames between turns are no activity, session_max_idle reaps a stream left disarmed
+    cases.push_back(Case { "recog_disarmed_idle", []() {
+        auto recognize = std::make_shared<TestRecognize>();
+        recognize->setContinuous(true, 1);
+        recognize->arm();
+        CHECK(recognize->takeTurn(true));
+        char frame[320] = { 0 };
+        usleep(30000);
+        for (int n = 0; n < 5; n++) {
+            recognize->onAudio(frame, sizeof(frame));
+            usleep(2000);
+        }
+        CHECK(recognize->getIdleTime() >= 30);
+        recognize->arm();
+        recognize->onAudio(frame, sizeof(frame));
+        CHECK(recognize->getIdleTime() < 30);
+    } });
+
+    // both engines publish a table in one process, closing one leaves the other's alone
+    cases.push_back(Case { "session_table_per_engine", []() {
+        string prefix = "/mrcpmod_test_" + std::to_string(getpid());
+        SessionTable recog;
+        SessionTable synth;
+        CHECK(recog.open(prefix + "-recog", 4));
+        CHECK(synth.open(prefix + "-synth", 4));
+        SessionTable::Slot* recogSlot = recog.acquire("channel-1", "voice-1", "test_asr");
+        SessionTable::Slot* synthSlot = synth.acquire("channel-1", "voice-2", "test_tts");
+        CHECK(recogSlot != SessionTable::Scratch() && synthSlot != SessionTable::Scratch());
+        std::vector<SessionTable::Row> rows;
+        CHECK(SessionTable::Read(prefix + "-recog", rows));
+        CHECK(rows.size() == 1 && rows[0].voiceId == "voice-1");
+        CHECK(SessionTable::Read(prefix + "-synth", rows));
+        CHECK(rows.size() == 1 && rows[0].voiceId == "voice-2");
+        recog.close();
+        CHECK(!SessionTable::Read(prefix + "-recog", rows));
+        CHECK(SessionTable::Read(prefix + "-synth", rows));
+        CHECK(rows.size() == 1);
+        SessionTable::Release(recogSlot);
+        SessionTable::Release(synthSlot);
+        synth.close();
+    } });
+
+    // a job blocked on the vendor holds up neither the next job nor the other engine's worker
+    cases.push_back(Case { "worker_blocked_job", []() {
+        BackgroundWorker stopWorker(2);
+        BackgroundWorker otherWorker(1);
+        std::atomic<bool> isRelease { false };
+        std::atomic<int> done { 0 };
+        stopWorker.post([&isRelease]() {
+            for (int i = 0; i < 2000 && !isRelease; i++) {
+                usleep(1000);
+            }
+        });
+        stopWorker.post([&done]() { done++; });
+        otherWorker.post([&done]() { done++; });
+        otherWorker.stop();
+        for (int i = 0; i < 1000 && done < 2; i++) {
+            usleep(1000);
+        }
+        bool isDone = done == 2;
+        isRelease = true;
+        stopWorker.stop();
+        CHECK(isDone);
+        // an engine opened again restarts its worker, stop runs what was posted
+        stopWorker.post([&done]() { done++; });
+        stopWorker.stop();
+        CHECK(done == 3);
+    } });
+
+    // the capacity rounds up to a power of two, reads and writes wrap in order and stop at full or empty
+    cases.push_back(Case { "ring_wrap", []() {
+        SpscRingBuffer<int> ring(6);
+        CHECK(ring.capacity() == 8);
+        int in[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+        int out[8] = { 0 };
+        CHECK(ring.push(in, 5) == 5);
+        CHECK(ring.pop(out, 3) == 3);
+        CHECK(out[0] == 0 && out[2] == 2);
+        // head at 5, tail at 3: 6 items fit, the write wraps
+        CHECK(ring.available() == 6);
+        CHECK(ring.push(in, 8) == 6);
+        CHECK(ring.push(in, 1) == 0);
+        CHECK(ring.size() == 8);
+        CHECK(ring.pop(out, 8) == 8);
+        int expected[8] = { 3, 4, 0, 1, 2, 3, 4, 5 };
+        CHECK(memcmp(out, expected, sizeof(out)) == 0);
+        CHECK(ring.pop(out, 1) == 0);
+        // peek stops at the wrap point, consume releases what was looked at
+        CHECK(ring.push(in, 6) == 6);
+        const int* data = nullptr;
+        size_t n = ring.peek(&data);
+        CHECK(n == 5 && data[0] == 0 && data[4] == 4);
+        ring.consume(n);
+        n = ring.peek(&data);
+        CHECK(n == 1 && data[0] == 5);
+        ring.clear();
+        CHECK(ring.size() == 0 && ring.available() == 8);
+    } });
+
+    // one producer and one consumer thread, every item arrives once and in order
+    cases.push_back(Case { "ring_threaded", []() {
+        static const int COUNT = 1000000;
+        SpscRingBuffer<int> ring(64);
+        std::thread producer([&ring]() {
+            int next = 0;
+            int chunk[7];
+            while (next < COUNT) {
+                int n = std::min(7, COUNT - next);
+                for (int i = 0; i < n; i++) {
+                    chunk[i] = next + i;
+                }
+                int pushed = 0;
+                while (pushed < n) {
+                    pushed += (int)ring.push(chunk + pushed, n - pushed);
+                }
+                next += n;
+            }
+        });
+        int expected = 0;
+        bool isOrdered = true;
+        int chunk[13];
+        while (expected < COUNT) {
+            size_t n = ring.pop(chunk, 13);
+            for (size_t i = 0; i < n; i++) {
+                isOrdered = isOrdered && chunk[i] == expected;
+                expected++;
+            }
+        }
+        producer.join();
+        CHECK(isOrdered);
+        CHECK(ring.size() == 0);
+    } });
+
+    // the least recently used entry goes first, entries bigger than the entry limit are not kept
+    cases.push_back(Case { "prompt_cache_lru", []() {
+        // three entries of 100 pcm samples fit
+        PromptCache::Configure(600, 400, false);
+        CHECK(PromptCache::MakeKey("  hello \n world ", "101", 8000, 0, 0, "pcm") == PromptCache::MakeKey("hello world", "101", 8000, 0, 0, "pcm"));
+        CHECK(PromptCache::MakeKey("hello", "101", 8000, 0, 0, "pcm") != PromptCache::MakeKey("hello", "101", 16000, 0, 0, "pcm"));
+        PromptCache::Put("a", std::vector<int16_t>(100, 1));
+        PromptCache::Put("b", std::vector<int16_t>(100, 2));
+        PromptCache::Put("c", std::vector<int16_t>(100, 3));
+        auto a = PromptCache::Get("a");
+        CHECK(a && a->samples == 100 && a->pcm[0] == 1);
+        PromptCache::Put("d", std::vector<int16_t>(100, 4));
+        bool isEvicted = !PromptCache::Contains("b");
+        bool isKept = PromptCache::Contains("a") && PromptCache::Contains("c") && PromptCache::Contains("d");
+        PromptCache::Put("e", std::vector<int16_t>(201, 5));
+        bool isTooBig = !PromptCache::Contains("e");
+        // an entry handed out stays valid after its eviction
+        PromptCache::Configure(0, 0, false);
+        bool isCleared = !PromptCache::Contains("a");
+        CHECK(isEvicted && isKept && isTooBig && isCleared);
+        CHECK(a->pcm[99] == 1);
+    } });
+
+    // sentences end at their marks, long ones are cut after a clause mark, else on a utf-8 boundary
+    cases.push_back(Case { "text_split", []() {
+        auto segments = TextSplitter::Split("你好。今天天气不错！Pi is 3.14 today. ok\n \n", 0);
+        CHECK(segments.size() == 4);
+        CHECK(segments[0] == "你好。" && segments[1] == "今天天气不错！");
+        CHECK(segments[2] == "Pi is 3.14 today." && segments[3] == " ok\n");
+        segments = TextSplitter::Split("一二三，四五六，七八九", 12);
+        CHECK(segments.size() == 3);
+        CHECK(segments[0] == "一二三，" && segments[1] == "四五六，" && segments[2] == "七八九");
+        segments = TextSplitter::Split("一二三四五", 7);
+        CHECK(segments.size() == 3);
+        CHECK(segments[0] == "一二" && segments[1] == "三四" && segments[2] == "五");
+        CHECK(TextSplitter::Split(" \n", 0).empty());
+    } });
+
+    // text of unknown elements is kept, breaks, recordings and sentence elements split the items
+    cases.push_back(Case { "ssml_parse", []() {
+        string body = "<?xml version=\"1.0\"?><speak>Hello &amp; <emphasis>welcome</emphasis><break time=\"1.5s\"/>"
+                      "<audio src=\"beep.wav\">a beep</audio><!-- <break/> --><s>Say <sub alias=\"World Wide Web\">WWW</sub> &#x4F60;</s>"
+                      "<break strength=\"weak\"/></speak>";
+        CHECK(SsmlParser::IsSsml("  " + body));
+        CHECK(!SsmlParser::IsSsml("Hello <b>"));
+        std::vector<SsmlParser::Item> items;
+        CHECK(SsmlParser::Parse(body, items));
+        CHECK(items.size() == 5);
+        CHECK(items[0].type == SsmlParser::Item::TEXT && items[0].text == "Hello & welcome");
+        CHECK(items[1].type == SsmlParser::Item::BREAK && items[1].time == 1500);
+        CHECK(items[2].type == SsmlParser::Item::AUDIO && items[2].src == "beep.wav" && items[2].text == "a beep");
+        CHECK(items[3].type == SsmlParser::Item::TEXT && items[3].text == "Say World Wide Web 你");
+        CHECK(items[4].type == SsmlParser::Item::BREAK && items[4].time == 250);
+        items.clear();
+        CHECK(!SsmlParser::Parse("<speak>cut <break", items));
+    } });
+
+    // the table encoders agree with the reference ones for every sample
+    cases.push_back(Case { "g711_tables", []() {
+        CHECK(G711::LinearToUlaw(0) == 0xFF && G711::LinearToAlaw(0) == 0xD5);
+        CHECK(G711::LinearToUlaw(32767) == 0x80 && G711::LinearToUlaw(-32768) == 0x00);
+        std::vector<int16_t> in(65536);
+        for (size_t i = 0; i < in.size(); i++) {
+            in[i] = (int16_t)(i - 32768);
+        }
+        std::vector<uint8_t> ulaw(in.size());
+        std::vector<uint8_t> alaw(in.size());
+        G711::EncodeUlaw(in.data(), ulaw.data(), in.size());
+        G711::EncodeAlaw(in.data(), alaw.data(), in.size());
+        for (size_t i = 0; i < in.size(); i++) {
+            CHECK(ulaw[i] == G711::LinearToUlaw(in[i]));
+            CHECK(alaw[i] == G711::LinearToAlaw(in[i]));
+        }
+    } });
+
+    // output length follows the rate ratio, chunking does not change the output, dc passes at unity gain
+    cases.push_back(Case { "resampler_stream", []() {
+        static const int rates[][2] = { { 8000, 16000 }, { 16000, 8000 }, { 16000, 24000 } };
+        for (auto& rate : rates) {
+            std::vector<int16_t> in(4800);
+            for (size_t i = 0; i < in.size(); i++) {
+                in[i] = (int16_t)(10000 + 3000 * sin(i * 2 * M_PI * 300 / rate[0]));
+            }
+            Resampler whole(rate[0], rate[1]);
+            std::vector<int16_t> expected;
+            whole.process(in.data(), in.size(), expected);
+            CHECK(expected.size() == in.size() * rate[1] / rate[0]);
+            Resampler chunked(rate[0], rate[1]);
+            std::vector<int16_t> out;
+            std::vector<int16_t> chunk;
+            for (size_t i = 0, n = 1; i < in.size(); i += n, n = n % 97 + 13) {
+                chunked.process(&in[i], std::min(n, in.size() - i), chunk);
+                out.insert(out.end(), chunk.begin(), chunk.end());
+            }
+            CHECK(out == expected);
+            Resampler dc(rate[0], rate[1]);
+            std::vector<int16_t> level(1000, 10000);
+            dc.process(level.data(), level.size(), out);
+            CHECK(abs(out.back() - 10000) < 100);
+        }
+    } });
+
+    // every block decodes on its own, block starts are exact and the rest tracks the input closely
+    cases.push_back(Case { "adpcm_round_trip", []() {
+        size_t count = ImaAdpcm::BLOCK_SAMPLES * 2 + 100;
+        std::vector<int16_t> in(count);
+        for (size_t i = 0; i < count; i++) {
+            in[i] = (int16_t)(12000 * sin(i * 2 * M_PI * 440 / 8000) + 4000 * sin(i * 2 * M_PI * 1700 / 8000));
+        }
+        size_t blocks = ImaAdpcm::BlockCount(count);
+        CHECK(blocks == 3);
+        std::vector<uint8_t> adpcm(blocks * ImaAdpcm::BLOCK_BYTES);
+        ImaAdpcm::Encode(in.data(), count, adpcm.data());
+        std::vector<int16_t> out(blocks * ImaAdpcm::BLOCK_SAMPLES);
+        // out of order, as a seeking reader would
+        for (size_t block : { 2, 0, 1 }) {
+            ImaAdpcm::DecodeBlock(&adpcm[block * ImaAdpcm::BLOCK_BYTES], &out[block * ImaAdpcm::BLOCK_SAMPLES]);
+        }
+        double error = 0;
+        double signal = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (i % ImaAdpcm::BLOCK_SAMPLES == 0) {
+                CHECK(out[i] == in[i]);
+            }
+            error += (double)(out[i] - in[i]) * (out[i] - in[i]);
+            signal += (double)in[i] * in[i];
+        }
+        // about 20 dB with a 1700 Hz component at 8k, the 4 bit step adapts slowly to it
+        CHECK(error * 30 < signal);
+        // the padding after the last sample decodes close to silence
+        CHECK(abs(out.back()) < 500);
+        // a compressed cache entry holds whole blocks, a quarter of the pcm plus padding, and decodes the same
+        PromptCache::Configure(1 << 20, 1 << 20, true);
+        PromptCache::Put("adpcm", std::vector<int16_t>(in));
+        auto clip = PromptCache::Get("adpcm");
+        PromptCache::Configure(0, 0, false);
+        CHECK(clip && clip->isCompressed() && clip->samples == count);
+        CHECK(clip->bytes() == blocks * ImaAdpcm::BLOCK_BYTES);
+        std::vector<int16_t> block(ImaAdpcm::BLOCK_SAMPLES);
+        PromptCache::Decode(*clip, 1, block.data());
+        CHECK(std::equal(block.begin(), block.end(), out.begin() + ImaAdpcm::BLOCK_SAMPLES));
+    } });
+
+    // waiters are admitted by priority then arrival, a full queue drops its newest lower priority waiter
+    cases.push_back(Case { "admission_queue", []() {
+        Admission::Account account;
+        account.credential.name = "test";
+        account.limit = 1;
+        Admission::Configure("test_queue", { account }, 2, 50, {}, 0);
+        std::vector<string> events;
+        std::vector<Admission::Ticket> admitted;
+        auto waiter = [&events, &admitted](const string& name) {
+            return [&events, &admitted, name](Admission::Ticket ticket) {
+                events.push_back(name + (ticket ? ":admitted" : ":rejected"));
+                admitted.push_back(ticket);
+            };
+        };
+        Admission::Ticket first;
+        Admission::Ticket ticket;
+        uint64_t firstId = 0;
+        uint64_t warmupId = 0;
+        uint64_t liveId = 0;
+        uint64_t lateId = 0;
+        CHECK(Admission::Acquire("test_queue", Admission::LIVE, first, waiter("first"), &firstId) == Admission::ADMITTED);
+        CHECK(Admission::Acquire("test_queue", Admission::WARMUP, ticket, waiter("warmup"), &warmupId) == Admission::QUEUED);
+        CHECK(Admission::Acquire("test_queue", Admission::LIVE, ticket, waiter("live"), &liveId) == Admission::QUEUED);
+        CHECK(Admission::HasWaiters("test_queue"));
+        CHECK(Admission::Acquire("test_queue", Admission::LIVE, ticket, waiter("late"), &lateId) == Admission::QUEUED);
+        CHECK(events.size() == 1 && events[0] == "warmup:rejected");
+        CHECK(Admission::Acquire("test_queue", Admission::WARMUP, ticket, waiter("none"), &warmupId) == Admission::REJECTED);
+        CHECK(!ticket);
+        // the slot goes to the oldest live waiter, outside any lock so the callback may acquire again
+        first = nullptr;
+        CHECK(events.size() == 2 && events[1] == "live:admitted" && admitted[1]);
+        CHECK(Admission::Cancel("test_queue", lateId));
+        CHECK(!Admission::Cancel("test_queue", lateId));
+        CHECK(!Admission::HasWaiters("test_queue"));
+        uint64_t expireId = 0;
+        CHECK(Admission::Acquire("test_queue", Admission::LIVE, ticket, waiter("expire"), &expireId) == Admission::QUEUED);
+        usleep(60000);
+        Admission::Expire();
+        CHECK(events.size() == 3 && events[2] == "expire:rejected");
+        CHECK(!Admission::HasWaiters("test_queue"));
+    } });
+
+    // sessions spread over the accounts by weight, a quota error takes an account out for a while
+    cases.push_back(Case { "admission_pool", []() {
+        Admission::Account light;
+        light.credential.name = "light";
+        Admission::Account heavy;
+        heavy.credential.name = "heavy";
+        heavy.weight = 3;
+        Admission::Configure("test_pool", { light, heavy }, 0, 0, { 4001 }, 50);
+        std::vector<Admission::Ticket> tickets;
+        int lightCount = 0;
+        for (int i = 0; i < 8; i++) {
+            Admission::Ticket ticket;
+            uint64_t waitId = 0;
+            CHECK(Admission::Acquire("test_pool", Admission::LIVE, ticket, nullptr, &waitId) == Admission::ADMITTED);
+            lightCount += ticket->credential().name == "light" ? 1 : 0;
+            tickets.push_back(ticket);
+        }
+        CHECK(lightCount == 2);
+        Admission::Ticket lightTicket;
+        Admission::Ticket heavyTicket;
+        for (auto& ticket : tickets) {
+            (ticket->credential().name == "light" ? lightTicket : heavyTicket) = ticket;
+        }
+        CHECK(Admission::OnError(lightTicket, 1) == Admission::IGNORED);
+        CHECK(Admission::OnError(lightTicket, 4001) == Admission::SUSPENDED);
+        CHECK(!Admission::IsUsable(lightTicket));
+        // the last account in rotation is kept
+        CHECK(Admission::OnError(heavyTicket, 4001) == Admission::KEPT);
+        CHECK(Admission::IsUsable(heavyTicket));
+        tickets.clear();
+        lightTicket = nullptr;
+        for (int i = 0; i < 4; i++) {
+            Admission::Ticket ticket;
+            uint64_t waitId = 0;
+            CHECK(Admission::Acquire("test_pool", Admission::LIVE, ticket, nullptr, &waitId) == Admission::ADMITTED);
+            CHECK(ticket->credential().name == "heavy");
+            tickets.push_back(ticket);
+        }
+        usleep(60000);
+        Admission::Ticket ticket;
+        uint64_t waitId = 0;
+        CHECK(Admission::Acquire("test_pool", Admission::LIVE, ticket, nullptr, &waitId) == Admission::ADMITTED);
+        CHECK(ticket->credential().name == "light");
+    } });
+
+    // input ends on the term char, at maxlength or after the interdigit timeout, short input is no match
+    cases.push_back(Case { "dtmf_digits", []() {
+        DtmfCollector invalid;
+        CHECK(!invalid.parse("builtin:speech/digits"));
+        CHECK(!invalid.parse("builtin:dtmf/digits?minlength=4;maxlength=2"));
+        CHECK(!invalid.parse("builtin:dtmf/digits?size=2"));
+        DtmfCollector dtmf;
+        CHECK(dtmf.parse("builtin:dtmf/digits?minlength=2;maxlength=4"));
+        dtmf.setTermChar('#');
+        dtmf.setInterdigitTimeout(3000);
+        CHECK(DtmfCollector::ToChar(11) == '#' && DtmfCollector::ToChar(16) == 0);
+        // event 11 is '#'
+        CHECK(dtmf.add(1, 1000) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.add(11, 1500) == DtmfCollector::NO_MATCH);
+        dtmf.reset();
+        CHECK(!dtmf.hasInput());
+        CHECK(dtmf.add(1, 1000) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.add(2, 1500) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.add(11, 2000) == DtmfCollector::MATCH);
+        CHECK(dtmf.getDigits() == "12");
+        dtmf.reset();
+        for (int key = 5; key < 8; key++) {
+            CHECK(dtmf.add(key, 1000) == DtmfCollector::COLLECTING);
+        }
+        CHECK(dtmf.add(8, 1000) == DtmfCollector::MATCH);
+        CHECK(dtmf.getDigits() == "5678");
+        // the interdigit timeout counts from the last digit
+        dtmf.reset();
+        CHECK(dtmf.check(100000) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.add(9, 1000) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.check(3999) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.check(4000) == DtmfCollector::NO_MATCH);
+        CHECK(dtmf.add(0, 4500) == DtmfCollector::COLLECTING);
+        CHECK(dtmf.check(7500) == DtmfCollector::MATCH);
+        CHECK(dtmf.getDigits() == "90");
+        // a key outside the digits grammar
+        dtmf.reset();
+        CHECK(dtmf.add(10, 1000) == DtmfCollector::NO_MATCH);
+    } });
+
+    // timers on every level cascade down and fire within a tick of their due time, cancelled ones never
+    cases.push_back(Case { "timer_wheel_cascade", []() {
+        static const int64_t TICK = 10;
+        static const int COUNT = 2000;
+        TimerWheel wheel(TICK);
+        int64_t now = 1000;
+        std::vector<int64_t> due(COUNT);
+        std::vector<int64_t> fired(COUNT, -1);
+        std::vector<TimerWheel::Id> ids(COUNT);
+        uint32_t seed = 12345;
+        for (int i = 0; i < COUNT; i++) {
+            seed = seed * 1103515245 + 12345;
+            // up to 700s, past the 65536 ticks of the second level
+            int64_t delay = i < 10 ? i : (seed >> 8) % 700000;
+            due[i] = now + delay;
+            ids[i] = wheel.schedule(now, delay, [&fired, &now, i]() { fired[i] = now; });
+        }
+        for (int i = 0; i < COUNT; i += 3) {
+            CHECK(wheel.cancel(ids[i]));
+            CHECK(!wheel.cancel(ids[i]));
+        }
+        CHECK(wheel.size() == COUNT - (COUNT + 2) / 3);
+        // a callback scheduling again, into the node it just left
+        int rescheduled = 0;
+        wheel.schedule(now, 25, [&]() { wheel.schedule(now, 25, [&rescheduled]() { rescheduled++; }); });
+        int64_t end = now + 700000 + 100;
+        while (now < end) {
+            now += TICK;
+            wheel.advance(now);
+        }
+        CHECK(wheel.size() == 0);
+        CHECK(rescheduled == 1);
+        for (int i = 0; i < COUNT; i++) {
+            if (i % 3 == 0) {
+                CHECK(fired[i] < 0);
+                continue;
+            }
+            CHECK(fired[i] >= due[i] && fired[i] < due[i] + TICK);
+            CHECK(!wheel.cancel(ids[i]));
+        }
+    } });
+
+    // the backlog rewinds into held audio, reads wrap in one piece, overrun backlog is counted as lost
+    cases.push_back(Case { "preroll_rewind", []() {
+        PreRoll preroll(10);
+        auto read = [&preroll](size_t max) {
+            size_t len = 0;
+            const char* data = preroll.read(max, len);
+            return data ? string(data, len) : string();
+        };
+        preroll.push("abcdef", 6);
+        CHECK(preroll.begin("voice-1", 1));
+        CHECK(!preroll.begin("voice-1", 1));
+        CHECK(preroll.begin("voice-1", 2));
+        preroll.rewind(4);
+        CHECK(preroll.backlog() == 4);
+        CHECK(read(3) == "cde" && read(10) == "f" && read(10).empty());
+        preroll.push("ghijklm", 7);
+        CHECK(read(10) == "ghijklm");
+        // no more than the ring holds
+        preroll.rewind(100);
+        CHECK(read(100) == "defghijklm");
+        // a frame larger than the ring keeps its tail
+        preroll.skip();
+        preroll.push("0123456789AB", 12);
+        CHECK(preroll.takeLost() == 2 && preroll.takeLost() == 0);
+        CHECK(read(10) == "23456789AB");
+        preroll.push("wxyz", 4);
+        preroll.push("12345678", 8);
+        CHECK(preroll.backlog() == 10 && preroll.takeLost() == 2);
+        CHECK(read(10) == "yz12345678");
+        preroll.push("abc", 3);
+        preroll.push("0123456789", 10);
+        preroll.rewind(5);
+        CHECK(preroll.takeLost() == 0 && read(10) == "56789");
+    } });
+
+    return cases;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    string filter;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--filter name]\n", argv[0]);
+            return 1;
+        }
+    }
+    WriteConfig();
+    int failed = 0;
+    for (auto& c : MakeCases()) {
+        if (!filter.empty() && c.name.find(filter) == string::npos) {
+            continue;
+        }
+        int before = sFailures;
+        c.run();
+        bool isPass = sFailures == before;
+        failed += isPass ? 0 : 1;
+        printf("%s %s\n", isPass ? "PASS" : "FAIL", c.name.c_str());
+    }
+    unlink(TEST_CONFIG_FILE);
+    return failed;
+}
@@ -0,0 +1,142 @@
+/*
+ * Live view of the sessions the engines of a running server publish, read from shared memory so
+ * the server does no work for it:
+ *     mrcpmod-top [--name table] [--sort age|backlog] [--interval ms] [--once]
+ * The recognizer and synthesizer tables are /<table>-recog and /<table>-synth, session_table in config.ini.
+ */
+#include "session/SessionTable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Options {
+    string name = "mrcpmod";
+    string sort = "age";
+    int interval = 1000;
+    bool once = false;
+};
+
+struct Entry {
+    const char* engine;
+    SessionTable::Row row;
+};
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--once") {
+            options.once = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        string value = argv[++i];
+        if (arg == "--name") {
+            options.name = value;
+        } else if (arg == "--sort" && (value == "age" || value == "backlog")) {
+            options.sort = value;
+        } else if (arg == "--interval") {
+            options.interval = std::max(atoi(value.c_str()), 100);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** bytes as B, K or M, to fit a column */
+string FormatBytes(int64_t bytes)
+{
+    char buff[32];
+    if (bytes < 10 * 1024) {
+        snprintf(buff, sizeof(buff), "%lldB", (long long)bytes);
+    } else if (bytes < 10 * 1024 * 1024) {
+        snprintf(buff, sizeof(buff), "%lldK", (long long)(bytes / 1024));
+    } else {
+        snprintf(buff, sizeof(buff), "%lldM", (long long)(bytes / (1024 * 1024)));
+    }
+    return buff;
+}
+
+/** ms before now as seconds, - when it never happened */
+string FormatSince(int64_t now, int64_t time)
+{
+    if (time <= 0) {
+        return "-";
+    }
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%.1f", (now - time) / 1000.0);
+    return buff;
+}
+
+int Show(const Options& options)
+{
+    std::vector<Entry> entries;
+    std::vector<SessionTable::Row> rows;
+    int tables = 0;
+    static const char* sEngines[] = { "recog", "synth" };
+    for (const char* engine : sEngines) {
+        if (!SessionTable::Read("/" + options.name + "-" + engine, rows)) {
+            continue;
+        }
+        tables++;
+        for (auto& row : rows) {
+            entries.push_back(Entry { engine, row });
+        }
+    }
+    // oldest or most backed up first
+    if (options.sort == "backlog") {
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.row.depth > b.row.depth;
+        });
+    } else {
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.row.created < b.row.created;
+        });
+    }
+    int64_t now = SessionTable::NowMs();
+    if (!options.once) {
+        fputs("\033[H\033[2J", stdout);
+    }
+    printf("mrcpmod-top  tables:%d sessions:%zu sort:%s\n\n", tables, entries.size(), options.sort.c_str());
+    printf("%-6s %-9s %8s %8s %8s %8s %8s %-12s %-36s %s\n", "ENGINE", "STATE", "AGE", "VENDOR", "IN", "OUT", "BACKLOG", "BACKEND", "VOICE", "CHANNEL");
+    for (auto& entry : entries) {
+        const SessionTable::Row& row = entry.row;
+        printf("%-6s %-9s %8s %8s %8s %8s %8s %-12s %-36s %s\n", entry.engine, SessionTable::StateName(row.state),
+            FormatSince(now, row.created).c_str(), FormatSince(now, row.lastVendorEvent).c_str(),
+            FormatBytes(row.bytesIn).c_str(), FormatBytes(row.bytesOut).c_str(), FormatBytes(row.depth).c_str(),
+            row.backend.c_str(), row.voiceId.c_str(), row.channelId.c_str());
+    }
+    fflush(stdout);
+    return tables;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--name table] [--sort age|backlog] [--interval ms] [--once]\n", argv[0]);
+        return 1;
+    }
+    if (options.once) {
+        if (Show(options) == 0) {
+            fprintf(stderr, "no session table found, name:%s\n", options.name.c_str());
+            return 1;
+        }
+        return 0;
+    }
+    for (;;) {
+        Show(options);
+        usleep(options.interval * 1000);
+    }
+    return 0;
+}